@@ -12,6 +12,8 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include "../microsocks/shmstats.h"
+#include "../microsocks/logring.h"
 
 @interface ViewController ()
 
@@ -20,8 +22,6 @@
 @implementation ViewController
 
 extern int socks_main(int argc, const char** argv);
-extern void custom_log(const char *format, ...);
-extern void update_traffic_stats_ui(uint64_t uploadBytes, uint64_t downloadBytes);
 static ViewController *sharedInstance = nil;
 
 #define MAX_LOG_LINES 1000
@@ -30,9 +30,8 @@ static uint64_t lastUploadBytes = 0;
 static uint64_t lastDownloadBytes = 0;
 static NSDate *lastUpdateTime = nil;
 static NSTimer *statsUpdateTimer;
-static uint64_t pending_upload_bytes = 0;
-static uint64_t pending_download_bytes = 0;
-static pthread_mutex_t pending_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static NSTimer *logPollTimer;
+static NSUInteger logLineCount = 0;
 
 - (NSString *)formatBytes:(uint64_t)bytes {
     if (bytes < 1024) return [NSString stringWithFormat:@"%llu B", bytes];
@@ -78,24 +77,6 @@ static pthread_mutex_t pending_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
     lastUpdateTime = now;
 }
 
-void update_traffic_stats_ui(uint64_t uploadBytes, uint64_t downloadBytes) {
-    pthread_mutex_lock(&pending_stats_mutex);
-    pending_upload_bytes = uploadBytes;
-    pending_download_bytes = downloadBytes;
-    pthread_mutex_unlock(&pending_stats_mutex);
-}
-void custom_log(const char *format, ...) {
-    char buffer[1024];
-    va_list args;
-    va_start(args, format);
-    vsnprintf(buffer, sizeof(buffer), format, args);
-    va_end(args);
-    
-    [ViewController logFromC:buffer];
-    // Also write to stderr for Xcode console
-    fprintf(stderr, "%s\n", buffer);
-}
-
 - (void)viewDidLoad {
     [super viewDidLoad];
     sharedInstance = self;
@@ -196,6 +177,13 @@ void custom_log(const char *format, ...) {
                                                     userInfo:nil
                                                      repeats:YES];
     
+    // Log lines are collected from the core's ring buffer in batches
+    logPollTimer = [NSTimer scheduledTimerWithTimeInterval:0.25
+                                                    target:self
+                                                  selector:@selector(drainLog)
+                                                  userInfo:nil
+                                                   repeats:YES];
+    
     // 確保初始文本也使用正確的字體
     NSMutableAttributedString *initialText = [[NSMutableAttributedString alloc] initWithString:@""];
     [initialText addAttribute:NSFontAttributeName 
@@ -211,71 +199,99 @@ void custom_log(const char *format, ...) {
 
 - (void)logMessage:(NSString *)message {
     NSLog(@"%@", message);
-    dispatch_async(dispatch_get_main_queue(), ^{
-        NSString *timestamp = [NSDateFormatter localizedStringFromDate:[NSDate date] 
-                                                          dateStyle:NSDateFormatterNoStyle 
-                                                          timeStyle:NSDateFormatterMediumStyle];
-        
-        NSMutableAttributedString *attributedMessage = [[NSMutableAttributedString alloc] init];
-        
-        // Timestamp in gray
-        NSAttributedString *timeString = [[NSAttributedString alloc] 
-            initWithString:[NSString stringWithFormat:@"[%@]", timestamp]
-            attributes:@{NSForegroundColorAttributeName: [UIColor grayColor]}];
-        [attributedMessage appendAttributedString:timeString];
-        
-        // Message with color based on content
-        UIColor *messageColor;
-        if ([message containsString:@"Error"] || [message containsString:@"Failed"] || [message containsString:@"failed"]) {
-            messageColor = [UIColor redColor];
-        } else if ([message containsString:@"connected"] || [message containsString:@"Successfully"]) {
-            messageColor = [UIColor greenColor];
-        } else if ([message containsString:@"disconnected"]) {
-            messageColor = [UIColor orangeColor];
-        } else {
-            messageColor = [UIColor whiteColor];
+    logring_write(message.UTF8String);
+}
+
+- (NSAttributedString *)attributedLogLine:(const struct logring_entry *)entry {
+    static NSDateFormatter *formatter;
+    if (!formatter) {
+        formatter = [[NSDateFormatter alloc] init];
+        formatter.dateStyle = NSDateFormatterNoStyle;
+        formatter.timeStyle = NSDateFormatterMediumStyle;
+    }
+    NSDate *date = [NSDate dateWithTimeIntervalSince1970:entry->time_ns / 1e9];
+    NSString *message = [NSString stringWithUTF8String:entry->msg] ?: @"";
+    
+    NSMutableAttributedString *line = [[NSMutableAttributedString alloc] 
+        initWithString:[NSString stringWithFormat:@"[%@]", [formatter stringFromDate:date]]
+        attributes:@{NSForegroundColorAttributeName: [UIColor grayColor]}];
+    
+    // Message with color based on content
+    UIColor *messageColor;
+    if ([message containsString:@"Error"] || [message containsString:@"Failed"] || [message containsString:@"failed"]) {
+        messageColor = [UIColor redColor];
+    } else if ([message containsString:@"connected"] || [message containsString:@"Successfully"]) {
+        messageColor = [UIColor greenColor];
+    } else if ([message containsString:@"disconnected"]) {
+        messageColor = [UIColor orangeColor];
+    } else {
+        messageColor = [UIColor whiteColor];
+    }
+    
+    [line appendAttributedString:[[NSAttributedString alloc] 
+        initWithString:[NSString stringWithFormat:@"%@\n", message]
+        attributes:@{NSForegroundColorAttributeName: messageColor}]];
+    return line;
+}
+
+// Appends whatever was logged since the last poll, only the new lines get
+// attributes and the text storage is edited in place.
+- (void)drainLog {
+    static struct logring_entry batch[64];
+    static uint64_t cursor = 0, lost = 0;
+    uint64_t lostBefore = lost;
+    NSMutableAttributedString *added = [[NSMutableAttributedString alloc] init];
+    NSUInteger lines = 0;
+    size_t n;
+    
+    while ((n = logring_read(&cursor, batch, 64, &lost)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            [added appendAttributedString:[self attributedLogLine:&batch[i]]];
+            lines++;
         }
-        
-        NSAttributedString *contentString = [[NSAttributedString alloc] 
-            initWithString:[NSString stringWithFormat:@"%@\n", message]
-            attributes:@{NSForegroundColorAttributeName: messageColor}];
-        [attributedMessage appendAttributedString:contentString];
-        
-        NSMutableAttributedString *currentText = [[NSMutableAttributedString alloc] 
-            initWithAttributedString:self.logTextView.attributedText ?: [[NSAttributedString alloc] init]];
-        [currentText appendAttributedString:attributedMessage];
-        
-        // 為整個文本設置字體
-        [currentText addAttribute:NSFontAttributeName 
-                           value:[UIFont fontWithName:@"Menlo-Regular" size:9.0] 
-                           range:NSMakeRange(0, currentText.length)];
-        
-        // 檢查並限制行數
-        NSArray *lines = [currentText.string componentsSeparatedByString:@"\n"];
-        if (lines.count > MAX_LOG_LINES) {
-            NSRange deleteRange = [currentText.string rangeOfString:
-                [[lines subarrayWithRange:NSMakeRange(0, lines.count - MAX_LOG_LINES)] componentsJoinedByString:@"\n"]];
-            [currentText deleteCharactersInRange:deleteRange];
+    }
+    if (lost != lostBefore) {
+        [added appendAttributedString:[[NSAttributedString alloc] 
+            initWithString:[NSString stringWithFormat:@"[SOCKS] %llu log lines dropped\n", lost - lostBefore]
+            attributes:@{NSForegroundColorAttributeName: [UIColor redColor]}]];
+        lines++;
+    }
+    if (!lines) return;
+    [added addAttribute:NSFontAttributeName 
+                  value:[UIFont fontWithName:@"Menlo-Regular" size:9.0] 
+                  range:NSMakeRange(0, added.length)];
+    
+    NSTextStorage *storage = self.logTextView.textStorage;
+    [storage beginEditing];
+    [storage appendAttributedString:added];
+    logLineCount += lines;
+    
+    // 檢查並限制行數
+    if (logLineCount > MAX_LOG_LINES) {
+        NSString *text = storage.string;
+        NSUInteger drop = logLineCount - MAX_LOG_LINES, end = 0;
+        while (drop > 0) {
+            NSRange nl = [text rangeOfString:@"\n" options:NSLiteralSearch range:NSMakeRange(end, text.length - end)];
+            if (nl.location == NSNotFound) break;
+            end = NSMaxRange(nl);
+            drop--;
         }
-        
-        self.logTextView.attributedText = currentText;
-        [self.logTextView scrollRangeToVisible:NSMakeRange(self.logTextView.text.length, 0)];
-    });
+        [storage deleteCharactersInRange:NSMakeRange(0, end)];
+        logLineCount = MAX_LOG_LINES + drop;
+    }
+    [storage endEditing];
+    [self.logTextView scrollRangeToVisible:NSMakeRange(storage.length, 0)];
 }
 
 + (void)logMessage:(NSString *)message {
-    if (sharedInstance) {
-        [sharedInstance logMessage:message];
-    } else {
-        NSLog(@"%@", message);
-    }
+    // the ring is process wide, messages logged before the view loaded
+    // show up with the first poll
+    NSLog(@"%@", message);
+    logring_write(message.UTF8String);
 }
 
 + (void)logFromC:(const char *)message {
-    if (message) {
-        NSString *nsMessage = [NSString stringWithUTF8String:message];
-        [ViewController logMessage:nsMessage];
-    }
+    if (message) logring_write(message);
 }
 
 + (void)logConnection:(NSString *)clientIP port:(int)clientPort {
@@ -289,12 +305,12 @@ void custom_log(const char *format, ...) {
 }
 
 - (void)updateStatsDisplay {
-    pthread_mutex_lock(&pending_stats_mutex);
-    uint64_t uploadBytes = pending_upload_bytes;
-    uint64_t downloadBytes = pending_download_bytes;
-    pthread_mutex_unlock(&pending_stats_mutex);
+    // the core publishes its counters into a seqlocked segment, we just
+    // take a snapshot instead of being called back on every relayed chunk
+    static struct shmstats_data snapshot;
+    if (shmstats_snapshot(&snapshot)) return;
     
-    [self updateStatsWithUpload:uploadBytes download:downloadBytes];
+    [self updateStatsWithUpload:snapshot.bytes[STATS_UP] download:snapshot.bytes[STATS_DOWN]];
 }
 
 @end
@@ -0,0 +1,460 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+int bench_parse_addr(const char* s, struct bench_addr* a) {
+    const char* colon = strrchr(s, ':');
+    const char* host = "127.0.0.1";
+    size_t len = strlen(host);
+    if(colon) {
+        host = s;
+        len = colon - s;
+        if(*s == '[' && len >= 2 && s[len - 1] == ']') {
+            host++;
+            len -= 2;
+        }
+        s = colon + 1;
+    }
+    char* end;
+    unsigned long port = strtoul(s, &end, 10);
+    if(!*s || *end || port > 65535 || !len || len >= sizeof a->host) return -1;
+    memcpy(a->host, host, len);
+    a->host[len] = 0;
+    a->port = port;
+    return 0;
+}
+
+uint64_t bench_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void bench_sleep_us(uint64_t us) {
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    while(nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+static int resolve(const struct bench_addr* a, int type, struct addrinfo** ai) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = type, .ai_flags = AI_PASSIVE };
+    char port[8];
+    snprintf(port, sizeof port, "%u", a->port);
+    return getaddrinfo(a->host, port, &hints, ai) ? -1 : 0;
+}
+
+int bench_connect(const struct bench_addr* a) {
+    struct addrinfo* ai;
+    if(resolve(a, SOCK_STREAM, &ai)) {
+        errno = EADDRNOTAVAIL;
+        return -1;
+    }
+    int fd = socket(ai->ai_family, SOCK_STREAM, 0);
+    if(fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+        int e = errno;
+        close(fd);
+        fd = -1;
+        errno = e;
+    }
+    freeaddrinfo(ai);
+    if(fd != -1) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    }
+    return fd;
+}
+
+int bench_connect_fd(int fd, const struct bench_addr* a) {
+    struct addrinfo* ai;
+    if(resolve(a, 0, &ai)) {
+        errno = EADDRNOTAVAIL;
+        return -1;
+    }
+    int r = connect(fd, ai->ai_addr, ai->ai_addrlen);
+    freeaddrinfo(ai);
+    return r;
+}
+
+int bench_listen(const struct bench_addr* a, int type, int backlog) {
+    struct addrinfo* ai;
+    if(resolve(a, type, &ai)) {
+        errno = EADDRNOTAVAIL;
+        return -1;
+    }
+    int fd = socket(ai->ai_family, type, 0), one = 1;
+    if(fd != -1) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        if(bind(fd, ai->ai_addr, ai->ai_addrlen) ||
+           (type == SOCK_STREAM && backlog >= 0 && listen(fd, backlog))) {
+            int e = errno;
+            close(fd);
+            fd = -1;
+            errno = e;
+        }
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+int bench_write_all(int fd, const void* buf, size_t n) {
+    const char* p = buf;
+    while(n) {
+        ssize_t m = write(fd, p, n);
+        if(m < 0 && errno == EINTR) continue;
+        if(m <= 0) return -1;
+        p += m;
+        n -= m;
+    }
+    return 0;
+}
+
+int bench_read_full(int fd, void* buf, size_t n) {
+    char* p = buf;
+    while(n) {
+        ssize_t m = read(fd, p, n);
+        if(m < 0 && errno == EINTR) continue;
+        if(m <= 0) return -1;
+        p += m;
+        n -= m;
+    }
+    return 0;
+}
+
+int bench_sockname(int fd, int peer, struct bench_addr* a) {
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in v4;
+        struct sockaddr_in6 v6;
+    } u;
+    socklen_t len = sizeof u;
+    if((peer ? getpeername : getsockname)(fd, &u.sa, &len)) return -1;
+    if(u.sa.sa_family == AF_INET) {
+        inet_ntop(AF_INET, &u.v4.sin_addr, a->host, sizeof a->host);
+        a->port = ntohs(u.v4.sin_port);
+    } else {
+        inet_ntop(AF_INET6, &u.v6.sin6_addr, a->host, sizeof a->host);
+        a->port = ntohs(u.v6.sin6_port);
+    }
+    return 0;
+}
+
+void bench_nonblock(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+unsigned long bench_raise_nofile(void) {
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl)) return 0;
+    rl.rlim_cur = rl.rlim_max;
+    if(setrlimit(RLIMIT_NOFILE, &rl)) {
+        /* macos refuses anything above OPEN_MAX for an unlimited maximum */
+        rl.rlim_cur = 10240;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    return rl.rlim_cur;
+}
+
+/* reads a complete reply, whose length depends on the address type */
+static int read_reply(int fd, struct bench_addr* bound) {
+    unsigned char b[4 + 256 + 2];
+    if(bench_read_full(fd, b, 5)) return -1;
+    if(b[0] != 5) return -1;
+    size_t rest;
+    switch(b[3]) {
+        case 1: rest = 4 + 2 - 1; break;
+        case 4: rest = 16 + 2 - 1; break;
+        case 3: rest = b[4] + 2; break;
+        default: return -1;
+    }
+    if(bench_read_full(fd, b + 5, rest)) return -1;
+    if(bound) {
+        if(b[3] == 3) {
+            memcpy(bound->host, b + 5, b[4]);
+            bound->host[b[4]] = 0;
+        } else {
+            inet_ntop(b[3] == 1 ? AF_INET : AF_INET6, b + 4, bound->host, sizeof bound->host);
+        }
+        bound->port = b[5 + rest - 2] << 8 | b[5 + rest - 1];
+    }
+    return b[1];
+}
+
+static int socks5_command(int fd, const struct socks5_auth* auth, int cmd, const char* target,
+                          unsigned short port, struct socks5_timing* tm, struct bench_addr* bound) {
+    unsigned char b[4 + 256 + 2 + 256];
+    size_t n = 0;
+    uint64_t t0 = bench_now_us(), t1;
+    b[n++] = 5;
+    if(!auth || !auth->user) {
+        b[n++] = 1;
+        b[n++] = 0;
+    } else if(auth->offer_noauth) {
+        b[n++] = 2;
+        b[n++] = 0;
+        b[n++] = 2;
+    } else {
+        b[n++] = 1;
+        b[n++] = 2;
+    }
+    if(bench_write_all(fd, b, n) || bench_read_full(fd, b, 2)) return -1;
+    t1 = bench_now_us();
+    if(tm) {
+        tm->greeting = t1 - t0;
+        tm->auth = 0;
+    }
+    if(b[0] != 5 || b[1] == 0xff) return 0xff;
+    if(b[1] == 2) {
+        if(!auth || !auth->user) return -1;
+        size_t ul = strlen(auth->user), pl = strlen(auth->pass);
+        if(ul > 255 || pl > 255) return -1;
+        n = 0;
+        b[n++] = 1;
+        b[n++] = ul;
+        memcpy(b + n, auth->user, ul);
+        n += ul;
+        b[n++] = pl;
+        memcpy(b + n, auth->pass, pl);
+        n += pl;
+        t0 = bench_now_us();
+        if(bench_write_all(fd, b, n) || bench_read_full(fd, b, 2)) return -1;
+        t1 = bench_now_us();
+        if(tm) tm->auth = t1 - t0;
+        if(b[1] != 0) return 0xff;
+    }
+    n = 0;
+    b[n++] = 5;
+    b[n++] = cmd;
+    b[n++] = 0;
+    unsigned char ip[16];
+    if(inet_pton(AF_INET, target, ip) == 1) {
+        b[n++] = 1;
+        memcpy(b + n, ip, 4);
+        n += 4;
+    } else if(inet_pton(AF_INET6, target, ip) == 1) {
+        b[n++] = 4;
+        memcpy(b + n, ip, 16);
+        n += 16;
+    } else {
+        size_t l = strlen(target);
+        if(l > 255) return -1;
+        b[n++] = 3;
+        b[n++] = l;
+        memcpy(b + n, target, l);
+        n += l;
+    }
+    b[n++] = port >> 8;
+    b[n++] = port & 0xff;
+    t0 = bench_now_us();
+    if(bench_write_all(fd, b, n)) return -1;
+    int rc = read_reply(fd, bound);
+    if(tm) tm->request = bench_now_us() - t0;
+    return rc;
+}
+
+int socks5_connect(int fd, const struct socks5_auth* auth, const char* target,
+                   unsigned short port, struct socks5_timing* tm) {
+    return socks5_command(fd, auth, 1, target, port, tm, 0);
+}
+
+int socks5_udp_associate(int fd, const struct socks5_auth* auth,
+                         const struct bench_addr* local, struct bench_addr* relay) {
+    int rc = socks5_command(fd, auth, 3, local->host, local->port, 0, relay);
+    if(rc) return rc;
+    /* a wildcard relay address means the address the proxy was reached at */
+    if(!strcmp(relay->host, "0.0.0.0") || !strcmp(relay->host, "::")) {
+        struct bench_addr peer;
+        if(bench_sockname(fd, 1, &peer)) return -1;
+        strcpy(relay->host, peer.host);
+    }
+    return 0;
+}
+
+size_t bench_udp_header(unsigned char* buf, const struct bench_addr* dst) {
+    unsigned char ip[16];
+    size_t n = 0, l;
+    buf[n++] = 0;
+    buf[n++] = 0;
+    buf[n++] = 0;
+    if(inet_pton(AF_INET, dst->host, ip) == 1) {
+        buf[n++] = 1;
+        memcpy(buf + n, ip, 4);
+        n += 4;
+    } else if(inet_pton(AF_INET6, dst->host, ip) == 1) {
+        buf[n++] = 4;
+        memcpy(buf + n, ip, 16);
+        n += 16;
+    } else {
+        l = strlen(dst->host);
+        buf[n++] = 3;
+        buf[n++] = l;
+        memcpy(buf + n, dst->host, l);
+        n += l;
+    }
+    buf[n++] = dst->port >> 8;
+    buf[n++] = dst->port & 0xff;
+    return n;
+}
+
+ssize_t bench_udp_skip_header(const unsigned char* buf, size_t n) {
+    size_t h;
+    if(n < 4 || buf[0] || buf[1] || buf[2]) return -1;
+    switch(buf[3]) {
+        case 1: h = 4 + 4 + 2; break;
+        case 4: h = 4 + 16 + 2; break;
+        case 3: h = n > 4 ? (size_t) 4 + 1 + buf[4] + 2 : n + 1; break;
+        default: return -1;
+    }
+    return h <= n ? (ssize_t) h : -1;
+}
+
+#ifdef __linux__
+/* parent pid and utime, stime, cutime, cstime in clock ticks */
+static int read_stat(pid_t pid, int* ppid, unsigned long long t[4]) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof path, "/proc/%d/stat", (int) pid);
+    FILE* f = fopen(path, "r");
+    if(!f) return -1;
+    size_t n = fread(buf, 1, sizeof buf - 1, f);
+    fclose(f);
+    buf[n] = 0;
+    /* the command name may contain spaces, fields are counted after it */
+    char* p = strrchr(buf, ')');
+    if(!p || sscanf(p + 2, "%*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %llu %llu",
+                    ppid, &t[0], &t[1], &t[2], &t[3]) != 5)
+        return -1;
+    return 0;
+}
+
+/* the process, its direct children (the prefork workers) and the children
+   it already reaped, so workers that were restarted still count */
+double bench_proc_cpu(pid_t pid) {
+    unsigned long long t[4], ticks;
+    int ppid;
+    struct dirent* e;
+    if(read_stat(pid, &ppid, t)) return -1;
+    ticks = t[0] + t[1] + t[2] + t[3];
+    DIR* d = opendir("/proc");
+    if(d) {
+        while((e = readdir(d))) {
+            int child = atoi(e->d_name);
+            if(child > 0 && child != pid && !read_stat(child, &ppid, t) && ppid == pid) ticks += t[0] + t[1];
+        }
+        closedir(d);
+    }
+    return (double) ticks / sysconf(_SC_CLK_TCK);
+}
+
+static long count_dir(const char* path) {
+    DIR* d = opendir(path);
+    struct dirent* e;
+    long n = 0;
+    if(!d) return -1;
+    while((e = readdir(d)))
+        if(e->d_name[0] != '.') n++;
+    closedir(d);
+    return n;
+}
+
+static int add_usage(pid_t pid, struct bench_usage* u) {
+    char path[64], line[256];
+    unsigned long long rss = 0;
+    long threads = 0, fds;
+    snprintf(path, sizeof path, "/proc/%d/status", (int) pid);
+    FILE* f = fopen(path, "r");
+    if(!f) return -1;
+    while(fgets(line, sizeof line, f)) {
+        sscanf(line, "VmRSS: %llu", &rss);
+        sscanf(line, "Threads: %ld", &threads);
+    }
+    fclose(f);
+    snprintf(path, sizeof path, "/proc/%d/fd", (int) pid);
+    if((fds = count_dir(path)) < 0) return -1;
+    u->rss_kb += rss;
+    u->threads += threads;
+    u->fds += fds;
+    u->procs++;
+    return 0;
+}
+
+int bench_proc_usage(pid_t pid, struct bench_usage* u) {
+    unsigned long long t[4];
+    struct dirent* e;
+    *u = (struct bench_usage) { 0 };
+    if(add_usage(pid, u)) return -1;
+    DIR* d = opendir("/proc");
+    if(!d) return 0;
+    while((e = readdir(d))) {
+        int child = atoi(e->d_name), ppid;
+        if(child > 0 && child != pid && !read_stat(child, &ppid, t) && ppid == pid) add_usage(child, u);
+    }
+    closedir(d);
+    return 0;
+}
+#else
+/* ps prints [[dd-]hh:]mm:ss.cc */
+static double parse_time(char* p) {
+    double t = 0, v;
+    while(*p == ' ') p++;
+    char* dash = strchr(p, '-');
+    if(dash) {
+        t = atof(p) * 86400;
+        p = dash + 1;
+    }
+    while(*p && *p != '\n') {
+        v = strtod(p, &p);
+        t = t * 60 + v;
+        if(*p == ':') p++;
+        else break;
+    }
+    return t;
+}
+
+/* the process and its direct children (the prefork workers). ps has no
+   time of reaped children, so workers that were restarted are missing */
+double bench_proc_cpu(pid_t pid) {
+    char line[128];
+    int p, ppid, n, found = 0;
+    double t = 0;
+    FILE* f = popen("ps -A -o pid= -o ppid= -o time=", "r");
+    if(!f) return -1;
+    while(fgets(line, sizeof line, f))
+        if(sscanf(line, "%d %d %n", &p, &ppid, &n) == 2 && (p == pid || ppid == pid)) {
+            found |= p == pid;
+            t += parse_time(line + n);
+        }
+    pclose(f);
+    return found ? t : -1;
+}
+
+/* only the memory, from ps */
+int bench_proc_usage(pid_t pid, struct bench_usage* u) {
+    char line[128];
+    int p, ppid, found = 0;
+    unsigned long long rss;
+    *u = (struct bench_usage) { .fds = -1, .threads = -1 };
+    FILE* f = popen("ps -A -o pid= -o ppid= -o rss=", "r");
+    if(!f) return -1;
+    while(fgets(line, sizeof line, f))
+        if(sscanf(line, "%d %d %llu", &p, &ppid, &rss) == 3 && (p == pid || ppid == pid)) {
+            found |= p == pid;
+            u->rss_kb += rss;
+            u->procs++;
+        }
+    pclose(f);
+    return found ? 0 : -1;
+}
+#endif
@@ -0,0 +1,73 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* helpers shared by the benchmark tools. they only use poll() and
+   pthreads, so unlike the proxy they build on any unix. */
+
+struct bench_addr {
+    char host[256];
+    unsigned short port;
+};
+
+/* "host:port", "[v6]:port" or just "port" for 127.0.0.1 */
+int bench_parse_addr(const char* s, struct bench_addr* a);
+uint64_t bench_now_us(void);
+void bench_sleep_us(uint64_t us);
+/* blocking connect with TCP_NODELAY, -1 with errno set */
+int bench_connect(const struct bench_addr* a);
+/* connects an existing socket, e.g. to fix the peer of a udp socket */
+int bench_connect_fd(int fd, const struct bench_addr* a);
+int bench_listen(const struct bench_addr* a, int type, int backlog);
+int bench_write_all(int fd, const void* buf, size_t n);
+int bench_read_full(int fd, void* buf, size_t n);
+/* local (or with peer set, remote) address of a socket */
+int bench_sockname(int fd, int peer, struct bench_addr* a);
+void bench_nonblock(int fd);
+/* raises RLIMIT_NOFILE as far as allowed, returns the new soft limit */
+unsigned long bench_raise_nofile(void);
+
+struct socks5_auth {
+    const char* user;  /* NULL: only offer no authentication */
+    const char* pass;
+    int offer_noauth;  /* with user: offer both, for auth-once */
+};
+
+/* client side phases of a SOCKS5 CONNECT, in microseconds */
+struct socks5_timing {
+    uint64_t greeting;  /* method selection round trip */
+    uint64_t auth;      /* username/password round trip, 0 if skipped */
+    uint64_t request;   /* CONNECT request until the reply */
+};
+
+/* runs the handshake on a connected fd. target is an ip literal or a name
+   the proxy resolves. returns 0 on success, the reply code (or 0xff for a
+   refused method or login) if the proxy said no, -1 on io errors. */
+int socks5_connect(int fd, const struct socks5_auth* auth, const char* target,
+                   unsigned short port, struct socks5_timing* tm);
+/* UDP ASSOCIATE for datagrams that will come from local, relay receives
+   the address to send them to. returns like socks5_connect. */
+int socks5_udp_associate(int fd, const struct socks5_auth* auth,
+                         const struct bench_addr* local, struct bench_addr* relay);
+/* writes the udp request header for dst into buf (at most 4 + 256 + 2
+   bytes), returns its length */
+size_t bench_udp_header(unsigned char* buf, const struct bench_addr* dst);
+/* length of the header in front of a relayed datagram, -1 if malformed */
+ssize_t bench_udp_skip_header(const unsigned char* buf, size_t n);
+/* user+system seconds of another local process and its children (the
+   prefork workers), -1 where unsupported */
+double bench_proc_cpu(pid_t pid);
+
+struct bench_usage {
+    unsigned long long rss_kb;
+    long fds, threads;  /* -1 where unsupported */
+    unsigned procs;
+};
+/* resident memory, open fds and threads of a process and its direct
+   children (the prefork workers), -1 if the process is gone */
+int bench_proc_usage(pid_t pid, struct bench_usage* u);
+
+#endif
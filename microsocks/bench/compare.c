@@ -0,0 +1,224 @@
+/* compares benchmark runs of two builds, for `make bench-compare`.
+   reads the json results written by bench/compare.sh, where every run has
+   a "build" label (base or new), and for each checked metric prints the
+   mean of both builds, the relative change and a 95% confidence interval
+   of it, bootstrapped from the runs. a metric regressed when the interval
+   lies on the worse side of zero and the change is beyond its threshold
+   (in percent); the exit status is 1 then. a change beyond the threshold
+   whose interval still reaches zero is called noisy: more RUNS decide it.
+   a percentile bootstrap of a handful of runs makes the interval far too
+   narrow, so below -n runs (MIN_RUNS) per build there is no verdict and
+   the exit status is 2. */
+
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_RUNS 256
+#define MIN_RUNS 5
+#define RESAMPLES 10000
+#define LINE_MAX_LEN 8192
+
+enum { LOWER_IS_BETTER, HIGHER_IS_BETTER };
+
+struct check {
+    const char* name;
+    const char* mode;  /* the "mode" of the result lines it reads */
+    const char* key;   /* "a.b" is key b in object a */
+    int better;
+    double threshold;
+    double v[2][MAX_RUNS];
+    unsigned n[2];
+};
+
+static struct check checks[] = {
+    { .name = "download MB/s", .mode = "down", .key = "mb_per_sec",
+      .better = HIGHER_IS_BETTER, .threshold = 5 },
+    { .name = "upload MB/s", .mode = "up", .key = "mb_per_sec",
+      .better = HIGHER_IS_BETTER, .threshold = 5 },
+    { .name = "tunnels/s", .mode = "rate", .key = "tunnels_per_sec",
+      .better = HIGHER_IS_BETTER, .threshold = 5 },
+    { .name = "p99 handshake us", .mode = "rate", .key = "handshake_us.p99",
+      .better = LOWER_IS_BETTER, .threshold = 10 },
+    { .name = "bytes/idle conn", .mode = "idle", .key = "bytes_per_conn",
+      .better = LOWER_IS_BETTER, .threshold = 5 },
+};
+#define N_CHECKS (sizeof checks / sizeof *checks)
+
+static const char* builds[2] = { "base", "new" };
+
+/* the text after "key": in line, or NULL */
+static const char* find_key(const char* line, const char* key, size_t len) {
+    char pat[128];
+    if(len + 5 > sizeof pat) return 0;
+    snprintf(pat, sizeof pat, "\"%.*s\": ", (int) len, key);
+    const char* p = strstr(line, pat);
+    return p ? p + strlen(pat) : 0;
+}
+
+static int get_string(const char* line, const char* key, char* out, size_t size) {
+    const char* p = find_key(line, key, strlen(key));
+    if(!p || *p != '"') return -1;
+    size_t l = strcspn(++p, "\"");
+    if(l >= size) return -1;
+    memcpy(out, p, l);
+    out[l] = 0;
+    return 0;
+}
+
+static int get_number(const char* line, const char* key, double* v) {
+    const char* dot = strchr(key, '.');
+    const char* p = line;
+    char* end;
+    if(dot) {
+        if(!(p = find_key(line, key, dot - key)) || *p != '{') return -1;
+        key = dot + 1;
+    }
+    if(!(p = find_key(p, key, strlen(key)))) return -1;
+    *v = strtod(p, &end);
+    return end == p ? -1 : 0;
+}
+
+static void add_line(const char* line) {
+    char build[32], mode[32];
+    unsigned b, i;
+    double v;
+    if(get_string(line, "build", build, sizeof build) || get_string(line, "mode", mode, sizeof mode)) return;
+    for(b = 0; b < 2 && strcmp(build, builds[b]); b++);
+    if(b == 2) return;
+    for(i = 0; i < N_CHECKS; i++) {
+        struct check* c = &checks[i];
+        if(!strcmp(mode, c->mode) && !get_number(line, c->key, &v) && c->n[b] < MAX_RUNS)
+            c->v[b][c->n[b]++] = v;
+    }
+}
+
+static double mean(const double* v, unsigned n) {
+    double s = 0;
+    unsigned i;
+    for(i = 0; i < n; i++) s += v[i];
+    return s / n;
+}
+
+static double stddev(const double* v, unsigned n) {
+    double m = mean(v, n), s = 0;
+    unsigned i;
+    if(n < 2) return 0;
+    for(i = 0; i < n; i++) s += (v[i] - m) * (v[i] - m);
+    return sqrt(s / (n - 1));
+}
+
+/* xorshift64*, seeded the same every time so reports are reproducible */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned rnd(unsigned n) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 0x2545f4914f6cdd1dULL >> 32) % n;
+}
+
+static double resampled_mean(const double* v, unsigned n) {
+    double s = 0;
+    unsigned i;
+    for(i = 0; i < n; i++) s += v[rnd(n)];
+    return s / n;
+}
+
+static int by_value(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+/* relative change of the new build in percent, positive when worse, with
+   its bootstrapped 95% interval */
+static void change(const struct check* c, double* point, double* lo, double* hi) {
+    static double d[RESAMPLES];
+    double sign = c->better == HIGHER_IS_BETTER ? -1 : 1;
+    double base = mean(c->v[0], c->n[0]);
+    unsigned i, k = 0;
+    *point = sign * (mean(c->v[1], c->n[1]) - base) / base * 100;
+    for(i = 0; i < RESAMPLES; i++) {
+        double b = resampled_mean(c->v[0], c->n[0]);
+        if(b != 0) d[k++] = sign * (resampled_mean(c->v[1], c->n[1]) - b) / b * 100;
+    }
+    if(!k) {
+        *lo = *hi = *point;
+        return;
+    }
+    qsort(d, k, sizeof *d, by_value);
+    *lo = d[(size_t)(k * .025)];
+    *hi = d[(size_t)(k * .975) < k ? (size_t)(k * .975) : k - 1];
+}
+
+static int usage(void) {
+    dprintf(2, "usage: compare [-t throughput%%] [-r rate%%] [-l p99%%] [-i idle%%] [-n minruns] results.json...\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    int ch, regressed = 0, undecided = 0;
+    unsigned i, min_runs = MIN_RUNS;
+    while((ch = getopt(argc, argv, "t:r:l:i:n:")) != -1) {
+        switch(ch) {
+            case 't': checks[0].threshold = checks[1].threshold = atof(optarg); break;
+            case 'r': checks[2].threshold = atof(optarg); break;
+            case 'l': checks[3].threshold = atof(optarg); break;
+            case 'i': checks[4].threshold = atof(optarg); break;
+            case 'n': min_runs = atoi(optarg) > 2 ? atoi(optarg) : 2; break;
+            default: return usage();
+        }
+    }
+    if(optind == argc) return usage();
+    for(; optind < argc; optind++) {
+        static char line[LINE_MAX_LEN];
+        FILE* f = fopen(argv[optind], "r");
+        if(!f) {
+            perror(argv[optind]);
+            return 2;
+        }
+        while(fgets(line, sizeof line, f)) add_line(line);
+        fclose(f);
+    }
+
+    printf("%-18s %23s %23s %8s %18s %6s  %s\n", "metric", "base", "new", "change", "95% interval", "limit",
+           "verdict");
+    for(i = 0; i < N_CHECKS; i++) {
+        struct check* c = &checks[i];
+        double point, lo, hi;
+        const char* verdict;
+        if(!c->n[0] || !c->n[1]) {
+            printf("%-18s %23s\n", c->name, "no runs");
+            continue;
+        }
+        change(c, &point, &lo, &hi);
+        if(c->n[0] < min_runs || c->n[1] < min_runs) {
+            verdict = "too few runs";
+            undecided = 1;
+        } else if(lo > 0 && point > c->threshold) {
+            verdict = "REGRESSION";
+            regressed = 1;
+        } else if(hi < 0 && -point > c->threshold) {
+            verdict = "better";
+        } else if(fabs(point) > c->threshold) {
+            verdict = "noisy";
+        } else {
+            verdict = "ok";
+        }
+        /* shown as the metric moves, not as worse/better */
+        double sign = c->better == HIGHER_IS_BETTER ? -1 : 1;
+        double a = sign * lo, b = sign * hi;
+        printf("%-18s %12.1f ±%6.1f %2u %12.1f ±%6.1f %2u %+7.1f%% [%+6.1f%%, %+6.1f%%] %5.1f%%  %s\n", c->name,
+               mean(c->v[0], c->n[0]), stddev(c->v[0], c->n[0]), c->n[0], mean(c->v[1], c->n[1]),
+               stddev(c->v[1], c->n[1]), c->n[1], sign * point, a < b ? a : b, a < b ? b : a, c->threshold,
+               verdict);
+    }
+    if(undecided)
+        dprintf(2, "compare: no verdict below %u runs per build, the interval would be too narrow\n", min_runs);
+    return regressed ? 1 : undecided ? 2 : 0;
+}
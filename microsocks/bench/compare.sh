@@ -0,0 +1,105 @@
+#!/bin/sh
+# regression check, run by `make bench-compare BASE=...`.
+# measures download and upload throughput, tunnels per second with their
+# p99 handshake latency and the memory per idle tunnel of two proxy builds,
+# RUNS times each with the builds taking turns, and lets bench/compare
+# decide which differences are real. BASE is the build to compare against:
+# a proxy binary, a git revision (built in a temporary directory) or the
+# json of an earlier compare run, whose "new" runs then serve as the
+# baseline. without BASE only PROXY is measured, which makes a baseline.
+# the exit status is 1 when a metric regressed. with fewer than 5 runs per
+# build (RUNS, or the runs in a json BASE) the intervals can't be trusted:
+# there is no verdict then and the exit status is 2.
+#
+#   BASE         baseline binary, git revision or json
+#   PROXY        proxy binary under test (./microsocks)
+#   RUNS         runs per build and benchmark (5, the least that gets a verdict)
+#   DURATION     seconds per loadgen run (3)
+#   CONC         loadgen concurrency (8)
+#   IDLE         idle tunnels for the memory check (2000)
+#   THRESH_TPUT  allowed throughput loss in percent (5)
+#   THRESH_RATE  allowed tunnels/s loss in percent (5)
+#   THRESH_P99   allowed p99 handshake latency growth in percent (10)
+#   THRESH_IDLE  allowed idle memory growth in percent (5)
+#   PORT         first of four local ports to use (21080)
+#   OUT          result file (bench/compare.json)
+
+cd "$(dirname "$0")/.." || exit 1
+PROXY=${PROXY:-./microsocks}
+RUNS=${RUNS:-5}
+DURATION=${DURATION:-3}
+CONC=${CONC:-8}
+IDLE=${IDLE:-2000}
+THRESH_TPUT=${THRESH_TPUT:-5}
+THRESH_RATE=${THRESH_RATE:-5}
+THRESH_P99=${THRESH_P99:-10}
+THRESH_IDLE=${THRESH_IDLE:-5}
+PORT=${PORT:-21080}
+OUT=${OUT:-bench/compare.json}
+
+. bench/lib.sh
+
+tmp=$OUT.tmp
+: > "$tmp"
+new=$PROXY
+base=
+build_dir=
+if [ -z "$BASE" ]; then
+	:
+elif [ -f "$BASE" ] && [ ! -x "$BASE" ]; then
+	# the runs measured last time are the baseline now
+	sed -n 's/^ *\({.*"build": "\)new\(".*}\),*$/\1base\2/p' "$BASE" > "$OUT.base"
+	[ -s "$OUT.base" ] || { echo "no runs in $BASE" >&2; exit 1; }
+elif [ -x "$BASE" ]; then
+	base=$BASE
+else
+	build_dir=$(mktemp -d) || exit 1
+	trap 'cleanup; rm -rf "$build_dir"' EXIT
+	echo "building $BASE" >&2
+	git -C .. archive "$BASE" microsocks | tar -x -C "$build_dir" &&
+		make -C "$build_dir/microsocks" microsocks >/dev/null || exit 1
+	base=$build_dir/microsocks/microsocks
+fi
+
+# measure build binary run
+measure() {
+	PROXY=$2
+	start_proxy all
+	wait_proxy
+	for mode in down up rate; do
+		case $mode in
+			up) port=$sink_port ;;
+			down) port=$source_port ;;
+			*) port=$echo_port ;;
+		esac
+		echo "$1 run $3: $mode" >&2
+		./bench/loadgen -x 127.0.0.1:$proxy_port -t 127.0.0.1:$port -m "$mode" \
+			-c "$CONC" -d "$DURATION" -p "$proxy_pid" -L build="$1" -L run="$3" >> "$tmp" ||
+			echo "loadgen failed" >&2
+	done
+	echo "$1 run $3: idle" >&2
+	./bench/idlegen -x 127.0.0.1:$proxy_port -t 127.0.0.1:$echo_port -m 1 -U 0 -A 0 \
+		-s "$IDLE" -i 1 -p "$proxy_pid" -L build="$1" -L run="$3" >> "$tmp" ||
+		echo "idlegen failed" >&2
+	stop_proxy
+}
+
+start_target
+run=1
+while [ $run -le "$RUNS" ]; do
+	# taking turns spreads drift (thermal, other load) over both builds
+	if [ -n "$base" ] && [ $((run % 2)) = 1 ]; then
+		measure base "$base" $run
+		measure new "$new" $run
+	else
+		measure new "$new" $run
+		[ -n "$base" ] && measure base "$base" $run
+	fi
+	run=$((run + 1))
+done
+
+[ -f "$OUT.base" ] && cat "$OUT.base" >> "$tmp"
+rm -f "$OUT.base"
+PROXY=$new META="\"runs\": $RUNS${BASE:+, \"base\": \"$BASE\"}" write_results "$OUT"
+[ -n "$BASE" ] || exit 0
+./bench/compare -t "$THRESH_TPUT" -r "$THRESH_RATE" -l "$THRESH_P99" -i "$THRESH_IDLE" "$OUT"
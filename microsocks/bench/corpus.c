@@ -0,0 +1,148 @@
+#include "corpus.h"
+#include <string.h>
+
+#define MAX_ENTRIES 64
+#define MAX_LEN 1400
+
+const char *corpus_kind_names[CK_KINDS] = { "greeting", "auth", "request", "udp" };
+
+static struct corpus_entry entries[MAX_ENTRIES];
+static unsigned char storage[MAX_ENTRIES][MAX_LEN];
+static size_t n_entries;
+
+/* the entry being built */
+static unsigned char *cur;
+static size_t cur_len;
+
+static void begin(void) {
+    cur = storage[n_entries];
+    cur_len = 0;
+}
+
+static void put(const void *p, size_t n) {
+    memcpy(cur + cur_len, p, n);
+    cur_len += n;
+}
+
+static void put_byte(unsigned char c) {
+    cur[cur_len++] = c;
+}
+
+static void fill(unsigned char c, size_t n) {
+    memset(cur + cur_len, c, n);
+    cur_len += n;
+}
+
+static void end(enum corpus_kind kind, int adversarial, const char *name) {
+    entries[n_entries++] = (struct corpus_entry) {
+        .kind = kind, .adversarial = adversarial, .name = name,
+        .len = cur_len, .data = cur,
+    };
+}
+
+static void bytes(enum corpus_kind kind, int adversarial, const char *name, const void *p, size_t n) {
+    begin();
+    put(p, n);
+    end(kind, adversarial, name);
+}
+
+#define B(kind, adv, name, ...) do { \
+    static const unsigned char b_[] = { __VA_ARGS__ }; \
+    bytes(kind, adv, name, b_, sizeof b_); } while(0)
+
+static void login(int adversarial, const char *name, const char *user, const char *pass) {
+    begin();
+    put_byte(1);
+    put_byte(strlen(user));
+    put(user, strlen(user));
+    put_byte(strlen(pass));
+    put(pass, strlen(pass));
+    end(CK_AUTH, adversarial, name);
+}
+
+/* prefix is VER CMD RSV for requests, RSV RSV FRAG for datagrams */
+static void dns_dest(enum corpus_kind kind, int adversarial, const char *name,
+                     const unsigned char prefix[3], size_t namelen, size_t payload) {
+    begin();
+    put(prefix, 3);
+    put_byte(3);
+    put_byte(namelen);
+    fill('a', namelen);
+    put_byte(443 >> 8);
+    put_byte(443 & 0xff);
+    fill('x', payload);
+    end(kind, adversarial, name);
+}
+
+static void build(void) {
+    static const unsigned char connect[3] = { 5, 1, 0 }, udp[3] = { 0, 0, 0 };
+
+    B(CK_GREETING, 0, "noauth", 5, 1, 0);
+    B(CK_GREETING, 0, "userpass", 5, 1, 2);
+    B(CK_GREETING, 0, "both", 5, 2, 0, 2);
+    B(CK_GREETING, 0, "curl", 5, 3, 0, 1, 2);
+    bytes(CK_GREETING, 1, "empty", "", 0);
+    B(CK_GREETING, 1, "socks4", 4, 1, 0);
+    B(CK_GREETING, 1, "nmethods_past_end", 5, 255, 1);
+    B(CK_GREETING, 1, "no_methods", 5, 0);
+    begin();
+    put_byte(5);
+    put_byte(255);
+    fill(0x80, 255);
+    end(CK_GREETING, 1, "255_unknown_methods");
+
+    login(0, "valid", "user", "secret");
+    login(0, "wrong_pass", "user", "wrong");
+    login(0, "long", "a-rather-long-user-name-from-some-config-file@example.com",
+          "and-an-even-longer-generated-password-0123456789abcdef");
+    B(CK_AUTH, 1, "ulen_past_end", 1, 200, 'u', 's');
+    B(CK_AUTH, 1, "plen_past_end", 1, 1, 'u', 255, 'p');
+    B(CK_AUTH, 1, "bad_version", 5, 1, 'u', 1, 'p');
+    B(CK_AUTH, 1, "short", 1, 0, 0);
+    begin();
+    put_byte(1);
+    put_byte(255);
+    fill('u', 255);
+    put_byte(255);
+    fill('p', 255);
+    end(CK_AUTH, 1, "max_lengths");
+
+    B(CK_REQUEST, 0, "connect_ipv4", 5, 1, 0, 1, 93, 184, 216, 34, 1, 187);
+    B(CK_REQUEST, 0, "connect_ipv6", 5, 1, 0, 4, 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 1, 1, 187);
+    B(CK_REQUEST, 0, "connect_dns", 5, 1, 0, 3, 15, 'w', 'w', 'w', '.', 'e', 'x', 'a', 'm',
+      'p', 'l', 'e', '.', 'c', 'o', 'm', 1, 187);
+    B(CK_REQUEST, 0, "udp_associate", 5, 3, 0, 1, 0, 0, 0, 0, 0, 0);
+    dns_dest(CK_REQUEST, 0, "connect_long_dns", connect, 253, 0);
+    B(CK_REQUEST, 1, "bind", 5, 2, 0, 1, 127, 0, 0, 1, 0, 80);
+    B(CK_REQUEST, 1, "rsv_set", 5, 1, 1, 1, 127, 0, 0, 1, 0, 80);
+    B(CK_REQUEST, 1, "atyp_2", 5, 1, 0, 2, 127, 0, 0, 1, 0, 80);
+    B(CK_REQUEST, 1, "ipv4_short", 5, 1, 0, 1, 127, 0, 0);
+    B(CK_REQUEST, 1, "ipv6_short", 5, 1, 0, 4, 0x20, 0x01, 0x0d, 0xb8, 0, 80);
+    B(CK_REQUEST, 1, "dns_len_past_end", 5, 1, 0, 3, 255, 'a', 'b', 0, 80);
+    B(CK_REQUEST, 1, "dns_nul", 5, 1, 0, 3, 3, 'a', 0, 'b', 0, 80);
+    B(CK_REQUEST, 1, "header_only", 5, 1, 0);
+    dns_dest(CK_REQUEST, 1, "dns_255", connect, 255, 0);
+
+    B(CK_UDP, 0, "dns_query_ipv4", 0, 0, 0, 1, 8, 8, 8, 8, 0, 53,
+      0x12, 0x34, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e',
+      3, 'c', 'o', 'm', 0, 0, 1, 0, 1);
+    begin();
+    put((const unsigned char[]) { 0, 0, 0, 4, 0x20, 0x01, 0x0d, 0xb8 }, 8);
+    fill(0, 11);
+    put((const unsigned char[]) { 1, 0x01, 0xbb }, 3);
+    fill('q', 1200);
+    end(CK_UDP, 0, "quic_ipv6");
+    dns_dest(CK_UDP, 0, "dns_512", udp, 16, 512);
+    B(CK_UDP, 1, "fragmented", 0, 0, 1, 1, 127, 0, 0, 1, 0, 53, 'x');
+    B(CK_UDP, 1, "rsv_set", 1, 0, 0, 1, 127, 0, 0, 1, 0, 53, 'x');
+    B(CK_UDP, 1, "header_short", 0, 0, 0, 1, 127);
+    B(CK_UDP, 1, "no_payload", 0, 0, 0, 1, 127, 0, 0, 1, 0, 53);
+    dns_dest(CK_UDP, 1, "dns_255", udp, 255, 8);
+}
+
+size_t corpus_get(const struct corpus_entry **out) {
+    if(!n_entries) build();
+    *out = entries;
+    return n_entries;
+}
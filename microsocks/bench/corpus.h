@@ -0,0 +1,31 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>
+
+/* client messages for the wire format benchmark (wirebench.c), which also
+   writes them out as the seed corpus of the fuzz target (fuzz_socks5.c).
+   realistic entries are what clients send, adversarial ones are truncated,
+   overlong or otherwise malformed. */
+
+enum corpus_kind {
+    CK_GREETING,  /* method selection */
+    CK_AUTH,      /* rfc1929 login, the valid one is user/secret */
+    CK_REQUEST,   /* CONNECT or UDP ASSOCIATE */
+    CK_UDP,       /* client datagram with its header */
+    CK_KINDS
+};
+
+struct corpus_entry {
+    enum corpus_kind kind;
+    int adversarial;
+    const char *name;
+    size_t len;
+    const unsigned char *data;
+};
+
+extern const char *corpus_kind_names[CK_KINDS];
+/* builds the corpus on first use, returns the number of entries */
+size_t corpus_get(const struct corpus_entry **entries);
+
+#endif
@@ -0,0 +1,160 @@
+/* a stub dns server for the handshake benchmark.
+   answers every A query with one address (and AAAA with -6, or an empty
+   answer otherwise) after a fixed delay, so resolution costs the same for
+   every name and no network is needed. answers are held back in a queue
+   rather than by sleeping, so concurrent queries overlap their delays.
+   SIGUSR1 prints the number of queries answered so far to stdout. */
+
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define QUEUE_SIZE 4096
+#define MAX_MSG 512
+
+struct pending {
+    uint64_t due_us;
+    struct sockaddr_storage peer;
+    socklen_t peer_len;
+    size_t len;
+    unsigned char msg[MAX_MSG];
+};
+
+static struct pending queue[QUEUE_SIZE];
+static unsigned q_head, q_len;
+static unsigned char addr4[4], addr6[16];
+static int have6;
+static uint32_t ttl = 60;
+static volatile sig_atomic_t report;
+static unsigned long long answered, dropped;
+
+static void on_usr1(int sig) {
+    (void) sig;
+    report = 1;
+}
+
+static void put16(unsigned char* p, unsigned v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+/* turns the query in buf into its answer, returns the length or 0 to drop */
+static size_t answer(unsigned char* buf, size_t n) {
+    size_t off = 12;
+    if(n < 12 || (buf[2] & 0x80) || buf[4] || buf[5] != 1) return 0;
+    while(off < n && buf[off]) {
+        if(buf[off] & 0xc0) return 0;
+        off += buf[off] + 1;
+    }
+    if(off + 5 > n) return 0;
+    unsigned qtype = buf[off + 1] << 8 | buf[off + 2];
+    off += 5;
+    const unsigned char* rdata = 0;
+    unsigned rdlen = 0;
+    if(qtype == 1) {
+        rdata = addr4;
+        rdlen = 4;
+    } else if(qtype == 28 && have6) {
+        rdata = addr6;
+        rdlen = 16;
+    }
+    /* response, keep opcode and rd, set ra, rcode 0 */
+    buf[2] = 0x80 | (buf[2] & 0x79);
+    buf[3] = 0x80;
+    put16(buf + 6, rdata != 0);
+    put16(buf + 8, 0);
+    put16(buf + 10, 0);
+    if(!rdata) return off;
+    if(off + 12 + rdlen > MAX_MSG) return 0;
+    unsigned char* p = buf + off;
+    put16(p, 0xc00c);  /* name: pointer to the question */
+    put16(p + 2, qtype);
+    put16(p + 4, 1);
+    put16(p + 6, ttl >> 16);
+    put16(p + 8, ttl);
+    put16(p + 10, rdlen);
+    memcpy(p + 12, rdata, rdlen);
+    return off + 12 + rdlen;
+}
+
+static int usage(void) {
+    dprintf(2, "usage: dnsstub [-l [host:]port] [-d delay_ms] [-a ipv4] [-6 ipv6] [-t ttl]\n");
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    struct bench_addr la;
+    uint64_t delay_us = 0;
+    int ch;
+    bench_parse_addr("127.0.0.1:53", &la);
+    inet_pton(AF_INET, "127.0.0.1", addr4);
+    while((ch = getopt(argc, argv, "l:d:a:6:t:")) != -1) {
+        switch(ch) {
+        case 'l': if(bench_parse_addr(optarg, &la)) return usage(); break;
+        case 'd': delay_us = strtoull(optarg, 0, 10) * 1000; break;
+        case 'a': if(inet_pton(AF_INET, optarg, addr4) != 1) return usage(); break;
+        case '6':
+            if(inet_pton(AF_INET6, optarg, addr6) != 1) return usage();
+            have6 = 1;
+            break;
+        case 't': ttl = strtoul(optarg, 0, 10); break;
+        default: return usage();
+        }
+    }
+    int fd = bench_listen(&la, SOCK_DGRAM, -1);
+    if(fd == -1) {
+        perror("dnsstub");
+        return 1;
+    }
+    bench_nonblock(fd);
+    struct sigaction sa = { .sa_handler = on_usr1 };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, 0);
+
+    for(;;) {
+        int timeout = -1;
+        if(q_len) {
+            uint64_t now = bench_now_us(), due = queue[q_head].due_us;
+            timeout = due > now ? (int)((due - now + 999) / 1000) : 0;
+        }
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int r = poll(&pfd, 1, timeout);
+        if(report) {
+            report = 0;
+            printf("queries %llu dropped %llu\n", answered, dropped);
+            fflush(stdout);
+        }
+        if(r > 0) for(;;) {
+            struct pending* p = &queue[(q_head + q_len) % QUEUE_SIZE];
+            struct pending tmp;
+            if(q_len == QUEUE_SIZE) p = &tmp;
+            p->peer_len = sizeof p->peer;
+            ssize_t n = recvfrom(fd, p->msg, MAX_MSG, 0, (void*) &p->peer, &p->peer_len);
+            if(n <= 0) break;
+            if(p == &tmp || !(p->len = answer(p->msg, n))) {
+                dropped++;
+                continue;
+            }
+            p->due_us = bench_now_us() + delay_us;
+            q_len++;
+        }
+        uint64_t now = bench_now_us();
+        while(q_len && queue[q_head].due_us <= now) {
+            struct pending* p = &queue[q_head];
+            if(sendto(fd, p->msg, p->len, 0, (void*) &p->peer, p->peer_len) == -1 && errno == EAGAIN)
+                break;
+            answered++;
+            q_head = (q_head + 1) % QUEUE_SIZE;
+            q_len--;
+        }
+    }
+}
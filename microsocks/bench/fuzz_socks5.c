@@ -0,0 +1,92 @@
+/* fuzz target for the SOCKS5 wire format code in socks5.c.
+   the first byte of an input picks the parser (see enum corpus_kind), the
+   rest is the message. besides the sanitizers it checks that parsers
+   never claim more bytes than they got, that addresses are terminated and
+   that udp headers survive being encoded and parsed again.
+   `make fuzz` builds it for libFuzzer with clang and seeds it from the
+   benchmark corpus (wirebench -w). built with -DFUZZ_MAIN it instead runs
+   the files given on the command line, or stdin, once each, which is how
+   to replay a crash, or to drive it from afl. */
+
+#include "corpus.h"
+#include "../socks5.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(x) do { if(!(x)) { fprintf(stderr, "check failed: %s\n", #x); abort(); } } while(0)
+
+static void check_addrport(const struct socks5_addrport *ap) {
+    CHECK(memchr(ap->addr, 0, sizeof ap->addr));
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    struct socks5_addrport ap, ap2;
+    unsigned char hdr[MAX_SOCKS5_HEADER_LEN];
+    char name[256];
+    int cmd, r;
+    ssize_t off, len;
+    if(size < 1) return 0;
+    /* a copy of exactly the message, so reads past it are caught */
+    size_t n = size - 1;
+    unsigned char *buf = malloc(n ? n : 1);
+    if(!buf) return 0;
+    memcpy(buf, data + 1, n);
+    switch(data[0] % CK_KINDS) {
+    case CK_GREETING:
+        r = socks5_auth_method(buf, n, data[0] & 0x10, data[0] & 0x20);
+        CHECK(r == AM_NO_AUTH || r == AM_USERNAME || r == AM_INVALID);
+        break;
+    case CK_AUTH:
+        r = socks5_check_credentials(buf, n, "user", "secret", name);
+        CHECK(r == EC_SUCCESS || r == EC_NOT_ALLOWED || r == EC_GENERAL_FAILURE);
+        if(r != EC_GENERAL_FAILURE) CHECK(memchr(name, 0, sizeof name));
+        break;
+    case CK_REQUEST:
+        if(socks5_parse_request(buf, n, &cmd, &ap) == EC_SUCCESS) {
+            CHECK(cmd == 1 || cmd == 3);
+            check_addrport(&ap);
+        }
+        if(n >= 3 && (r = socks5_parse_addrport(buf + 3, n - 3, &ap)) >= 0) {
+            CHECK((size_t) r <= n - 3);
+            check_addrport(&ap);
+        }
+        break;
+    case CK_UDP:
+        off = socks5_parse_udp(buf, n, &ap);
+        if(off < 0) break;
+        CHECK((size_t) off <= n);
+        check_addrport(&ap);
+        len = socks5_udp_header(hdr, &ap);
+        CHECK(len > 0 && len <= (ssize_t) sizeof hdr);
+        CHECK(socks5_parse_udp(hdr, len, &ap2) == len);
+        CHECK(ap.type == ap2.type && ap.port == ap2.port && !strcmp(ap.addr, ap2.addr));
+        break;
+    }
+    free(buf);
+    return 0;
+}
+
+#ifdef FUZZ_MAIN
+static void run_file(FILE *f) {
+    static uint8_t buf[65536];
+    size_t n = fread(buf, 1, sizeof buf, f);
+    LLVMFuzzerTestOneInput(buf, n);
+}
+
+int main(int argc, char **argv) {
+    int i;
+    if(argc < 2) run_file(stdin);
+    for(i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if(!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        run_file(f);
+        fclose(f);
+    }
+    return 0;
+}
+#endif
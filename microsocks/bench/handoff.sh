@@ -0,0 +1,48 @@
+#!/bin/sh
+# upgrade check, run by `make check-handoff`.
+# echo tunnels run through a proxy started with -H while a second proxy
+# with the same -H path and -T takes over, so the tunnels finish in the
+# new process. then every tunnel must have echoed without errors, and
+# every span in the new process's trace must lie within the run; adopted
+# tunnels started before that process did, so theirs begin below 0.
+#
+#   PROXY     proxy binary (./microsocks)
+#   DURATION  seconds the tunnels run (4)
+#   PORT      proxy port (21080), the target uses the three after it
+
+cd "$(dirname "$0")/.." || exit 1
+PROXY=${PROXY:-./microsocks}
+DURATION=${DURATION:-4}
+PORT=${PORT:-21080}
+
+. bench/lib.sh
+dir=$(mktemp -d) || exit 1
+sock=$dir/handoff.sock
+trace=$dir/trace.json
+
+start_target
+start_proxy all -H "$sock"
+old_pid=$proxy_pid
+wait_proxy
+./bench/loadgen -x 127.0.0.1:$proxy_port -t 127.0.0.1:$echo_port -m echo -s 64 \
+	-c 4 -d "$DURATION" > "$dir/load.json" &
+load_pid=$!
+sleep 1
+start_proxy all -H "$sock" -T "$trace"
+wait "$load_pid"
+wait "$old_pid" 2>/dev/null
+stop_proxy
+
+fail=0
+grep -q '"errors": *0[,}]' "$dir/load.json" ||
+	{ echo "tunnels failed across the handoff: $(cat "$dir/load.json")" >&2; fail=1; }
+grep -q '"name":"connection"' "$trace" 2>/dev/null ||
+	{ echo "no tunnel finished in the new process" >&2; fail=1; }
+# ts and dur are in microseconds
+sed -n 's/.*"ts":\([-0-9.]*\),"dur":\([0-9.]*\).*/\1 \2/p' "$trace" |
+	awk -v max=$(((DURATION + 5) * 1000000)) '
+		$1 < -max || $1 > max || $1 + $2 > max { print "span outside the run: ts " $1 " dur " $2; bad = 1 }
+		END { exit bad }' >&2 || fail=1
+rm -rf "$dir"
+[ $fail = 0 ] && echo "handoff ok" >&2
+exit $fail
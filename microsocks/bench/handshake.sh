@@ -0,0 +1,93 @@
+#!/bin/sh
+# handshake latency benchmark, run by `make bench-handshake`.
+# many short tunnels (loadgen -m rate) to names under ZONE, which the proxy
+# resolves through bench/dnsstub, to the echo port of bench/target. every
+# run records the greeting, auth and request round trips, the whole
+# handshake and the time to the first byte, plus the dns queries the stub
+# answered per tunnel, for each stub delay, auth mode and concurrency.
+#
+# on linux the script re-runs itself in a private user, network and mount
+# namespace where the stub serves 127.0.0.1:53 and a private resolv.conf
+# points there, so it needs neither root nor a network. elsewhere point the
+# resolver at the stub for ZONE yourself and set DNS_PORT, e.g. on macos
+# /etc/resolver/bench.test with "nameserver 127.0.0.1" and "port 5353".
+#
+#   PROXY      proxy binary (./microsocks)
+#   AUTH       auth modes: none, auth (-u/-P), once (-1 -u -P) ("none auth once")
+#   DNS_DELAY  stub response delays in ms ("0 2 20")
+#   NAMES      distinct names the tunnels cycle through (1000)
+#   CONC       concurrency levels ("1 16")
+#   DURATION   seconds per run (5)
+#   ZONE       domain the names live in (bench.test)
+#   DNS_PORT   port of the stub (53)
+#   PORT       first of four local ports to use (21080)
+#   OUT        result file (bench/handshake.json)
+
+cd "$(dirname "$0")/.." || exit 1
+PROXY=${PROXY:-./microsocks}
+AUTH=${AUTH:-none auth once}
+DNS_DELAY=${DNS_DELAY:-0 2 20}
+NAMES=${NAMES:-1000}
+CONC=${CONC:-1 16}
+DURATION=${DURATION:-5}
+ZONE=${ZONE:-bench.test}
+DNS_PORT=${DNS_PORT:-53}
+PORT=${PORT:-21080}
+OUT=${OUT:-bench/handshake.json}
+
+if [ "$(uname)" = Linux ] && [ "$DNS_PORT" = 53 ] && [ -z "$BENCH_NETNS" ]; then
+	export PROXY AUTH DNS_DELAY NAMES CONC DURATION ZONE DNS_PORT PORT OUT
+	BENCH_NETNS=1 exec unshare -rn --mount sh bench/handshake.sh
+fi
+if [ -n "$BENCH_NETNS" ]; then
+	ip link set lo up || exit 1
+	echo "nameserver 127.0.0.1" > bench/resolv.conf.tmp
+	mount --bind bench/resolv.conf.tmp /etc/resolv.conf || exit 1
+	rm -f bench/resolv.conf.tmp
+fi
+
+. bench/lib.sh
+
+dns_out=$OUT.dns
+dns_pid=
+# prints the number of queries the stub answered so far
+dns_queries() {
+	kill -USR1 "$dns_pid"
+	sleep 0.2
+	sed -n 's/^queries \([0-9]*\).*/\1/p' "$dns_out" | tail -n 1
+}
+
+start_target
+tmp=$OUT.tmp
+: > "$tmp"
+for delay in $DNS_DELAY; do
+	./bench/dnsstub -l 127.0.0.1:$DNS_PORT -d "$delay" > "$dns_out" &
+	dns_pid=$!
+	bench_pids="$bench_pids $dns_pid"
+	for auth in $AUTH; do
+		case $auth in
+			none) popts= ; lopts= ;;
+			auth) popts="-u bench -P bench" ; lopts="-u bench -P bench" ;;
+			once) popts="-1 -u bench -P bench" ; lopts="-u bench -P bench -o" ;;
+			*) echo "unknown auth mode $auth" >&2; exit 1 ;;
+		esac
+		start_proxy all $popts
+		wait_proxy $lopts
+		for conc in $CONC; do
+			echo "dns_delay=$delay auth=$auth conc=$conc" >&2
+			q0=$(dns_queries)
+			line=$(./bench/loadgen -x 127.0.0.1:$proxy_port -t $ZONE:$echo_port \
+				-m rate -c "$conc" -d "$DURATION" -n "$NAMES" $lopts \
+				-p "$proxy_pid" -L auth="$auth" -L dns_delay_ms="$delay") ||
+				echo "loadgen failed" >&2
+			q1=$(dns_queries)
+			[ -n "$line" ] && echo "${line%\}}, \"dns_queries\": $((q1 - q0))}" >> "$tmp"
+		done
+		stop_proxy
+	done
+	kill "$dns_pid"
+	wait "$dns_pid" 2>/dev/null
+done
+rm -f "$dns_out"
+
+META="\"names\": $NAMES, \"zone\": \"$ZONE\"" write_results "$OUT"
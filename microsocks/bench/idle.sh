@@ -0,0 +1,61 @@
+#!/bin/sh
+# idle connection benchmark, run by `make bench-idle`.
+# bench/idlegen opens STEPS mostly idle tunnels plus UDP_PCT percent udp
+# associations through the proxy, step by step, and records the proxy's
+# rss, fds and threads after each step, and from them the bytes, fds and
+# threads per idle connection. every entry of MODES is a proxy setup:
+# name=options, with commas for spaces in the options.
+#
+#   PROXY     proxy binary (./microsocks)
+#   MODES     proxy setups ("threads prefork=-F,<ncpu>")
+#   STEPS     tunnel counts ("1000 10000 100000")
+#   UDP_PCT   udp associations per 100 tunnels (10)
+#   ACTIVE    percent of the tunnels that ping once a second (1)
+#   HOLD      seconds every step is held before measuring (5)
+#   TARGETS   echo ports the tunnels are spread over (8)
+#   NOFILE    fd limit to ask for, raising the hard limit needs root (1048576)
+#   PORT      first local port to use (21080), the echo ports follow it
+#   OUT       result file (bench/idle.json)
+
+cd "$(dirname "$0")/.." || exit 1
+PROXY=${PROXY:-./microsocks}
+STEPS=${STEPS:-1000 10000 100000}
+UDP_PCT=${UDP_PCT:-10}
+ACTIVE=${ACTIVE:-1}
+HOLD=${HOLD:-5}
+TARGETS=${TARGETS:-8}
+NOFILE=${NOFILE:-1048576}
+PORT=${PORT:-21080}
+OUT=${OUT:-bench/idle.json}
+
+. bench/lib.sh
+MODES=${MODES:-threads prefork=-F,$ncpu}
+
+# proxy, target and client each hold a socket per tunnel
+ulimit -n "$NOFILE" 2>/dev/null || ulimit -n "$(ulimit -Hn)" 2>/dev/null
+max=0
+for s in $STEPS; do [ "$s" -gt "$max" ] && max=$s; done
+# one client address has ~28k ports towards the proxy
+sources=1
+[ "$(uname -s)" = Linux ] && sources=$((max / 20000 + 1))
+steps=$(echo $STEPS | tr ' ' ,)
+
+spawn ./bench/target -w "$ncpu" -l 127.0.0.1:$echo_port-$((echo_port + TARGETS - 1))=echo \
+	-l 127.0.0.1:$echo_port=udpecho
+tmp=$OUT.tmp
+: > "$tmp"
+for m in $MODES; do
+	name=${m%%=*}
+	opts=
+	[ "$name" != "$m" ] && opts=$(echo "${m#*=}" | tr , ' ')
+	echo "mode $name: $opts" >&2
+	start_proxy all $opts
+	wait_proxy
+	./bench/idlegen -x 127.0.0.1:$proxy_port -t 127.0.0.1:$echo_port -m "$TARGETS" \
+		-T 127.0.0.1:$echo_port -U "$UDP_PCT" -A "$ACTIVE" -s "$steps" -i "$HOLD" \
+		-b "$sources" -p "$proxy_pid" -L proxy_mode="$name" >> "$tmp" ||
+		echo "idlegen failed" >&2
+	stop_proxy
+done
+
+META="\"nofile\": \"$(ulimit -n)\"" write_results "$OUT"
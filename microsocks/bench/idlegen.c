@@ -0,0 +1,318 @@
+/* opens mostly idle tunnels and udp associations through the proxy in
+   steps and measures what the proxy holds on to for them.
+   -s has the tunnel counts of the steps; every step opens tunnels up to
+   that count, plus -U percent as many udp associations, which each send
+   one datagram to the -T udp echo port. tunnels go to -m echo ports from
+   -t on, so that the proxy's own connections spread over several ports.
+   one client address only has ~28k ports towards the proxy, with -b the
+   client binds to that many loopback addresses 127.0.1.x (linux).
+   -w threads open the connections. then the step holds for -i seconds,
+   -A percent of the tunnels send a ping through the echo target every
+   second, and the rss, fds and threads of the proxy (-p, with its
+   children) are read. one json line per step has them, also per
+   connection against the proxy before the first step and against the
+   step before. a step that can't open everything is reported with what
+   it reached and ends the run. */
+
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MAX_STEPS 16
+#define PING_TIMEOUT_MS 2000
+#define UDP_TIMEOUT_MS 2000
+
+struct conn {
+    int tcp, udp;
+};
+
+static struct {
+    struct bench_addr proxy, target, udp_target;
+    struct socks5_auth auth;
+    unsigned targets, sources, threads;
+    int have_udp;
+} opt;
+
+/* the connections of the current step are opened at indices from
+   *_from up to *_goal, failed ones keep fd -1 */
+static struct conn *tunnels, *assocs;
+static unsigned t_next, t_goal, a_next, a_goal;
+static int stop, first_errno;
+static const char* first_error;
+static unsigned udp_unanswered;
+
+static void fail(const char* what, int e) {
+    if(!__atomic_exchange_n(&stop, 1, __ATOMIC_SEQ_CST)) {
+        first_error = what;
+        first_errno = e;
+    }
+}
+
+static int proxy_socket(unsigned i) {
+    if(opt.sources <= 1) return bench_connect(&opt.proxy);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd == -1) return -1;
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    /* the port is picked by connect(), per destination */
+    int one = 1;
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof one);
+#endif
+    struct sockaddr_in sa = { .sin_family = AF_INET };
+    sa.sin_addr.s_addr = htonl(0x7f000100 + 1 + i % opt.sources);
+    if(bind(fd, (void*) &sa, sizeof sa) || bench_connect_fd(fd, &opt.proxy)) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return -1;
+    }
+    return fd;
+}
+
+static int open_tunnel(struct conn* c, unsigned i) {
+    if((c->tcp = proxy_socket(i)) == -1) {
+        fail("connect", errno);
+        return -1;
+    }
+    int r = socks5_connect(c->tcp, &opt.auth, opt.target.host, opt.target.port + i % opt.targets, 0);
+    if(r) {
+        fail(r > 0 ? "socks5 refused" : "socks5", r > 0 ? 0 : errno);
+        close(c->tcp);
+        c->tcp = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int open_assoc(struct conn* c, unsigned i) {
+    unsigned char buf[4 + 256 + 2 + 8];
+    struct bench_addr local, relay;
+    bench_parse_addr("127.0.0.1:0", &local);
+    if((c->udp = bench_listen(&local, SOCK_DGRAM, -1)) == -1) {
+        fail("udp socket", errno);
+        return -1;
+    }
+    c->tcp = proxy_socket(i);
+    int r = c->tcp == -1 || bench_sockname(c->udp, 0, &local) ? -1 :
+            socks5_udp_associate(c->tcp, &opt.auth, &local, &relay);
+    if(!r && bench_connect_fd(c->udp, &relay)) r = -1;
+    if(r) {
+        fail(r > 0 ? "udp associate refused" : "udp associate", r > 0 ? 0 : errno);
+        if(c->tcp != -1) close(c->tcp);
+        close(c->udp);
+        c->tcp = c->udp = -1;
+        return -1;
+    }
+    /* one round trip, so the proxy has a flow to the target */
+    size_t h = bench_udp_header(buf, &opt.udp_target);
+    memset(buf + h, 'x', 8);
+    struct pollfd pfd = { .fd = c->udp, .events = POLLIN };
+    if(send(c->udp, buf, h + 8, 0) == -1 || poll(&pfd, 1, UDP_TIMEOUT_MS) != 1 ||
+       recv(c->udp, buf, sizeof buf, 0) <= 0)
+        __atomic_fetch_add(&udp_unanswered, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void* opener(void* arg) {
+    unsigned i;
+    (void) arg;
+    while(!__atomic_load_n(&stop, __ATOMIC_RELAXED) &&
+          (i = __atomic_fetch_add(&t_next, 1, __ATOMIC_RELAXED)) < t_goal)
+        open_tunnel(&tunnels[i], i);
+    while(!__atomic_load_n(&stop, __ATOMIC_RELAXED) &&
+          (i = __atomic_fetch_add(&a_next, 1, __ATOMIC_RELAXED)) < a_goal)
+        open_assoc(&assocs[i], i);
+    return 0;
+}
+
+/* moves the open connections of [from, goal) down to from, returns the new count */
+static unsigned compact(struct conn* c, unsigned from, unsigned goal) {
+    unsigned i, n = from;
+    for(i = from; i < goal; i++)
+        if(c[i].tcp != -1) c[n++] = c[i];
+    return n;
+}
+
+/* one ping through every stride-th tunnel, returns the slowest round trip */
+static uint64_t ping(unsigned n, unsigned stride, unsigned* ok, unsigned* failed) {
+    struct pollfd* pfd = calloc(n / stride + 1, sizeof *pfd);
+    unsigned* got = calloc(n / stride + 1, sizeof *got);
+    unsigned i, k = 0, left;
+    char buf[8] = "ping1234";
+    uint64_t start = bench_now_us(), max = 0;
+    if(!pfd || !got) goto out;
+    for(i = 0; i < n; i += stride) {
+        if(write(tunnels[i].tcp, buf, sizeof buf) != sizeof buf) {
+            (*failed)++;
+            continue;
+        }
+        pfd[k++] = (struct pollfd) { .fd = tunnels[i].tcp, .events = POLLIN };
+    }
+    left = k;
+    while(left) {
+        int wait = PING_TIMEOUT_MS - (int)((bench_now_us() - start) / 1000);
+        if(wait <= 0 || poll(pfd, k, wait) <= 0) break;
+        for(i = 0; i < k; i++) {
+            if(!pfd[i].revents) continue;
+            ssize_t r = read(pfd[i].fd, buf, sizeof buf - got[i]);
+            if(r > 0 && (got[i] += r) < sizeof buf) continue;
+            if(r > 0) (*ok)++;
+            else (*failed)++;
+            pfd[i].fd = -1;
+            left--;
+        }
+        uint64_t t = bench_now_us() - start;
+        if(t > max) max = t;
+    }
+    *failed += left;
+out:
+    free(pfd);
+    free(got);
+    return max;
+}
+
+static void print_per_conn(const char* key, double v, unsigned conns, int known) {
+    if(known && conns) printf(", \"%s\": %.1f", key, v / conns);
+    else printf(", \"%s\": null", key);
+}
+
+static int usage(void) {
+    dprintf(2, "usage: idlegen -x proxy -t target [-m targets] [-T udptarget] [-U udp_pct]\n"
+               "               [-s steps] [-i hold_secs] [-A active_pct] [-w threads] [-b sources]\n"
+               "               [-u user -P pass] [-p proxypid] [-L key=value]...\n");
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    unsigned steps[MAX_STEPS], n_steps = 0, udp_pct = 10, hold = 5, active_pct = 1;
+    unsigned i, s, n_labels = 0, n_t = 0, n_a = 0;
+    const char* labels[16];
+    pid_t pid = 0;
+    int ch, have_proxy = 0, have_target = 0;
+    opt.targets = 1;
+    opt.threads = 8;
+    opt.sources = 1;
+    while((ch = getopt(argc, argv, "x:t:m:T:U:s:i:A:w:b:u:P:p:L:")) != -1) {
+        switch(ch) {
+        case 'x': have_proxy = !bench_parse_addr(optarg, &opt.proxy); break;
+        case 't': have_target = !bench_parse_addr(optarg, &opt.target); break;
+        case 'm': opt.targets = atoi(optarg); break;
+        case 'T': opt.have_udp = !bench_parse_addr(optarg, &opt.udp_target); break;
+        case 'U': udp_pct = atoi(optarg); break;
+        case 's': {
+            char* p = optarg;
+            n_steps = 0;
+            do {
+                if(n_steps == MAX_STEPS || !(steps[n_steps++] = strtoul(p, &p, 10))) return usage();
+            } while(*p++ == ',');
+            if(p[-1]) return usage();
+            break;
+        }
+        case 'i': hold = atoi(optarg); break;
+        case 'A': active_pct = atoi(optarg); break;
+        case 'w': opt.threads = atoi(optarg); break;
+        case 'b': opt.sources = atoi(optarg); break;
+        case 'u': opt.auth.user = optarg; break;
+        case 'P': opt.auth.pass = optarg; break;
+        case 'p': pid = atoi(optarg); break;
+        case 'L':
+            if(!strchr(optarg, '=') || n_labels == sizeof labels / sizeof *labels) return usage();
+            labels[n_labels++] = optarg;
+            break;
+        default: return usage();
+        }
+    }
+    if(!n_steps) {
+        steps[n_steps++] = 1000;
+        steps[n_steps++] = 10000;
+        steps[n_steps++] = 100000;
+    }
+    if(!opt.have_udp) udp_pct = 0;
+    for(s = 1; s < n_steps; s++)
+        if(steps[s] < steps[s - 1]) return usage();
+    if(!have_proxy || !have_target || !opt.targets || !opt.threads || !opt.sources ||
+       active_pct > 100 || opt.targets + opt.target.port > 65536 ||
+       (opt.auth.user && !opt.auth.pass)) return usage();
+    signal(SIGPIPE, SIG_IGN);
+    unsigned long nofile = bench_raise_nofile();
+    unsigned max_t = steps[n_steps - 1], max_a = (unsigned long long) max_t * udp_pct / 100;
+    if(nofile < max_t + 2ULL * max_a + 64)
+        dprintf(2, "idlegen: only %lu fds, the last steps will fail\n", nofile);
+    tunnels = malloc((max_t + 1) * sizeof *tunnels);
+    assocs = malloc((max_a + 1) * sizeof *assocs);
+    pthread_t* pt = calloc(opt.threads, sizeof *pt);
+    if(!tunnels || !assocs || !pt) return 1;
+    for(i = 0; i < max_t; i++) tunnels[i] = (struct conn) { -1, -1 };
+    for(i = 0; i < max_a; i++) assocs[i] = (struct conn) { -1, -1 };
+
+    struct bench_usage base = { 0 }, prev, u;
+    int have_usage = pid && !bench_proc_usage(pid, &base);
+    prev = base;
+    for(s = 0; s < n_steps && !stop; s++) {
+        t_next = n_t;
+        t_goal = steps[s];
+        a_next = n_a;
+        a_goal = (unsigned long long) steps[s] * udp_pct / 100;
+        udp_unanswered = 0;
+        uint64_t t0 = bench_now_us();
+        unsigned started = 0;
+        for(i = 0; i < opt.threads; i++)
+            if(!pthread_create(&pt[i], 0, opener, 0)) started++;
+            else break;
+        if(!started) opener(0);
+        for(i = 0; i < started; i++) pthread_join(pt[i], 0);
+        double open_secs = (bench_now_us() - t0) / 1e6;
+        unsigned prev_conns = n_t + n_a;
+        n_t = compact(tunnels, n_t, t_goal);
+        n_a = compact(assocs, n_a, a_goal);
+        dprintf(2, "step %u: %u tunnels, %u udp associations in %.1fs\n", steps[s], n_t, n_a, open_secs);
+
+        unsigned ping_ok = 0, ping_failed = 0, sec;
+        uint64_t ping_max = 0;
+        for(sec = 0; sec < hold; sec++) {
+            uint64_t t = bench_now_us(), m = 0;
+            if(active_pct && n_t) m = ping(n_t, 100 / active_pct, &ping_ok, &ping_failed);
+            if(m > ping_max) ping_max = m;
+            t = bench_now_us() - t;
+            if(t < 1000000) bench_sleep_us(1000000 - t);
+        }
+        int measured = have_usage && !bench_proc_usage(pid, &u);
+
+        printf("{\"mode\": \"idle\"");
+        for(i = 0; i < n_labels; i++) {
+            const char* eq = strchr(labels[i], '=');
+            printf(", \"%.*s\": \"%s\"", (int)(eq - labels[i]), labels[i], eq + 1);
+        }
+        printf(", \"step\": %u, \"tunnels\": %u, \"udp_assocs\": %u, \"open_secs\": %.3f", steps[s], n_t, n_a,
+               open_secs);
+        if(n_a) printf(", \"udp_unanswered\": %u", udp_unanswered);
+        if(stop) printf(", \"error\": \"%s%s%s\"", first_error, first_errno ? ": " : "",
+                        first_errno ? strerror(first_errno) : "");
+        printf(", \"ping_ok\": %u, \"ping_failed\": %u, \"ping_max_us\": %llu", ping_ok, ping_failed,
+               (unsigned long long) ping_max);
+        if(measured) {
+            unsigned conns = n_t + n_a;
+            printf(", \"proxy_procs\": %u, \"proxy_rss_kb\": %llu, \"proxy_fds\": %ld, \"proxy_threads\": %ld",
+                   u.procs, u.rss_kb, u.fds, u.threads);
+            print_per_conn("bytes_per_conn", ((double) u.rss_kb - base.rss_kb) * 1024, conns, 1);
+            print_per_conn("bytes_per_conn_marginal", ((double) u.rss_kb - prev.rss_kb) * 1024,
+                           conns - prev_conns, 1);
+            print_per_conn("fds_per_conn", (double) u.fds - base.fds, conns, u.fds >= 0);
+            print_per_conn("threads_per_conn", (double) u.threads - base.threads, conns, u.threads >= 0);
+            prev = u;
+        }
+        printf("}\n");
+        fflush(stdout);
+    }
+    return n_t ? 0 : 1;
+}
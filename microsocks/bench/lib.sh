@@ -0,0 +1,78 @@
+# shell helpers shared by the benchmark scripts, sourced from the
+# microsocks directory after PROXY, PORT and friends are set.
+# the proxy listens on PORT, the target on the three ports after it.
+
+PORT=${PORT:-21080}
+ncpu=$(getconf _NPROCESSORS_ONLN 2>/dev/null || sysctl -n hw.ncpu 2>/dev/null || echo 1)
+proxy_port=$PORT
+sink_port=$((PORT + 1))
+source_port=$((PORT + 2))
+echo_port=$((PORT + 3))
+proxy_pid=
+bench_pids=
+
+cleanup() {
+	[ -n "$proxy_pid" ] && kill "$proxy_pid" 2>/dev/null
+	for p in $bench_pids; do kill "$p" 2>/dev/null; done
+	wait 2>/dev/null
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# runs a helper in the background until the script exits
+spawn() {
+	"$@" &
+	bench_pids="$bench_pids $!"
+}
+
+start_target() {
+	spawn ./bench/target -w "$ncpu" -l 127.0.0.1:$sink_port=sink \
+		-l 127.0.0.1:$source_port=source -l 127.0.0.1:$echo_port=echo
+}
+
+# waits until a tunnel through the proxy to the echo port works, the
+# arguments are passed on to loadgen (credentials)
+wait_proxy() {
+	i=0
+	until ./bench/loadgen -x 127.0.0.1:$proxy_port -t 127.0.0.1:$echo_port \
+	      -m rate -d 1 "$@" >/dev/null 2>&1 ||
+	      [ $i -ge 50 ]; do
+		sleep 0.1
+		i=$((i + 1))
+	done
+}
+
+# start_proxy cores [proxy options]: cores is a count to pin the proxy to
+# with taskset, or "all"
+start_proxy() {
+	cores=$1
+	shift
+	if [ "$cores" = all ]; then
+		"$PROXY" -q -i 127.0.0.1 -p $proxy_port "$@" &
+	else
+		taskset -c 0-$((cores - 1)) "$PROXY" -q -i 127.0.0.1 -p $proxy_port "$@" &
+	fi
+	proxy_pid=$!
+}
+
+stop_proxy() {
+	kill "$proxy_pid" 2>/dev/null
+	wait "$proxy_pid" 2>/dev/null
+	proxy_pid=
+}
+
+# write_results file: wraps the json lines collected in file.tmp into one
+# document with a "meta" object, extra meta fields can come in META
+write_results() {
+	{
+		printf '{"meta": {"date": "%s", "host": "%s", "os": "%s", "ncpu": %s%s%s%s},\n' \
+			"$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(uname -n)" "$(uname -sr)" "$ncpu" \
+			"${PROXY:+, \"proxy\": \"$PROXY\"}" "${DURATION:+, \"duration\": $DURATION}" \
+			"${META:+, $META}"
+		printf ' "results": [\n'
+		sed -e 's/^/  /' -e '$!s/$/,/' "$1.tmp"
+		printf ' ]}\n'
+	} > "$1"
+	rm -f "$1.tmp"
+	echo "results written to $1" >&2
+}
@@ -0,0 +1,221 @@
+/* SOCKS5 load generator.
+   -c threads each drive one tunnel at a time through the proxy to a target
+   for -d seconds and the result is printed as one json object:
+     up    write -s sized chunks into a sink
+     down  read from a source
+     echo  write -s bytes, read them back, repeat (request/response)
+     rate  connect, handshake, one byte there and back, close: tunnels/s
+   rate also records the handshake phases and the time to the first byte.
+   with -n the target name gets a prefix out of n ("n17.host") per tunnel,
+   so the proxy has to resolve that many different names.
+   -o offers no authentication besides -u/-P, which auth-once proxies take
+   from clients that logged in before.
+   with -p the proxy's cpu time is sampled before and after the run. */
+
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../hist.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum mode { M_UP, M_DOWN, M_ECHO, M_RATE };
+static const char* mode_names[] = { "up", "down", "echo", "rate" };
+
+static struct {
+    struct bench_addr proxy, target;
+    struct socks5_auth auth;
+    enum mode mode;
+    size_t size;
+    unsigned names;
+    uint64_t deadline;
+} opt;
+
+static struct hist setup_hist, rtt_hist;
+/* rate mode: the socks5_timing phases, greeting to reply, and reply to
+   the first byte coming back */
+static struct hist greeting_hist, auth_hist, request_hist, handshake_hist, ttfb_hist;
+static unsigned next_name;
+static uint64_t total_bytes, total_tunnels, total_errors;
+
+/* returns a relaying tunnel, -1 after counting the error */
+static int open_tunnel(void) {
+    char name[sizeof opt.target.host + 16];
+    const char* host = opt.target.host;
+    struct socks5_timing tm;
+    if(opt.names) {
+        unsigned k = __atomic_fetch_add(&next_name, 1, __ATOMIC_RELAXED) % opt.names;
+        snprintf(name, sizeof name, "n%u.%s", k, opt.target.host);
+        host = name;
+    }
+    uint64_t t0 = bench_now_us();
+    int fd = bench_connect(&opt.proxy);
+    uint64_t t1 = bench_now_us();
+    if(fd == -1 || socks5_connect(fd, &opt.auth, host, opt.target.port, &tm)) {
+        if(fd != -1) close(fd);
+        __atomic_fetch_add(&total_errors, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    uint64_t t2 = bench_now_us();
+    hist_record(&setup_hist, t2 - t0);
+    if(opt.mode == M_RATE) {
+        hist_record(&greeting_hist, tm.greeting);
+        if(tm.auth) hist_record(&auth_hist, tm.auth);
+        hist_record(&request_hist, tm.request);
+        hist_record(&handshake_hist, t2 - t1);
+    }
+    __atomic_fetch_add(&total_tunnels, 1, __ATOMIC_RELAXED);
+    return fd;
+}
+
+/* moves data over one tunnel until the deadline, returns the byte count */
+static uint64_t transfer(int fd, char* buf) {
+    uint64_t bytes = 0;
+    while(bench_now_us() < opt.deadline) {
+        if(opt.mode == M_UP) {
+            if(bench_write_all(fd, buf, opt.size)) break;
+            bytes += opt.size;
+        } else if(opt.mode == M_DOWN) {
+            ssize_t n = read(fd, buf, opt.size);
+            if(n <= 0 && !(n < 0 && errno == EINTR)) break;
+            if(n > 0) bytes += n;
+        } else {
+            uint64_t t0 = bench_now_us();
+            if(bench_write_all(fd, buf, opt.size) || bench_read_full(fd, buf, opt.size)) break;
+            hist_record(&rtt_hist, bench_now_us() - t0);
+            bytes += opt.size;
+        }
+    }
+    return bytes;
+}
+
+static void* run(void* arg) {
+    char* buf = malloc(opt.size);
+    uint64_t bytes = 0;
+    (void) arg;
+    if(!buf) return 0;
+    memset(buf, 'x', opt.size);
+    while(bench_now_us() < opt.deadline) {
+        int fd = open_tunnel();
+        if(fd == -1) {
+            /* don't spin on a proxy that is refusing */
+            bench_sleep_us(1000);
+            continue;
+        }
+        if(opt.mode == M_RATE) {
+            uint64_t t0 = bench_now_us();
+            if(bench_write_all(fd, buf, 1) || bench_read_full(fd, buf, 1))
+                __atomic_fetch_add(&total_errors, 1, __ATOMIC_RELAXED);
+            else {
+                hist_record(&ttfb_hist, bench_now_us() - t0);
+                bytes++;
+            }
+        } else {
+            bytes += transfer(fd, buf);
+        }
+        close(fd);
+    }
+    __atomic_fetch_add(&total_bytes, bytes, __ATOMIC_RELAXED);
+    free(buf);
+    return 0;
+}
+
+static void print_hist(const char* name, struct hist* h) {
+    struct hist_snapshot s;
+    hist_merge(h, &s);
+    printf(", \"%s_us\": {\"count\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}",
+           name, (unsigned long long) s.count,
+           (unsigned long long) hist_quantile(&s, .5), (unsigned long long) hist_quantile(&s, .9),
+           (unsigned long long) hist_quantile(&s, .99), (unsigned long long) hist_quantile(&s, 1));
+}
+
+static int usage(void) {
+    dprintf(2, "usage: loadgen -x proxy -t target [-m up|down|echo|rate] [-c threads] [-d secs]\n"
+               "               [-s size] [-u user -P pass [-o]] [-n names] [-p proxypid]\n"
+               "               [-L key=value]...\n");
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    unsigned conc = 1, secs = 5, i, n_labels = 0;
+    const char* labels[16];
+    pid_t pid = 0;
+    int ch, have_proxy = 0, have_target = 0;
+    opt.size = 65536;
+    while((ch = getopt(argc, argv, "x:t:m:c:d:s:u:P:on:p:L:")) != -1) {
+        switch(ch) {
+        case 'x': have_proxy = !bench_parse_addr(optarg, &opt.proxy); break;
+        case 't': have_target = !bench_parse_addr(optarg, &opt.target); break;
+        case 'm':
+            for(i = 0; i < 4 && strcmp(optarg, mode_names[i]); i++);
+            if(i == 4) return usage();
+            opt.mode = i;
+            break;
+        case 'c': conc = atoi(optarg); break;
+        case 'd': secs = atoi(optarg); break;
+        case 's': opt.size = strtoul(optarg, 0, 10); break;
+        case 'u': opt.auth.user = optarg; break;
+        case 'P': opt.auth.pass = optarg; break;
+        case 'o': opt.auth.offer_noauth = 1; break;
+        case 'n': opt.names = atoi(optarg); break;
+        case 'p': pid = atoi(optarg); break;
+        case 'L':
+            if(!strchr(optarg, '=') || n_labels == sizeof labels / sizeof *labels) return usage();
+            labels[n_labels++] = optarg;
+            break;
+        default: return usage();
+        }
+    }
+    if(!have_proxy || !have_target || !conc || !secs || !opt.size ||
+       (opt.auth.user && !opt.auth.pass)) return usage();
+    signal(SIGPIPE, SIG_IGN);
+    bench_raise_nofile();
+
+    pthread_t* pt = calloc(conc, sizeof *pt);
+    if(!pt) return 1;
+    double cpu0 = pid ? bench_proc_cpu(pid) : -1;
+    uint64_t start = bench_now_us();
+    opt.deadline = start + secs * 1000000ULL;
+    for(i = 0; i < conc; i++)
+        if(pthread_create(&pt[i], 0, run, 0)) {
+            perror("pthread_create");
+            return 1;
+        }
+    for(i = 0; i < conc; i++) pthread_join(pt[i], 0);
+    double elapsed = (bench_now_us() - start) / 1e6;
+    double cpu1 = pid ? bench_proc_cpu(pid) : -1;
+
+    printf("{\"mode\": \"%s\", \"conc\": %u, \"size\": %zu", mode_names[opt.mode], conc, opt.size);
+    for(i = 0; i < n_labels; i++) {
+        const char* eq = strchr(labels[i], '=');
+        printf(", \"%.*s\": \"%s\"", (int)(eq - labels[i]), labels[i], eq + 1);
+    }
+    printf(", \"secs\": %.3f, \"bytes\": %llu, \"mb_per_sec\": %.2f, \"tunnels\": %llu, "
+           "\"tunnels_per_sec\": %.1f, \"errors\": %llu",
+           elapsed, (unsigned long long) total_bytes, total_bytes / elapsed / 1e6,
+           (unsigned long long) total_tunnels, total_tunnels / elapsed,
+           (unsigned long long) total_errors);
+    if(cpu0 >= 0 && cpu1 >= 0) {
+        printf(", \"proxy_cpu_sec\": %.3f", cpu1 - cpu0);
+        if(total_bytes >= 1000000)
+            printf(", \"cpu_sec_per_gb\": %.3f", (cpu1 - cpu0) / (total_bytes / 1e9));
+        if(total_tunnels)
+            printf(", \"cpu_us_per_tunnel\": %.1f", (cpu1 - cpu0) * 1e6 / total_tunnels);
+    }
+    print_hist("setup", &setup_hist);
+    if(opt.mode == M_ECHO) print_hist("rtt", &rtt_hist);
+    if(opt.mode == M_RATE) {
+        print_hist("greeting", &greeting_hist);
+        if(opt.auth.user) print_hist("auth", &auth_hist);
+        print_hist("request", &request_hist);
+        print_hist("handshake", &handshake_hist);
+        print_hist("ttfb", &ttfb_hist);
+    }
+    printf("}\n");
+    return total_tunnels ? 0 : 1;
+}
@@ -0,0 +1,765 @@
+/* plays a tunnel shape trace (microsocks -C, see capture.h) back against
+   a local proxy. every recorded tunnel is opened at its recorded time
+   (divided by -s), does the same kind of handshake and then moves the
+   recorded byte counts at the recorded times, in both directions, until
+   its recorded duration is over. the other end is played by this
+   program too: tcp tunnels go to one of -m ports from the -t port on,
+   picked by the destination hash, udp associations send to a udp port
+   of their worker thread (the -t port plus the worker number). the first
+   8 bytes of every tunnel and datagram say which tunnel it is, so the
+   target side knows what to send back.
+   tunnels the proxy refused in the trace are refused again: a refused
+   method by offering only gssapi, failed requests by connecting to the
+   closed -c port. name destinations are sent as the -n name.
+   -w threads share the tunnels, handshakes are done blocking. the times
+   of a tunnel's bytes and its end count from when its handshake is done,
+   so a tunnel that starts late still plays its whole shape, and it only
+   closes once its recorded download arrived (or GRACE_US after its end).
+   one that got less is counted as failed ("short").
+   -i only prints a summary of the trace. */
+
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../capture.h"
+#include "../hist.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define ID_MAGIC 0x52504c59u  /* "RPLY" */
+#define ID_LEN 8
+#define MAX_DATAGRAM 1024
+#define MAX_PORTS 256
+#define BUF_SIZE 65536
+#define GRACE_US 1000000
+#define HANDSHAKE_TIMEOUT_S 5
+/* longest run of timers between two polls, a backlog of starts must not
+   keep the target side from reading */
+#define TIMER_SLICE_US 2000
+
+enum { T_START, T_UP, T_END, T_DOWN, T_EXPIRE };
+enum { R_LISTEN, R_UDPT, R_CLIENT, R_CUDP, R_PEND, R_TARGET };
+
+struct timer {
+    uint64_t due;
+    unsigned idx;
+    int kind;
+};
+
+/* client side of a tunnel, owned by worker idx % workers */
+struct ctun {
+    int fd, udp;
+    int pos, upos;      /* in the owner's pollfd array */
+    unsigned next_up;   /* next event to look at */
+    unsigned hdr_left;  /* id bytes still to write */
+    uint64_t pending;   /* up bytes due but not written */
+    uint64_t base;      /* what the event times count from, 0 until known */
+    uint64_t down_got, down_want;
+    int closing;        /* ends once pending is written and down arrived */
+};
+
+/* target side, served by whichever worker accepted it */
+struct ttun {
+    int fd, pos;
+    unsigned next_down;
+    uint64_t pending;
+    struct sockaddr_storage peer;  /* udp */
+    socklen_t peer_len;
+};
+
+struct ref {
+    int kind;
+    unsigned idx;
+    unsigned got;  /* R_PEND: id bytes read */
+    unsigned char id[ID_LEN];
+};
+
+struct worker {
+    unsigned idx;
+    pthread_t pt;
+    int udp;  /* target side udp socket */
+    struct timer* heap;
+    size_t n_heap, cap_heap;
+    struct pollfd* pfd;
+    struct ref* ref;
+    size_t n, cap;
+    int removed;
+    uint64_t started, ok, failed, short_, refused_expected, up_sent, down_got;
+};
+
+static struct {
+    struct bench_addr proxy, target;
+    struct socks5_auth auth;
+    const char* name;
+    unsigned short closed_port;
+    unsigned ports, workers;
+    double speed;
+} opt;
+
+static struct capture_record* rec;
+static struct ctun* ctun;
+static struct ttun* ttun;
+static size_t n_rec;
+static struct worker* workers;
+static int listeners[MAX_PORTS];
+static uint64_t t0, tunnels_done;
+static int stop;
+static struct hist lag_hist, handshake_hist;
+static char zeros[BUF_SIZE];
+
+static uint64_t at_us(uint64_t ms) {
+    return ms * 1000 / opt.speed;
+}
+
+/* by time, and the end of a tunnel after its last bytes */
+static int before(const struct timer* a, const struct timer* b) {
+    return a->due < b->due || (a->due == b->due && a->kind < b->kind);
+}
+
+static void heap_push(struct worker* w, uint64_t due, int kind, unsigned idx) {
+    struct timer t = { due, idx, kind };
+    if(w->n_heap == w->cap_heap) {
+        size_t cap = w->cap_heap ? w->cap_heap * 2 : 256;
+        struct timer* h = realloc(w->heap, cap * sizeof *h);
+        if(!h) return;
+        w->heap = h;
+        w->cap_heap = cap;
+    }
+    size_t i = w->n_heap++;
+    while(i && before(&t, &w->heap[(i - 1) / 2])) {
+        w->heap[i] = w->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    w->heap[i] = t;
+}
+
+static struct timer heap_pop(struct worker* w) {
+    struct timer top = w->heap[0], last = w->heap[--w->n_heap];
+    size_t i = 0, c;
+    while((c = 2 * i + 1) < w->n_heap) {
+        if(c + 1 < w->n_heap && before(&w->heap[c + 1], &w->heap[c])) c++;
+        if(!before(&w->heap[c], &last)) break;
+        w->heap[i] = w->heap[c];
+        i = c;
+    }
+    if(w->n_heap) w->heap[i] = last;
+    return top;
+}
+
+static int add_fd(struct worker* w, int fd, short events, int kind, unsigned idx) {
+    if(w->n == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 256;
+        struct pollfd* pfd = realloc(w->pfd, cap * sizeof *pfd);
+        if(pfd) w->pfd = pfd;
+        struct ref* ref = realloc(w->ref, cap * sizeof *ref);
+        if(ref) w->ref = ref;
+        if(!pfd || !ref) return -1;
+        w->cap = cap;
+    }
+    w->pfd[w->n] = (struct pollfd) { .fd = fd, .events = events };
+    w->ref[w->n] = (struct ref) { .kind = kind, .idx = idx };
+    return w->n++;
+}
+
+/* closes the fd at pos, the slot is reclaimed after the poll round */
+static void del_fd(struct worker* w, int pos) {
+    close(w->pfd[pos].fd);
+    w->pfd[pos].fd = -1;
+    w->removed = 1;
+}
+
+static void compact(struct worker* w) {
+    size_t i, n = 0;
+    for(i = 0; i < w->n; i++) {
+        if(w->pfd[i].fd == -1) continue;
+        w->pfd[n] = w->pfd[i];
+        w->ref[n] = w->ref[i];
+        switch(w->ref[n].kind) {
+            case R_CLIENT: ctun[w->ref[n].idx].pos = n; break;
+            case R_CUDP: ctun[w->ref[n].idx].upos = n; break;
+            case R_TARGET: ttun[w->ref[n].idx].pos = n; break;
+        }
+        n++;
+    }
+    w->n = n;
+    w->removed = 0;
+}
+
+/* next event of rec[idx] in direction dir from *i on */
+static int next_event(unsigned idx, unsigned* i, int dir) {
+    while(*i < rec[idx].n_events && rec[idx].events[*i].dir != dir) (*i)++;
+    return *i < rec[idx].n_events;
+}
+
+static void put_id(unsigned char* p, unsigned idx) {
+    uint32_t v[2] = { htonl(ID_MAGIC), htonl(idx) };
+    memcpy(p, v, ID_LEN);
+}
+
+static int get_id(const unsigned char* p, unsigned* idx) {
+    uint32_t v[2];
+    memcpy(v, p, ID_LEN);
+    *idx = ntohl(v[1]);
+    return ntohl(v[0]) == ID_MAGIC && *idx < n_rec ? 0 : -1;
+}
+
+/* ok if everything recorded went both ways */
+static void end_tunnel(struct worker* w, unsigned idx) {
+    struct ctun* c = &ctun[idx];
+    if(!c->hdr_left && !c->pending && c->down_got >= c->down_want) {
+        w->ok++;
+    } else {
+        w->failed++;
+        w->short_++;
+    }
+    if(c->fd != -1) del_fd(w, c->pos);
+    if(c->udp != -1) del_fd(w, c->upos);
+    c->fd = c->udp = -1;
+    __atomic_fetch_add(&tunnels_done, 1, __ATOMIC_RELAXED);
+}
+
+static void flush_client(struct worker* w, struct ctun* c) {
+    unsigned char id[ID_LEN];
+    ssize_t n;
+    put_id(id, c - ctun);
+    while(c->hdr_left && (n = write(c->fd, id + ID_LEN - c->hdr_left, c->hdr_left)) > 0) {
+        c->hdr_left -= n;
+        w->up_sent += n;
+    }
+    while(!c->hdr_left && c->pending &&
+          (n = write(c->fd, zeros, c->pending < BUF_SIZE ? c->pending : BUF_SIZE)) > 0) {
+        c->pending -= n;
+        w->up_sent += n;
+    }
+    w->pfd[c->pos].events = POLLIN | (c->hdr_left || c->pending ? POLLOUT : 0);
+    if(c->closing && !c->hdr_left && !c->pending && c->down_got >= c->down_want) end_tunnel(w, c - ctun);
+}
+
+static void flush_target(struct worker* w, struct ttun* t) {
+    ssize_t n;
+    while(t->pending && (n = write(t->fd, zeros, t->pending < BUF_SIZE ? t->pending : BUF_SIZE)) > 0)
+        t->pending -= n;
+    w->pfd[t->pos].events = POLLIN | (t->pending ? POLLOUT : 0);
+}
+
+/* payload size of the datagrams of a udp event */
+static size_t datagram_size(const struct capture_event* e) {
+    size_t size = e->datagrams ? e->bytes / e->datagrams : e->bytes;
+    return size < ID_LEN ? ID_LEN : size > MAX_DATAGRAM ? MAX_DATAGRAM : size;
+}
+
+/* sends the datagrams of e, through the proxy to dst or back to peer.
+   returns the payload bytes */
+static uint64_t send_datagrams(int fd, unsigned idx, const struct capture_event* e, const struct bench_addr* dst,
+                               const struct sockaddr_storage* peer, socklen_t peer_len) {
+    unsigned char buf[4 + 256 + 2 + MAX_DATAGRAM];
+    size_t h = dst ? bench_udp_header(buf, dst) : 0, size = datagram_size(e);
+    uint64_t sent = 0;
+    unsigned i;
+    memset(buf + h, 0, size);
+    put_id(buf + h, idx);
+    for(i = 0; i < (e->datagrams ? e->datagrams : 1); i++) {
+        ssize_t n = peer ? sendto(fd, buf, h + size, 0, (const void*) peer, peer_len) : send(fd, buf, h + size, 0);
+        if(n > 0) sent += size;
+    }
+    return sent;
+}
+
+/* greeting only, for tunnels that ended before their request */
+static int greet(int fd, int method) {
+    unsigned char b[3] = { 5, 1, method };
+    if(bench_write_all(fd, b, 3) || bench_read_full(fd, b, 2)) return -1;
+    return b[1];
+}
+
+static void on_io(struct worker* w, size_t i, short rev);
+
+/* the handshakes below block, so the proxy's connects to the targets must
+   not pile up in the accept queues meanwhile */
+static void accept_all(struct worker* w) {
+    unsigned l;
+    for(l = 0; l < opt.ports; l++) on_io(w, l, POLLIN);
+}
+
+static void start_tunnel(struct worker* w, unsigned idx, uint64_t now) {
+    struct capture_record* r = &rec[idx];
+    struct ctun* c = &ctun[idx];
+    struct socks5_auth none = { 0 };
+    const struct socks5_auth* auth = r->auth == CAPTURE_AUTH_PASSWORD && opt.auth.user ? &opt.auth : &none;
+    int expect_fail = r->auth == CAPTURE_AUTH_REFUSED || (r->reply && r->reply != CAPTURE_NO_REPLY);
+    int ret = -1;
+    struct timeval tv = { .tv_sec = HANDSHAKE_TIMEOUT_S };
+    w->started++;
+    accept_all(w);
+    c->fd = bench_connect(&opt.proxy);
+    if(c->fd == -1) goto failed;
+    setsockopt(c->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    if(r->auth == CAPTURE_AUTH_REFUSED) {
+        ret = greet(c->fd, 1);
+    } else if(r->cmd == CAPTURE_CMD_NONE || r->reply == CAPTURE_NO_REPLY) {
+        ret = greet(c->fd, auth->user ? 2 : 0) == (auth->user ? 2 : 0) ? 0 : -1;
+        expect_fail = 1;  /* nothing to relay */
+    } else if(r->cmd == CAPTURE_CMD_UDP) {
+        struct bench_addr local, relay;
+        bench_parse_addr("127.0.0.1:0", &local);
+        if((c->udp = bench_listen(&local, SOCK_DGRAM, -1)) != -1 && !bench_sockname(c->udp, 0, &local) &&
+           !(ret = socks5_udp_associate(c->fd, auth, &local, &relay)) && bench_connect_fd(c->udp, &relay))
+            ret = -1;
+    } else {
+        const char* host = r->atyp == CAPTURE_ATYP_NAME ? opt.name : opt.target.host;
+        unsigned short port = r->reply ? opt.closed_port : opt.target.port + r->dst % opt.ports;
+        ret = socks5_connect(c->fd, auth, host, port, 0);
+    }
+    uint64_t done = bench_now_us();
+    hist_record(&handshake_hist, done - now);
+    if(expect_fail) {
+        /* greeting only tunnels succeed, refused ones must be refused */
+        if(r->auth != CAPTURE_AUTH_REFUSED && (r->cmd == CAPTURE_CMD_NONE || r->reply == CAPTURE_NO_REPLY)) {
+            if(ret) w->failed++;
+            else w->ok++;
+        } else if(ret) {
+            w->refused_expected++;
+        } else {
+            w->failed++;
+        }
+        if(c->udp != -1) close(c->udp);
+        close(c->fd);
+        c->fd = c->udp = -1;
+        __atomic_fetch_add(&tunnels_done, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if(ret) goto failed;
+    /* the recorded handshake time is already over */
+    uint64_t hs = r->handshake_us / opt.speed;
+    __atomic_store_n(&c->base, done > hs ? done - hs : done, __ATOMIC_RELEASE);
+    bench_nonblock(c->fd);
+    c->pos = add_fd(w, c->fd, POLLIN, R_CLIENT, idx);
+    if(c->udp != -1) {
+        bench_nonblock(c->udp);
+        c->upos = add_fd(w, c->udp, POLLIN, R_CUDP, idx);
+    } else {
+        c->hdr_left = ID_LEN;
+        flush_client(w, c);
+    }
+    if(next_event(idx, &c->next_up, CAPTURE_UP))
+        heap_push(w, c->base + at_us(r->events[c->next_up].at_ms), T_UP, idx);
+    heap_push(w, c->base + at_us(r->duration_ms), T_END, idx);
+    return;
+failed:
+    w->failed++;
+    if(c->udp != -1) close(c->udp);
+    if(c->fd != -1) close(c->fd);
+    c->fd = c->udp = -1;
+    __atomic_fetch_add(&tunnels_done, 1, __ATOMIC_RELAXED);
+}
+
+static void run_timer(struct worker* w, struct timer t, uint64_t now) {
+    struct capture_record* r = &rec[t.idx];
+    uint64_t base = __atomic_load_n(&ctun[t.idx].base, __ATOMIC_ACQUIRE);
+    switch(t.kind) {
+    case T_START:
+        hist_record(&lag_hist, now - t.due);
+        start_tunnel(w, t.idx, now);
+        break;
+    case T_UP: {
+        struct ctun* c = &ctun[t.idx];
+        if(c->fd == -1) break;
+        if(c->udp != -1) {
+            struct bench_addr dst = opt.target;
+            dst.port += w->idx;
+            w->up_sent += send_datagrams(c->udp, t.idx, &r->events[c->next_up], &dst, 0, 0);
+        } else {
+            c->pending += r->events[c->next_up].bytes;
+            flush_client(w, c);
+        }
+        c->next_up++;
+        if(next_event(t.idx, &c->next_up, CAPTURE_UP))
+            heap_push(w, base + at_us(r->events[c->next_up].at_ms), T_UP, t.idx);
+        break;
+    }
+    case T_END: {
+        struct ctun* c = &ctun[t.idx];
+        if(c->fd == -1) break;
+        c->closing = 1;
+        heap_push(w, now + GRACE_US, T_EXPIRE, t.idx);
+        if(c->udp != -1) {
+            if(c->down_got >= c->down_want) end_tunnel(w, t.idx);
+        } else {
+            flush_client(w, c);
+        }
+        break;
+    }
+    case T_EXPIRE:
+        /* what didn't arrive by now makes it short */
+        if(ctun[t.idx].fd != -1) end_tunnel(w, t.idx);
+        break;
+    case T_DOWN: {
+        struct ttun* tt = &ttun[t.idx];
+        if(tt->fd == -1) break;
+        if(r->cmd == CAPTURE_CMD_UDP)
+            send_datagrams(tt->fd, t.idx, &r->events[tt->next_down], 0, &tt->peer, tt->peer_len);
+        else {
+            tt->pending += r->events[tt->next_down].bytes;
+            flush_target(w, tt);
+        }
+        tt->next_down++;
+        if(next_event(t.idx, &tt->next_down, CAPTURE_DOWN))
+            heap_push(w, base + at_us(r->events[tt->next_down].at_ms), T_DOWN, t.idx);
+        break;
+    }
+    }
+}
+
+/* the target side learnt which tunnel it serves. the client set the
+   tunnel's base before it sent the id */
+static void identified(struct worker* w, unsigned idx) {
+    struct ttun* tt = &ttun[idx];
+    struct capture_record* r = &rec[idx];
+    uint64_t base = __atomic_load_n(&ctun[idx].base, __ATOMIC_ACQUIRE);
+    if(next_event(idx, &tt->next_down, CAPTURE_DOWN))
+        heap_push(w, base + at_us(r->events[tt->next_down].at_ms), T_DOWN, idx);
+}
+
+static void on_io(struct worker* w, size_t i, short rev) {
+    static __thread unsigned char buf[BUF_SIZE];
+    struct ref* ref = &w->ref[i];
+    ssize_t n;
+    unsigned idx;
+    int fd = w->pfd[i].fd;
+    switch(ref->kind) {
+    case R_LISTEN:
+        while((n = accept(fd, 0, 0)) != -1) {
+            bench_nonblock(n);
+            add_fd(w, n, POLLIN, R_PEND, 0);
+        }
+        break;
+    case R_UDPT:
+        for(;;) {
+            struct sockaddr_storage peer;
+            socklen_t len = sizeof peer;
+            if((n = recvfrom(fd, buf, sizeof buf, 0, (void*) &peer, &len)) < 0) break;
+            if(n < ID_LEN || get_id(buf, &idx)) continue;
+            struct ttun* tt = &ttun[idx];
+            tt->peer = peer;
+            tt->peer_len = len;
+            if(tt->fd == -1) {
+                tt->fd = fd;
+                identified(w, idx);
+            }
+        }
+        break;
+    case R_PEND:
+        n = read(fd, ref->id + ref->got, ID_LEN - ref->got);
+        if(n <= 0) {
+            if(n == 0 || (errno != EAGAIN && errno != EINTR)) del_fd(w, i);
+            break;
+        }
+        if((ref->got += n) < ID_LEN) break;
+        if(get_id(ref->id, &idx) || ttun[idx].fd != -1) {
+            del_fd(w, i);
+            break;
+        }
+        ref->kind = R_TARGET;
+        ref->idx = idx;
+        ttun[idx].fd = fd;
+        ttun[idx].pos = i;
+        identified(w, idx);
+        break;
+    case R_TARGET: {
+        struct ttun* tt = &ttun[ref->idx];
+        if(rev & POLLOUT) flush_target(w, tt);
+        if(!(rev & (POLLIN | POLLHUP | POLLERR))) break;
+        while((n = read(fd, buf, sizeof buf)) > 0);
+        if(n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            del_fd(w, i);
+            tt->fd = -1;
+        }
+        break;
+    }
+    case R_CLIENT: {
+        struct ctun* c = &ctun[ref->idx];
+        if(rev & POLLOUT) flush_client(w, c);
+        if(c->fd == -1 || !(rev & (POLLIN | POLLHUP | POLLERR))) break;
+        while((n = read(fd, buf, sizeof buf)) > 0) {
+            w->down_got += n;
+            c->down_got += n;
+        }
+        /* the proxy closed the tunnel early */
+        if(n == 0 || (errno != EAGAIN && errno != EINTR)) end_tunnel(w, ref->idx);
+        else if(c->closing) flush_client(w, c);
+        break;
+    }
+    case R_CUDP: {
+        struct ctun* c = &ctun[ref->idx];
+        while((n = recv(fd, buf, sizeof buf, 0)) > 0) {
+            ssize_t h = bench_udp_skip_header(buf, n);
+            if(h < 0) continue;
+            w->down_got += n - h;
+            c->down_got += n - h;
+        }
+        if(c->closing && c->down_got >= c->down_want) end_tunnel(w, ref->idx);
+        break;
+    }
+    }
+}
+
+static void* worker_main(void* arg) {
+    struct worker* w = arg;
+    size_t i;
+    while(!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        uint64_t now = bench_now_us(), until = now + TIMER_SLICE_US;
+        while(w->n_heap && w->heap[0].due <= now && now < until) {
+            run_timer(w, heap_pop(w), now);
+            now = bench_now_us();
+        }
+        int timeout = 100;
+        if(w->n_heap && w->heap[0].due <= now)
+            timeout = 0;
+        else if(w->n_heap && (w->heap[0].due - now) / 1000 < (uint64_t) timeout)
+            timeout = (w->heap[0].due - now + 999) / 1000;
+        if(w->removed) compact(w);
+        size_t n = w->n;
+        if(poll(w->pfd, n, timeout) <= 0) continue;
+        for(i = 0; i < n; i++)
+            if(w->pfd[i].fd != -1 && w->pfd[i].revents) on_io(w, i, w->pfd[i].revents);
+    }
+    return 0;
+}
+
+static int load(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if(!f) return -1;
+    size_t cap = 1 << 20, len = 0, n;
+    unsigned char* buf = malloc(cap);
+    while(buf && (n = fread(buf + len, 1, cap - len, f)) > 0)
+        if((len += n) == cap) buf = realloc(buf, cap *= 2);
+    fclose(f);
+    if(!buf || len < sizeof CAPTURE_MAGIC - 1 || memcmp(buf, CAPTURE_MAGIC, sizeof CAPTURE_MAGIC - 1)) {
+        dprintf(2, "%s: not a capture file\n", path);
+        return -1;
+    }
+    size_t off = sizeof CAPTURE_MAGIC - 1, cap_rec = 0;
+    ssize_t r;
+    for(;;) {
+        if(n_rec == cap_rec) {
+            cap_rec = cap_rec ? cap_rec * 2 : 1024;
+            if(!(rec = realloc(rec, cap_rec * sizeof *rec))) return -1;
+        }
+        if((r = capture_decode(buf + off, len - off, &rec[n_rec])) <= 0) break;
+        off += r;
+        n_rec++;
+    }
+    /* a process that was killed may leave a partial record behind */
+    if(r < 0) dprintf(2, "%s: malformed record at offset %zu\n", path, off);
+    free(buf);
+    return 0;
+}
+
+static int by_start(const void* a, const void* b) {
+    const struct capture_record *x = a, *y = b;
+    return x->start_ms < y->start_ms ? -1 : x->start_ms > y->start_ms;
+}
+
+static void print_quantiles(const char* key, struct hist_snapshot* s) {
+    printf(", \"%s\": {\"count\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}", key,
+           (unsigned long long) s->count,
+           (unsigned long long) hist_quantile(s, .5), (unsigned long long) hist_quantile(s, .9),
+           (unsigned long long) hist_quantile(s, .99), (unsigned long long) hist_quantile(s, 1));
+}
+
+static int info(void) {
+    static struct hist duration_hist, bytes_hist;
+    uint64_t count[3] = { 0 }, refused = 0, failed = 0, bytes[2] = { 0 }, events = 0, flows = 0;
+    size_t i, j;
+    for(i = 0; i < n_rec; i++) {
+        struct capture_record* r = &rec[i];
+        uint64_t b = 0;
+        count[r->cmd]++;
+        refused += r->auth == CAPTURE_AUTH_REFUSED;
+        failed += r->reply && r->reply != CAPTURE_NO_REPLY;
+        flows += r->flows;
+        events += r->n_events;
+        for(j = 0; j < r->n_events; j++) {
+            bytes[r->events[j].dir] += r->events[j].bytes;
+            b += r->events[j].bytes;
+        }
+        hist_record(&duration_hist, r->duration_ms);
+        hist_record(&bytes_hist, b);
+    }
+    struct hist_snapshot s;
+    printf("{\"records\": %zu, \"connect\": %llu, \"udp\": %llu, \"no_request\": %llu, \"auth_refused\": %llu, "
+           "\"request_failed\": %llu, \"udp_flows\": %llu, \"events\": %llu, \"bytes_up\": %llu, \"bytes_down\": %llu, "
+           "\"span_secs\": %.3f", n_rec, (unsigned long long) count[CAPTURE_CMD_CONNECT],
+           (unsigned long long) count[CAPTURE_CMD_UDP], (unsigned long long) count[CAPTURE_CMD_NONE],
+           (unsigned long long) refused, (unsigned long long) failed, (unsigned long long) flows,
+           (unsigned long long) events, (unsigned long long) bytes[CAPTURE_UP], (unsigned long long) bytes[CAPTURE_DOWN],
+           n_rec ? (rec[n_rec - 1].start_ms - rec[0].start_ms) / 1e3 : 0);
+    hist_merge(&duration_hist, &s);
+    print_quantiles("duration_ms", &s);
+    hist_merge(&bytes_hist, &s);
+    print_quantiles("bytes_per_tunnel", &s);
+    printf("}\n");
+    return 0;
+}
+
+static int usage(void) {
+    dprintf(2, "usage: replay [-i] -x proxy -t target [-m ports] [-c closedport] [-n name] [-s speed]\n"
+               "              [-d secs] [-w threads] [-u user -P pass] [-p proxypid] [-L key=value]... trace\n");
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    unsigned secs = 0, i, n_labels = 0;
+    const char* labels[16];
+    pid_t pid = 0;
+    int ch, have_proxy = 0, have_target = 0, only_info = 0;
+    opt.ports = 16;
+    opt.workers = 1;
+    opt.speed = 1;
+    opt.name = "127.0.0.1";
+    opt.closed_port = 1;
+    while((ch = getopt(argc, argv, "ix:t:m:c:n:s:d:w:u:P:p:L:")) != -1) {
+        switch(ch) {
+        case 'i': only_info = 1; break;
+        case 'x': have_proxy = !bench_parse_addr(optarg, &opt.proxy); break;
+        case 't': have_target = !bench_parse_addr(optarg, &opt.target); break;
+        case 'm': opt.ports = atoi(optarg); break;
+        case 'c': opt.closed_port = atoi(optarg); break;
+        case 'n': opt.name = optarg; break;
+        case 's': opt.speed = atof(optarg); break;
+        case 'd': secs = atoi(optarg); break;
+        case 'w': opt.workers = atoi(optarg); break;
+        case 'u': opt.auth.user = optarg; break;
+        case 'P': opt.auth.pass = optarg; break;
+        case 'p': pid = atoi(optarg); break;
+        case 'L':
+            if(!strchr(optarg, '=') || n_labels == sizeof labels / sizeof *labels) return usage();
+            labels[n_labels++] = optarg;
+            break;
+        default: return usage();
+        }
+    }
+    if(optind != argc - 1 || load(argv[optind])) return usage();
+    qsort(rec, n_rec, sizeof *rec, by_start);
+    if(only_info) return info();
+    if(!have_proxy || !have_target || !opt.ports || opt.ports > MAX_PORTS || !opt.workers ||
+       opt.speed <= 0 || opt.target.port + (opt.ports > opt.workers ? opt.ports : opt.workers) > 65536 ||
+       (opt.auth.user && !opt.auth.pass)) return usage();
+    /* -d cuts the trace at that many seconds of replay time */
+    if(secs)
+        while(n_rec && at_us(rec[n_rec - 1].start_ms - rec[0].start_ms) >= secs * 1000000ULL) n_rec--;
+    if(!n_rec) {
+        dprintf(2, "replay: no tunnels to play\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    bench_raise_nofile();
+    ctun = calloc(n_rec, sizeof *ctun);
+    ttun = calloc(n_rec, sizeof *ttun);
+    workers = calloc(opt.workers, sizeof *workers);
+    if(!ctun || !ttun || !workers) return 1;
+    for(i = 0; i < n_rec; i++) {
+        ctun[i].fd = ctun[i].udp = ttun[i].fd = -1;
+        /* times count from the first tunnel */
+        rec[i].start_ms -= rec[0].start_ms;
+    }
+    rec[0].start_ms = 0;
+
+    struct bench_addr a = opt.target;
+    for(i = 0; i < opt.ports; i++, a.port++)
+        if((listeners[i] = bench_listen(&a, SOCK_STREAM, 4096)) == -1) {
+            perror("listen");
+            return 1;
+        } else bench_nonblock(listeners[i]);
+    a = opt.target;
+    for(i = 0; i < opt.workers; i++, a.port++) {
+        struct worker* w = &workers[i];
+        unsigned l;
+        w->idx = i;
+        if((w->udp = bench_listen(&a, SOCK_DGRAM, -1)) == -1) {
+            perror("listen udp");
+            return 1;
+        }
+        bench_nonblock(w->udp);
+        for(l = 0; l < opt.ports; l++) add_fd(w, listeners[l], POLLIN, R_LISTEN, l);
+        add_fd(w, w->udp, POLLIN, R_UDPT, 0);
+    }
+    t0 = bench_now_us() + 100000;
+    for(i = 0; i < n_rec; i++) heap_push(&workers[i % opt.workers], t0 + at_us(rec[i].start_ms), T_START, i);
+
+    uint64_t up_expected = 0, down_expected = 0;
+    for(i = 0; i < n_rec; i++) {
+        size_t j;
+        for(j = 0; j < rec[i].n_events; j++) {
+            const struct capture_event* e = &rec[i].events[j];
+            uint64_t b = e->bytes;
+            /* what the replay sends for it */
+            if(rec[i].cmd == CAPTURE_CMD_UDP) b = datagram_size(e) * (e->datagrams ? e->datagrams : 1);
+            if(e->dir == CAPTURE_UP) {
+                up_expected += b;
+            } else {
+                down_expected += b;
+                ctun[i].down_want += b;
+            }
+        }
+        if(rec[i].cmd == CAPTURE_CMD_CONNECT && !rec[i].reply) up_expected += ID_LEN;
+    }
+
+    double cpu0 = pid ? bench_proc_cpu(pid) : -1;
+    for(i = 0; i < opt.workers; i++)
+        if(pthread_create(&workers[i].pt, 0, worker_main, &workers[i])) {
+            perror("pthread_create");
+            return 1;
+        }
+    uint64_t last_done = 0, quiet_since = 0;
+    for(;;) {
+        bench_sleep_us(100000);
+        uint64_t done = __atomic_load_n(&tunnels_done, __ATOMIC_RELAXED), now = bench_now_us();
+        if(done != last_done) quiet_since = now;
+        last_done = done;
+        /* the last bytes may still be on their way after the tunnels ended */
+        if(done >= n_rec && now - quiet_since >= GRACE_US) break;
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    uint64_t started = 0, ok = 0, failed = 0, short_ = 0, refused = 0, up = 0, down = 0;
+    for(i = 0; i < opt.workers; i++) {
+        pthread_join(workers[i].pt, 0);
+        started += workers[i].started;
+        ok += workers[i].ok;
+        failed += workers[i].failed;
+        short_ += workers[i].short_;
+        refused += workers[i].refused_expected;
+        up += workers[i].up_sent;
+        down += workers[i].down_got;
+    }
+    double elapsed = (bench_now_us() - t0) / 1e6, cpu1 = pid ? bench_proc_cpu(pid) : -1;
+
+    printf("{\"mode\": \"replay\", \"speed\": %g", opt.speed);
+    for(i = 0; i < n_labels; i++) {
+        const char* eq = strchr(labels[i], '=');
+        printf(", \"%.*s\": \"%s\"", (int)(eq - labels[i]), labels[i], eq + 1);
+    }
+    printf(", \"tunnels\": %zu, \"started\": %llu, \"ok\": %llu, \"refused_as_recorded\": %llu, \"failed\": %llu"
+           ", \"short\": %llu, \"secs\": %.3f, \"bytes_up\": %llu, \"bytes_up_expected\": %llu, \"bytes_down\": %llu"
+           ", \"bytes_down_expected\": %llu", n_rec, (unsigned long long) started, (unsigned long long) ok,
+           (unsigned long long) refused, (unsigned long long) failed, (unsigned long long) short_, elapsed, (unsigned long long) up,
+           (unsigned long long) up_expected, (unsigned long long) down, (unsigned long long) down_expected);
+    if(cpu0 >= 0 && cpu1 >= 0) printf(", \"proxy_cpu_sec\": %.3f", cpu1 - cpu0);
+    struct hist_snapshot s;
+    hist_merge(&lag_hist, &s);
+    print_quantiles("start_lag_us", &s);
+    hist_merge(&handshake_hist, &s);
+    print_quantiles("handshake_us", &s);
+    printf("}\n");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# trace replay, run by `make bench-replay TRACE=file`.
+# plays a tunnel shape trace recorded with microsocks -C back through a
+# fresh proxy; bench/replay is also the target of the tunnels.
+#
+#   TRACE     trace file, required
+#   PROXY     proxy binary (./microsocks)
+#   SPEED     time compression, 2 plays the trace twice as fast (1)
+#   THREADS   replay threads (number of cpus)
+#   PORT      proxy port (21080), the targets use 16 ports after 23000
+#   OUT       result file (bench/replay.json)
+
+cd "$(dirname "$0")/.." || exit 1
+[ -n "$TRACE" ] || { echo "TRACE is not set" >&2; exit 1; }
+PROXY=${PROXY:-./microsocks}
+SPEED=${SPEED:-1}
+PORT=${PORT:-21080}
+OUT=${OUT:-bench/replay.json}
+
+. bench/lib.sh
+THREADS=${THREADS:-$ncpu}
+
+./bench/replay -i "$TRACE" >&2 || exit 1
+# only for wait_proxy, the replay serves its own tunnels
+spawn ./bench/target -l 127.0.0.1:$echo_port=echo
+start_proxy all
+wait_proxy
+tmp=$OUT.tmp
+: > "$tmp"
+./bench/replay -x 127.0.0.1:$proxy_port -t 127.0.0.1:23000 -w "$THREADS" -s "$SPEED" \
+	-p "$proxy_pid" -L trace="$(basename "$TRACE")" "$TRACE" >> "$tmp" ||
+	echo "replay failed" >&2
+stop_proxy
+
+write_results "$OUT"
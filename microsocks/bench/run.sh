@@ -0,0 +1,58 @@
+#!/bin/sh
+# throughput and tunnel rate benchmark, run by `make bench`.
+# starts a target and the proxy, runs loadgen for every mode, concurrency
+# level and core count and writes all results into one json document.
+#
+#   PROXY     proxy binary (./microsocks)
+#   MODES     loadgen modes ("up down echo rate")
+#   CONC      concurrency levels ("1 8 64")
+#   CORES     core counts the proxy is pinned to with taskset, "all" to not
+#             pin; defaults to "1 <ncpu>" where taskset exists
+#   DURATION  seconds per run (5)
+#   SIZE      chunk size for the bulk modes (65536)
+#   PORT      first of four local ports to use (21080)
+#   OUT       result file (bench/results.json)
+
+cd "$(dirname "$0")/.." || exit 1
+PROXY=${PROXY:-./microsocks}
+MODES=${MODES:-up down echo rate}
+CONC=${CONC:-1 8 64}
+DURATION=${DURATION:-5}
+SIZE=${SIZE:-65536}
+PORT=${PORT:-21080}
+OUT=${OUT:-bench/results.json}
+
+. bench/lib.sh
+if [ -z "$CORES" ]; then
+	if command -v taskset >/dev/null 2>&1 && [ "$ncpu" -gt 1 ]; then
+		CORES="1 $ncpu"
+	else
+		CORES=all
+	fi
+fi
+
+
+start_target
+tmp=$OUT.tmp
+: > "$tmp"
+for cores in $CORES; do
+	start_proxy "$cores"
+	wait_proxy
+	for mode in $MODES; do
+		case $mode in
+			up) port=$sink_port ;;
+			down) port=$source_port ;;
+			*) port=$echo_port ;;
+		esac
+		for conc in $CONC; do
+			echo "cores=$cores mode=$mode conc=$conc" >&2
+			./bench/loadgen -x 127.0.0.1:$proxy_port -t 127.0.0.1:$port \
+				-m "$mode" -c "$conc" -d "$DURATION" -s "$SIZE" \
+				-p "$proxy_pid" -L cores="$cores" >> "$tmp" ||
+				echo "loadgen failed" >&2
+		done
+	done
+	stop_proxy
+done
+
+write_results "$OUT"
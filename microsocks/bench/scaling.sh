@@ -0,0 +1,148 @@
+#!/bin/sh
+# core scaling benchmark, run by `make bench-scaling`.
+# gives the proxy 1..N cores and measures tunnels per second (loadgen -m
+# rate) and relay throughput (loadgen -m down) at each step, for every
+# accept model in ACCEPT and pinning in PIN:
+#
+#   shared   one process, its accept thread hands every connection to a
+#            new thread
+#   sharded  -F <cores> worker processes, each accepting on its own
+#            SO_REUSEPORT listener
+#   cores    the proxy may use cores 0..n-1 as a group (taskset)
+#   worker   sharded only: worker i runs on core i
+#   none     no affinity; shared then ignores the core count, so it only
+#            runs once
+#
+# afterwards every series gets its speedup over its first step and the
+# scaling efficiency, speedup / cores: 1 is linear, a flat tunnels/s line
+# (efficiency falling as 1/n) means something serialises. loadgen and the
+# target run on the cores the proxy doesn't get.
+#
+#   PROXY     proxy binary (./microsocks)
+#   CORES     core counts ("1 2 4 ... up to half the cpus")
+#   ACCEPT    accept models ("shared sharded")
+#   PIN       pinnings ("cores worker" with taskset, otherwise "none")
+#   MODES     loadgen modes ("rate down")
+#   CONC      loadgen concurrency (64)
+#   DURATION  seconds per run (5)
+#   PORT      first of four local ports to use (21080)
+#   OUT       result file (bench/scaling.json)
+
+cd "$(dirname "$0")/.." || exit 1
+PROXY=${PROXY:-./microsocks}
+MODES=${MODES:-rate down}
+CONC=${CONC:-64}
+DURATION=${DURATION:-5}
+PORT=${PORT:-21080}
+OUT=${OUT:-bench/scaling.json}
+
+. bench/lib.sh
+ACCEPT=${ACCEPT:-shared sharded}
+have_taskset=
+command -v taskset >/dev/null 2>&1 && have_taskset=1
+if [ -z "$PIN" ]; then
+	if [ -n "$have_taskset" ]; then PIN="cores worker"; else PIN=none; fi
+fi
+# the proxy gets the lower half of the cpus, the load the upper half
+max=$((ncpu / 2))
+[ $max -lt 1 ] && max=1
+if [ -z "$CORES" ]; then
+	CORES=1
+	c=2
+	while [ $c -lt $max ]; do
+		CORES="$CORES $c"
+		c=$((c * 2))
+	done
+	[ $max -gt 1 ] && CORES="$CORES $max"
+fi
+load=
+if [ -n "$have_taskset" ] && [ "$ncpu" -gt 1 ]; then
+	load="taskset -c $max-$((ncpu - 1))"
+else
+	echo "proxy and load share the cpus, the curves will be flat" >&2
+fi
+
+# pins worker i of the -F group to core i, all threads of it
+pin_workers() {
+	i=0
+	while [ "$(pgrep -P "$proxy_pid" | wc -l)" -lt "$1" ] && [ $i -lt 50 ]; do
+		sleep 0.1
+		i=$((i + 1))
+	done
+	core=0
+	for pid in $(pgrep -P "$proxy_pid"); do
+		taskset -a -p -c $((core % ncpu)) "$pid" >/dev/null
+		core=$((core + 1))
+	done
+}
+
+lworkers=$((ncpu - max))
+[ $lworkers -lt 1 ] && lworkers=1
+spawn $load ./bench/target -w "$lworkers" -l 127.0.0.1:$sink_port=sink \
+	-l 127.0.0.1:$source_port=source -l 127.0.0.1:$echo_port=echo
+tmp=$OUT.tmp
+: > "$tmp"
+for accept in $ACCEPT; do
+	for pin in $PIN; do
+		[ "$accept" = shared ] && [ "$pin" = worker ] && continue
+		for n in $CORES; do
+			opts=
+			[ "$accept" = sharded ] && opts="-F $n"
+			used=$n
+			[ "$accept" = shared ] && [ "$pin" = none ] && used=$ncpu
+			if [ "$pin" = cores ]; then
+				start_proxy "$n" $opts
+			else
+				start_proxy all $opts
+			fi
+			wait_proxy
+			[ "$pin" = worker ] && pin_workers "$n"
+			for mode in $MODES; do
+				case $mode in
+					up) port=$sink_port ;;
+					down) port=$source_port ;;
+					*) port=$echo_port ;;
+				esac
+				echo "accept=$accept pin=$pin cores=$used mode=$mode" >&2
+				$load ./bench/loadgen -x 127.0.0.1:$proxy_port -t 127.0.0.1:$port \
+					-m "$mode" -c "$CONC" -d "$DURATION" -p "$proxy_pid" \
+					-L accept="$accept" -L pin="$pin" -L cores="$used" >> "$tmp" ||
+					echo "loadgen failed" >&2
+			done
+			stop_proxy
+			# without affinity one process gets all cpus anyway
+			[ "$accept" = shared ] && [ "$pin" = none ] && break
+		done
+	done
+done
+
+# one scaling line per run: speedup and efficiency against the first
+# step of the same series, tunnels/s for rate, MB/s otherwise
+awk '
+function field(line, key,    r) {
+	if(!match(line, "\"" key "\": \"?[^,\"}]*")) return ""
+	r = substr(line, RSTART, RLENGTH)
+	sub(/^"[^"]*": "?/, "", r)
+	return r
+}
+{
+	mode = field($0, "mode")
+	metric = mode == "rate" ? "tunnels_per_sec" : "mb_per_sec"
+	v = field($0, metric) + 0
+	cores = field($0, "cores") + 0
+	series = field($0, "accept") "/" field($0, "pin") "/" mode
+	if(!(series in base_v)) {
+		base_v[series] = v
+		base_c[series] = cores
+	}
+	speedup = base_v[series] ? v / base_v[series] : 0
+	eff = speedup / (cores / base_c[series])
+	printf "{\"mode\": \"scaling\", \"bench\": \"%s\", \"accept\": \"%s\", \"pin\": \"%s\", \"cores\": %d, \"%s\": %s, \"speedup\": %.3f, \"efficiency\": %.3f}\n", \
+		mode, field($0, "accept"), field($0, "pin"), cores, metric, v, speedup, eff
+	printf "%-22s cores %3d  %-16s %10.1f  speedup %5.2f  efficiency %4.2f\n", \
+		series, cores, metric, v, speedup, eff > "/dev/stderr"
+}' "$tmp" > "$tmp.eff"
+cat "$tmp.eff" >> "$tmp"
+rm -f "$tmp.eff"
+
+META="\"proxy_cores\": \"$CORES\", \"load\": \"${load:-shared}\"" write_results "$OUT"
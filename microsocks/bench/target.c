@@ -0,0 +1,417 @@
+/* the other end of the benchmark tunnels.
+   every listener has a mode: echo sends everything back, sink reads and
+   drops, source writes as fast as the reader takes it, udpecho returns
+   datagrams to their sender. a listener can cover a range of ports.
+   -w worker threads run a poll() loop each; they share the (non-blocking)
+   tcp listening sockets, udp sockets are dealt out among them.
+
+   backends can misbehave on purpose: refuse ports are bound but don't
+   listen, so connects are refused; blackhole ports have a full accept
+   queue, so further SYNs are dropped and connects time out. the other
+   modes take faults after a comma: accept=ms takes one connection every
+   ms (the others wait in the backlog), delay=ms holds every echo reply
+   and the first source bytes that long, rbps= and wbps= cap reading and
+   writing per connection in bytes per second (bps= both), reset=n sends
+   an RST once n bytes went either way. with ctl, a connection can pick its
+   own faults in a first line "fault delay=50 reset=1000\n", which is not
+   echoed; a source then waits for the first bytes. */
+
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MAX_LISTENERS 4096
+#define BUF_SIZE 65536
+#define UDP_BATCH 64
+
+#define CTL_MAX 256
+#define BLACKHOLE_FILL 16
+
+enum mode { M_ECHO, M_SINK, M_SOURCE, M_UDPECHO, M_REFUSE, M_BLACKHOLE };
+static const char* mode_names[] = { "echo", "sink", "source", "udpecho", "refuse", "blackhole" };
+
+struct faults {
+    unsigned accept_ms, delay_ms;
+    unsigned long rbps, wbps;
+    unsigned long long reset;
+    int ctl;
+};
+
+struct listener {
+    int fd;
+    enum mode mode;
+    struct faults f;
+    unsigned worker;  /* the one serving a udp socket or a slow accept */
+    uint64_t next_accept;
+};
+
+struct conn {
+    int fd;
+    enum mode mode;
+    struct faults f;
+    int ctl;          /* still looking for the fault line */
+    uint64_t wake;    /* not served before this */
+    unsigned long long bytes;
+    size_t off, len;  /* echo data read but not written back yet */
+    char* buf;
+};
+
+static struct listener listeners[MAX_LISTENERS];
+static unsigned n_listeners, n_workers;
+static char source_buf[BUF_SIZE];
+
+/* pfd[0..n_listeners) are the listeners (with fd -1 for udp sockets of
+   other workers, which poll skips), pfd[n_listeners + i] is conns[i] */
+struct worker {
+    unsigned idx;
+    pthread_t pt;
+    struct pollfd* pfd;
+    struct conn* conns;
+    size_t n, cap;
+};
+
+static void add_conn(struct worker* w, int fd, const struct listener* l) {
+    if(w->n == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 64;
+        struct pollfd* pfd = realloc(w->pfd, (n_listeners + cap) * sizeof *pfd);
+        if(pfd) w->pfd = pfd;
+        struct conn* conns = realloc(w->conns, cap * sizeof *conns);
+        if(conns) w->conns = conns;
+        if(!pfd || !conns) {
+            close(fd);
+            return;
+        }
+        w->cap = cap;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    bench_nonblock(fd);
+    w->conns[w->n] = (struct conn) { .fd = fd, .mode = l->mode, .f = l->f, .ctl = l->f.ctl };
+    if(l->mode == M_SOURCE && l->f.delay_ms) w->conns[w->n].wake = bench_now_us() + l->f.delay_ms * 1000ULL;
+    w->n++;
+}
+
+static void del_conn(struct worker* w, size_t i) {
+    if(w->conns[i].f.reset && w->conns[i].bytes >= w->conns[i].f.reset) {
+        /* closing with a zero linger sends an RST */
+        struct linger lg = { 1, 0 };
+        setsockopt(w->conns[i].fd, SOL_SOCKET, SO_LINGER, &lg, sizeof lg);
+    }
+    close(w->conns[i].fd);
+    free(w->conns[i].buf);
+    w->conns[i] = w->conns[--w->n];
+}
+
+/* key=value pairs split by commas or spaces, as in the -l spec and the
+   fault line */
+static int parse_faults(const char* s, struct faults* f) {
+    while(*s) {
+        size_t l = strcspn(s, ", ");
+        char* end;
+        unsigned long long v = 0;
+        const char* eq = memchr(s, '=', l);
+        if(eq) {
+            v = strtoull(eq + 1, &end, 10);
+            if(end != s + l) return -1;
+        }
+        size_t k = eq ? (size_t)(eq - s) : l;
+#define KEY(name) (k == sizeof name - 1 && !memcmp(s, name, k))
+        if(KEY("ctl") && !eq) f->ctl = 1;
+        else if(KEY("accept") && eq) f->accept_ms = v;
+        else if(KEY("delay") && eq) f->delay_ms = v;
+        else if(KEY("rbps") && eq) f->rbps = v;
+        else if(KEY("wbps") && eq) f->wbps = v;
+        else if(KEY("bps") && eq) f->rbps = f->wbps = v;
+        else if(KEY("reset") && eq) f->reset = v;
+        else if(l) return -1;
+#undef KEY
+        s += l;
+        s += strspn(s, ", ");
+    }
+    return 0;
+}
+
+/* takes a leading "fault ...\n" off the stream. returns 1 while it may
+   still be incomplete */
+static int read_ctl(struct conn* c) {
+    static const char tag[] = "fault ";
+    char line[CTL_MAX + 1];
+    ssize_t n = recv(c->fd, line, CTL_MAX, MSG_PEEK);
+    if(n <= 0) return n < 0 && (errno == EAGAIN || errno == EINTR) ? 1 : 0;
+    size_t t = (size_t) n < sizeof tag - 1 ? (size_t) n : sizeof tag - 1;
+    c->ctl = 0;
+    if(memcmp(line, tag, t)) return 0;
+    char* nl = memchr(line, '\n', n);
+    if(!nl) {
+        /* a line that long is not a fault line */
+        if(n < CTL_MAX) c->ctl = 1;
+        return c->ctl;
+    }
+    ssize_t l = nl - line + 1;
+    if(read(c->fd, line, l) != l) return 0;
+    *nl = 0;
+    if(nl > line && nl[-1] == '\r') nl[-1] = 0;
+    if(parse_faults(line + sizeof tag - 1, &c->f)) dprintf(2, "target: bad fault line\n");
+    if(c->mode == M_SOURCE && c->f.delay_ms) c->wake = bench_now_us() + c->f.delay_ms * 1000ULL;
+    return 0;
+}
+
+/* bytes to move in one go under a rate limit, about 10ms worth */
+static size_t chunk(unsigned long bps, size_t max) {
+    if(!bps) return max;
+    size_t n = bps / 100;
+    return n < 1 ? 1 : n > max ? max : n;
+}
+
+/* after n bytes at bps, the connection rests until they are due */
+static void pace(struct conn* c, unsigned long bps, size_t n) {
+    c->bytes += n;
+    if(bps) c->wake = bench_now_us() + n * 1000000ULL / bps;
+}
+
+static short want(const struct conn* c) {
+    switch(c->mode) {
+        case M_SOURCE: return POLLOUT;
+        case M_ECHO: return c->len ? POLLOUT : POLLIN;
+        default: return POLLIN;
+    }
+}
+
+/* returns -1 when the connection is done */
+static int serve(struct conn* c, short rev) {
+    static __thread char scratch[BUF_SIZE];
+    ssize_t n;
+    if(rev & (POLLERR | POLLNVAL)) return -1;
+    if(c->ctl && (rev & POLLIN) && read_ctl(c)) return 0;
+    if(c->wake > bench_now_us()) return 0;
+    switch(c->mode) {
+    case M_SINK:
+        n = read(c->fd, scratch, chunk(c->f.rbps, sizeof scratch));
+        if(n > 0) pace(c, c->f.rbps, n);
+        break;
+    case M_SOURCE:
+        if(rev & POLLHUP) return -1;
+        n = write(c->fd, source_buf, chunk(c->f.wbps, sizeof source_buf));
+        if(n > 0) pace(c, c->f.wbps, n);
+        break;
+    case M_ECHO:
+        if(!c->buf && !(c->buf = malloc(BUF_SIZE))) return -1;
+        if(c->len) {
+            n = write(c->fd, c->buf + c->off, chunk(c->f.wbps, c->len));
+            if(n > 0) {
+                c->off += n;
+                c->len -= n;
+                pace(c, c->f.wbps, n);
+            }
+        } else {
+            n = read(c->fd, c->buf, chunk(c->f.rbps, BUF_SIZE));
+            if(n > 0) {
+                c->off = 0;
+                c->len = n;
+                pace(c, c->f.rbps, n);
+                if(c->f.delay_ms) {
+                    uint64_t due = bench_now_us() + c->f.delay_ms * 1000ULL;
+                    if(due > c->wake) c->wake = due;
+                } else if(!c->f.rbps && !c->f.wbps) {
+                    /* most of the time the socket takes it right away */
+                    ssize_t m = write(c->fd, c->buf, c->len);
+                    if(m > 0) {
+                        c->off += m;
+                        c->len -= m;
+                        c->bytes += m;
+                    }
+                }
+            }
+        }
+        break;
+    default:
+        return -1;
+    }
+    if(n == 0) return -1;
+    if(n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    return c->f.reset && c->bytes >= c->f.reset ? -1 : 0;
+}
+
+static void udp_echo(int fd) {
+    static __thread char buf[BUF_SIZE];
+    struct sockaddr_storage peer;
+    unsigned i;
+    for(i = 0; i < UDP_BATCH; i++) {
+        socklen_t len = sizeof peer;
+        ssize_t n = recvfrom(fd, buf, sizeof buf, 0, (void*) &peer, &len);
+        if(n < 0) break;
+        sendto(fd, buf, n, 0, (void*) &peer, len);
+    }
+}
+
+/* the poll timeout until the earliest of the times in *due */
+static void earliest(uint64_t* due, uint64_t t) {
+    if(!*due || t < *due) *due = t;
+}
+
+static void* worker_main(void* arg) {
+    struct worker* w = arg;
+    unsigned l;
+    size_t i;
+    for(;;) {
+        uint64_t now = bench_now_us(), due = 0;
+        for(l = 0; l < n_listeners; l++) {
+            struct listener* li = &listeners[l];
+            int mine = (li->mode != M_UDPECHO && !li->f.accept_ms) || li->worker == w->idx;
+            if(li->mode == M_REFUSE || li->mode == M_BLACKHOLE) mine = 0;
+            if(mine && li->next_accept > now) {
+                earliest(&due, li->next_accept);
+                mine = 0;
+            }
+            w->pfd[l] = (struct pollfd) { .fd = mine ? li->fd : -1, .events = POLLIN };
+        }
+        for(i = 0; i < w->n; i++) {
+            struct conn* c = &w->conns[i];
+            /* resting connections are left out, a hangup would wake poll over and over */
+            int rest = c->wake > now;
+            if(rest) earliest(&due, c->wake);
+            w->pfd[n_listeners + i] = (struct pollfd) { .fd = rest ? -1 : c->fd,
+                                                        .events = c->ctl ? POLLIN : want(c) };
+        }
+        size_t n = w->n;
+        int timeout = due ? (int)((due - now + 999) / 1000) : -1;
+        if(poll(w->pfd, n_listeners + n, timeout) <= 0) continue;
+        /* walk backwards so del_conn's swap only moves entries already seen */
+        for(i = n; i-- > 0;) {
+            short rev = w->pfd[n_listeners + i].revents;
+            if(rev && serve(&w->conns[i], rev)) del_conn(w, i);
+        }
+        for(l = 0; l < n_listeners; l++) {
+            if(!(w->pfd[l].revents & POLLIN)) continue;
+            if(listeners[l].mode == M_UDPECHO) {
+                udp_echo(listeners[l].fd);
+                continue;
+            }
+            int fd;
+            while((fd = accept(listeners[l].fd, 0, 0)) != -1) {
+                add_conn(w, fd, &listeners[l]);
+                if(listeners[l].f.accept_ms) {
+                    listeners[l].next_accept = bench_now_us() + listeners[l].f.accept_ms * 1000ULL;
+                    break;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* fills the accept queue of a listener that never accepts. with a
+   backlog of 0 linux queues one connection, others round it up a bit */
+static int blackhole(int fd) {
+    struct sockaddr_storage sa;
+    socklen_t len = sizeof sa;
+    unsigned i;
+    if(getsockname(fd, (void*) &sa, &len)) return -1;
+    for(i = 0; i < BLACKHOLE_FILL; i++) {
+        int s = socket(sa.ss_family, SOCK_STREAM, 0);
+        if(s == -1) return -1;
+        bench_nonblock(s);
+        if(connect(s, (void*) &sa, len) && errno != EINPROGRESS) {
+            close(s);
+            return -1;
+        }
+        /* kept open for good. a SYN without an answer means the queue is full */
+        struct pollfd pfd = { .fd = s, .events = POLLOUT };
+        if(poll(&pfd, 1, 100) != 1) break;
+    }
+    return 0;
+}
+
+/* [host:]port[-last]=mode[,fault...] */
+static int add_listener(const char* spec) {
+    char addr[300];
+    const char* eq = strchr(spec, '=');
+    unsigned m, last;
+    struct faults f = { 0 };
+    if(!eq || eq - spec >= (long) sizeof addr) return -1;
+    memcpy(addr, spec, eq - spec);
+    addr[eq - spec] = 0;
+    size_t ml = strcspn(eq + 1, ",");
+    for(m = 0; m < sizeof mode_names / sizeof *mode_names &&
+        (strlen(mode_names[m]) != ml || strncmp(eq + 1, mode_names[m], ml)); m++);
+    if(m == sizeof mode_names / sizeof *mode_names) return -1;
+    if(eq[1 + ml] && (m == M_UDPECHO || m == M_REFUSE || m == M_BLACKHOLE || parse_faults(eq + 2 + ml, &f)))
+        return -1;
+    char* dash = strrchr(addr, '-');
+    if(dash && !strchr(dash, ']')) {
+        *dash = 0;
+        last = atoi(dash + 1);
+    } else {
+        last = 0;
+    }
+    struct bench_addr a;
+    if(bench_parse_addr(addr, &a)) return -1;
+    if(last < a.port) last = a.port;
+    for(;; a.port++) {
+        if(n_listeners == MAX_LISTENERS) return -1;
+        int backlog = m == M_REFUSE ? -1 : m == M_BLACKHOLE ? 0 : 4096;
+        int fd = bench_listen(&a, m == M_UDPECHO ? SOCK_DGRAM : SOCK_STREAM, backlog);
+        if(fd == -1 || (m == M_BLACKHOLE && blackhole(fd))) {
+            perror(addr);
+            return -1;
+        }
+        bench_nonblock(fd);
+        listeners[n_listeners] = (struct listener) { .fd = fd, .mode = m, .f = f, .worker = n_listeners };
+        n_listeners++;
+        if(a.port == last) break;
+    }
+    return 0;
+}
+
+static int usage(void) {
+    dprintf(2, "usage: target [-w workers] -l [host:]port[-last]=mode[,fault...] ...\n"
+               "modes: echo sink source udpecho refuse blackhole\n"
+               "faults: accept=ms delay=ms rbps=n wbps=n bps=n reset=bytes ctl\n");
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    unsigned i;
+    int ch;
+    while((ch = getopt(argc, argv, "w:l:")) != -1) {
+        switch(ch) {
+            case 'w': n_workers = atoi(optarg); break;
+            case 'l':
+                if(add_listener(optarg)) {
+                    dprintf(2, "bad listener: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default: return usage();
+        }
+    }
+    if(!n_listeners) return usage();
+    if(!n_workers) n_workers = 1;
+    for(i = 0; i < n_listeners; i++) listeners[i].worker %= n_workers;
+    signal(SIGPIPE, SIG_IGN);
+    bench_raise_nofile();
+    memset(source_buf, 'x', sizeof source_buf);
+    struct worker* w = calloc(n_workers, sizeof *w);
+    if(!w) return 1;
+    for(i = 0; i < n_workers; i++) {
+        w[i].idx = i;
+        w[i].pfd = malloc(n_listeners * sizeof *w[i].pfd);
+        if(!w[i].pfd || pthread_create(&w[i].pt, 0, worker_main, &w[i])) {
+            perror("target");
+            return 1;
+        }
+    }
+    pthread_join(w[0].pt, 0);
+    return 0;
+}
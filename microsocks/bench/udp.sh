@@ -0,0 +1,58 @@
+#!/bin/sh
+# udp relay benchmark, run by `make bench-udp`.
+# bench/udpgen opens associations through the proxy and bounces datagrams
+# off TARGETS udp echo ports of bench/target. with many targets every
+# association holds that many target flows, which the proxy looks up for
+# each datagram. results give datagrams per second, loss, round trip
+# percentiles and proxy cpu per datagram.
+#
+#   PROXY     proxy binary (./microsocks)
+#   ASSOCS    association counts ("1 16 64")
+#   TARGETS   echo ports each association sends to in turn ("1 64")
+#   SIZES     payload sizes, the proxy relays at most 1024 ("64 1024")
+#   WINDOW    datagrams in flight per association (8)
+#   RATE      if set, send this many datagrams per second instead
+#   THREADS   udpgen threads (number of cpus)
+#   DURATION  seconds per run (5)
+#   PORT      first of four local tcp ports to use (21080)
+#   UDP_PORT  first udp echo port (22000)
+#   OUT       result file (bench/udp.json)
+
+cd "$(dirname "$0")/.." || exit 1
+PROXY=${PROXY:-./microsocks}
+ASSOCS=${ASSOCS:-1 16 64}
+TARGETS=${TARGETS:-1 64}
+SIZES=${SIZES:-64 1024}
+WINDOW=${WINDOW:-8}
+DURATION=${DURATION:-5}
+PORT=${PORT:-21080}
+UDP_PORT=${UDP_PORT:-22000}
+OUT=${OUT:-bench/udp.json}
+
+. bench/lib.sh
+THREADS=${THREADS:-$ncpu}
+
+max_targets=1
+for m in $TARGETS; do [ "$m" -gt "$max_targets" ] && max_targets=$m; done
+spawn ./bench/target -w "$ncpu" -l 127.0.0.1:$echo_port=echo \
+	-l 127.0.0.1:$UDP_PORT-$((UDP_PORT + max_targets - 1))=udpecho
+start_proxy all
+wait_proxy
+
+if [ -n "$RATE" ]; then load="-r $RATE"; else load="-q $WINDOW"; fi
+tmp=$OUT.tmp
+: > "$tmp"
+for assocs in $ASSOCS; do
+	for targets in $TARGETS; do
+		for size in $SIZES; do
+			echo "assocs=$assocs targets=$targets size=$size" >&2
+			./bench/udpgen -x 127.0.0.1:$proxy_port -t 127.0.0.1:$UDP_PORT \
+				-a "$assocs" -m "$targets" -s "$size" -w "$THREADS" $load \
+				-d "$DURATION" -p "$proxy_pid" >> "$tmp" ||
+				echo "udpgen failed" >&2
+		done
+	done
+done
+stop_proxy
+
+write_results "$OUT"
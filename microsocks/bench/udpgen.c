@@ -0,0 +1,245 @@
+/* UDP ASSOCIATE load generator.
+   opens -a associations through the proxy and sends -s byte datagrams
+   from each of them to -m udp echo ports (starting at the -t port), one
+   destination after the other, so every association keeps that many
+   target flows open in the proxy. -w threads share the associations.
+   without -r every association keeps -q datagrams in flight and sends the
+   next one when an answer arrives, or when nothing came back for 200ms.
+   with -r the threads send r datagrams per second in total, regardless.
+   each payload carries its send time, which gives the round trip time of
+   the answers. the datagrams that never came back are the loss; after
+   the run a last half second is allowed for stragglers. */
+
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../hist.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LOSS_TIMEOUT_US 200000
+#define DRAIN_US 500000
+#define MAX_DATAGRAM 2048
+
+struct assoc {
+    int tcp, udp;
+    unsigned next_dst;
+    unsigned inflight;
+    uint64_t last_us;  /* last send or receive */
+};
+
+struct worker {
+    pthread_t pt;
+    struct assoc* a;
+    unsigned n;
+    uint64_t sent, received, bytes;
+};
+
+static struct {
+    struct bench_addr proxy, target;
+    struct socks5_auth auth;
+    unsigned targets, window, rate, threads;
+    size_t size;
+    uint64_t deadline;
+} opt;
+
+static struct hist rtt_hist;
+/* header per destination, all destinations have the same length */
+static unsigned char (*headers)[4 + 256 + 2];
+static size_t header_len;
+
+static int open_assoc(struct assoc* a) {
+    struct bench_addr local, relay;
+    bench_parse_addr("127.0.0.1:0", &local);
+    a->udp = bench_listen(&local, SOCK_DGRAM, -1);
+    a->tcp = bench_connect(&opt.proxy);
+    if(a->udp == -1 || a->tcp == -1 || bench_sockname(a->udp, 0, &local) ||
+       socks5_udp_associate(a->tcp, &opt.auth, &local, &relay)) return -1;
+    /* the relay only answers the address it was told about */
+    if(bench_connect_fd(a->udp, &relay)) return -1;
+    bench_nonblock(a->udp);
+    return 0;
+}
+
+static int send_one(struct worker* w, struct assoc* a, uint64_t now) {
+    unsigned char buf[MAX_DATAGRAM];
+    unsigned d = a->next_dst++ % opt.targets;
+    memcpy(buf, headers[d], header_len);
+    memset(buf + header_len, 'x', opt.size);
+    memcpy(buf + header_len, &now, sizeof now);
+    if(send(a->udp, buf, header_len + opt.size, 0) == -1) return -1;
+    w->sent++;
+    a->inflight++;
+    a->last_us = now;
+    return 0;
+}
+
+static void receive(struct worker* w, struct assoc* a) {
+    unsigned char buf[MAX_DATAGRAM];
+    ssize_t n, h;
+    uint64_t sent_us;
+    while((n = recv(a->udp, buf, sizeof buf, 0)) > 0) {
+        uint64_t now = bench_now_us();
+        if((h = bench_udp_skip_header(buf, n)) < 0 || n - h < (ssize_t) sizeof sent_us) continue;
+        memcpy(&sent_us, buf + h, sizeof sent_us);
+        hist_record(&rtt_hist, now - sent_us);
+        w->received++;
+        w->bytes += n - h;
+        if(a->inflight) a->inflight--;
+        a->last_us = now;
+    }
+}
+
+static void* run(void* arg) {
+    struct worker* w = arg;
+    struct pollfd* pfd = calloc(w->n, sizeof *pfd);
+    uint64_t start = bench_now_us(), sent_paced = 0;
+    unsigned i, rr = 0;
+    double per_us = opt.rate ? (double) opt.rate / opt.threads / 1e6 : 0;
+    if(!pfd) return 0;
+    for(i = 0; i < w->n; i++) pfd[i] = (struct pollfd) { .fd = w->a[i].udp, .events = POLLIN };
+    for(;;) {
+        uint64_t now = bench_now_us();
+        int draining = now >= opt.deadline;
+        if(draining && now >= opt.deadline + DRAIN_US) break;
+        int timeout = 10;
+        if(!draining && opt.rate) {
+            /* paced: catch up with the schedule, round robin over associations */
+            uint64_t due = (now - start) * per_us;
+            while(sent_paced < due) {
+                send_one(w, &w->a[rr++ % w->n], now);
+                sent_paced++;
+            }
+            timeout = 1;
+        } else if(!draining) {
+            for(i = 0; i < w->n; i++) {
+                struct assoc* a = &w->a[i];
+                if(a->inflight && now - a->last_us > LOSS_TIMEOUT_US) a->inflight = 0;
+                while(a->inflight < opt.window && !send_one(w, a, now));
+            }
+        }
+        if(poll(pfd, w->n, timeout) > 0)
+            for(i = 0; i < w->n; i++)
+                if(pfd[i].revents & POLLIN) receive(w, &w->a[i]);
+    }
+    free(pfd);
+    return 0;
+}
+
+static int usage(void) {
+    dprintf(2, "usage: udpgen -x proxy -t target [-m targets] [-a assocs] [-w threads] [-s size]\n"
+               "              [-q window | -r pps] [-d secs] [-u user -P pass] [-p proxypid]\n"
+               "              [-L key=value]...\n");
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    unsigned assocs = 1, secs = 5, i, n_labels = 0;
+    const char* labels[16];
+    pid_t pid = 0;
+    int ch, have_proxy = 0, have_target = 0;
+    opt.size = 64;
+    opt.targets = 1;
+    opt.window = 1;
+    opt.threads = 1;
+    while((ch = getopt(argc, argv, "x:t:m:a:w:s:q:r:d:u:P:p:L:")) != -1) {
+        switch(ch) {
+        case 'x': have_proxy = !bench_parse_addr(optarg, &opt.proxy); break;
+        case 't': have_target = !bench_parse_addr(optarg, &opt.target); break;
+        case 'm': opt.targets = atoi(optarg); break;
+        case 'a': assocs = atoi(optarg); break;
+        case 'w': opt.threads = atoi(optarg); break;
+        case 's': opt.size = strtoul(optarg, 0, 10); break;
+        case 'q': opt.window = atoi(optarg); break;
+        case 'r': opt.rate = atoi(optarg); break;
+        case 'd': secs = atoi(optarg); break;
+        case 'u': opt.auth.user = optarg; break;
+        case 'P': opt.auth.pass = optarg; break;
+        case 'p': pid = atoi(optarg); break;
+        case 'L':
+            if(!strchr(optarg, '=') || n_labels == sizeof labels / sizeof *labels) return usage();
+            labels[n_labels++] = optarg;
+            break;
+        default: return usage();
+        }
+    }
+    if(!have_proxy || !have_target || !assocs || !secs || !opt.targets || !opt.window ||
+       opt.size < sizeof(uint64_t) || opt.targets + opt.target.port > 65536 ||
+       (opt.auth.user && !opt.auth.pass)) return usage();
+    if(opt.threads > assocs) opt.threads = assocs;
+    signal(SIGPIPE, SIG_IGN);
+    bench_raise_nofile();
+
+    headers = calloc(opt.targets, sizeof *headers);
+    struct assoc* a = calloc(assocs, sizeof *a);
+    struct worker* w = calloc(opt.threads, sizeof *w);
+    if(!headers || !a || !w) return 1;
+    for(i = 0; i < opt.targets; i++) {
+        struct bench_addr dst = opt.target;
+        dst.port += i;
+        header_len = bench_udp_header(headers[i], &dst);
+    }
+    if(header_len + opt.size > MAX_DATAGRAM) return usage();
+    for(i = 0; i < assocs; i++)
+        if(open_assoc(&a[i])) {
+            dprintf(2, "association %u failed\n", i);
+            return 1;
+        }
+    for(i = 0; i < opt.threads; i++) {
+        /* contiguous shares, the first threads take the remainder */
+        unsigned share = assocs / opt.threads, rest = assocs % opt.threads;
+        w[i].a = a + i * share + (i < rest ? i : rest);
+        w[i].n = share + (i < rest);
+    }
+
+    double cpu0 = pid ? bench_proc_cpu(pid) : -1;
+    uint64_t start = bench_now_us();
+    opt.deadline = start + secs * 1000000ULL;
+    for(i = 0; i < opt.threads; i++)
+        if(pthread_create(&w[i].pt, 0, run, &w[i])) {
+            perror("pthread_create");
+            return 1;
+        }
+    uint64_t sent = 0, received = 0, bytes = 0;
+    for(i = 0; i < opt.threads; i++) {
+        pthread_join(w[i].pt, 0);
+        sent += w[i].sent;
+        received += w[i].received;
+        bytes += w[i].bytes;
+    }
+    double elapsed = secs, cpu1 = pid ? bench_proc_cpu(pid) : -1;
+
+    printf("{\"mode\": \"udp\", \"assocs\": %u, \"targets\": %u, \"size\": %zu", assocs, opt.targets, opt.size);
+    if(opt.rate) printf(", \"rate\": %u", opt.rate);
+    else printf(", \"window\": %u", opt.window);
+    for(i = 0; i < n_labels; i++) {
+        const char* eq = strchr(labels[i], '=');
+        printf(", \"%.*s\": \"%s\"", (int)(eq - labels[i]), labels[i], eq + 1);
+    }
+    printf(", \"secs\": %.3f, \"sent\": %llu, \"received\": %llu, \"loss\": %.5f, \"pps\": %.1f, \"mb_per_sec\": %.2f",
+           elapsed, (unsigned long long) sent, (unsigned long long) received,
+           sent ? (double)(sent - (received < sent ? received : sent)) / sent : 0,
+           received / elapsed, bytes / elapsed / 1e6);
+    if(cpu0 >= 0 && cpu1 >= 0) {
+        printf(", \"proxy_cpu_sec\": %.3f", cpu1 - cpu0);
+        if(received) printf(", \"cpu_us_per_packet\": %.2f", (cpu1 - cpu0) * 1e6 / (sent + received));
+    }
+    struct hist_snapshot s;
+    hist_merge(&rtt_hist, &s);
+    printf(", \"rtt_us\": {\"count\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}}\n",
+           (unsigned long long) s.count,
+           (unsigned long long) hist_quantile(&s, .5), (unsigned long long) hist_quantile(&s, .9),
+           (unsigned long long) hist_quantile(&s, .99), (unsigned long long) hist_quantile(&s, 1));
+    for(i = 0; i < assocs; i++) {
+        close(a[i].udp);
+        close(a[i].tcp);
+    }
+    return received ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+# wire format microbenchmarks, run by `make bench-wire`.
+# runs bench/wirebench over the shared corpus. where perf is installed
+# (and PERF is not 0) every function is run once more under perf stat and
+# its cycles, instructions, cache and branch misses per op are added.
+#
+#   MS     milliseconds per function and corpus class (200)
+#   PERF   set to 0 to skip perf stat
+#   OUT    result file (bench/wire.json)
+
+cd "$(dirname "$0")/.." || exit 1
+MS=${MS:-200}
+OUT=${OUT:-bench/wire.json}
+EVENTS=cycles,instructions,cache-misses,branch-misses
+
+tmp=$OUT.tmp
+./bench/wirebench -t "$MS" > "$tmp" || exit 1
+if [ "$PERF" != 0 ] && command -v perf >/dev/null 2>&1; then
+	for fn in $(./bench/wirebench -l); do
+		echo "perf stat $fn" >&2
+		# ops come from wirebench itself, counters from perf's csv output
+		ops=$(perf stat -x, -e $EVENTS -o "$tmp.perf" ./bench/wirebench -t "$MS" -f "$fn" |
+			sed -n 's/.*"ops": \([0-9]*\).*/\1/p' | awk '{ s += $1 } END { print s + 0 }')
+		[ "$ops" -gt 0 ] || continue
+		counters=$(awk -F, -v ops="$ops" '
+			$3 ~ /^[a-z-]+$/ && $1 ~ /^[0-9]+$/ {
+				printf "%s\"%s_per_op\": %.3f", sep, $3, $1 / ops; sep = ", "
+			}' "$tmp.perf")
+		[ -n "$counters" ] &&
+			echo "{\"function\": \"$fn\", \"corpus\": \"both\", \"perf\": {$counters}}" >> "$tmp"
+	done
+	rm -f "$tmp.perf"
+fi
+
+. bench/lib.sh
+META="\"ms_per_run\": $MS" write_results "$OUT"
@@ -0,0 +1,161 @@
+/* microbenchmarks for the SOCKS5 wire format code in socks5.c.
+   every function runs over the realistic and the adversarial entries of
+   its part of the corpus (corpus.c) for -t milliseconds each and one json
+   object per function and class is printed, with ns/op and, with glibc,
+   heap allocations per op. -f runs only the named function, so that
+   perf stat counters can be put down to it, -l lists them. -w dir writes the corpus
+   into dir as seeds for the fuzz target, one file per entry, prefixed
+   with the kind byte fuzz_socks5.c dispatches on. */
+
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "corpus.h"
+#include "../socks5.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+/* counts the allocations of the code under test */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+static uint64_t allocs;
+void *malloc(size_t n) { allocs++; return __libc_malloc(n); }
+void *calloc(size_t n, size_t m) { allocs++; return __libc_calloc(n, m); }
+void *realloc(void *p, size_t n) { allocs++; return __libc_realloc(p, n); }
+#define HAVE_ALLOC_COUNT 1
+#else
+static uint64_t allocs;
+#define HAVE_ALLOC_COUNT 0
+#endif
+
+/* keeps the compiler from dropping results */
+static volatile long sink;
+
+static long run_addrport(const struct corpus_entry *e) {
+    struct socks5_addrport ap;
+    /* the destination behind VER CMD RSV */
+    return e->len < 3 ? 0 : socks5_parse_addrport(e->data + 3, e->len - 3, &ap);
+}
+
+static long run_request(const struct corpus_entry *e) {
+    struct socks5_addrport ap;
+    int cmd;
+    return socks5_parse_request(e->data, e->len, &cmd, &ap);
+}
+
+static long run_auth_method(const struct corpus_entry *e) {
+    return socks5_auth_method(e->data, e->len, 1, 0);
+}
+
+static long run_credentials(const struct corpus_entry *e) {
+    char name[256];
+    return socks5_check_credentials(e->data, e->len, "user", "secret", name);
+}
+
+static long run_udp(const struct corpus_entry *e) {
+    struct socks5_addrport ap;
+    return socks5_parse_udp(e->data, e->len, &ap);
+}
+
+static long run_udp_header(const struct corpus_entry *e) {
+    struct socks5_addrport ap;
+    unsigned char buf[MAX_SOCKS5_HEADER_LEN];
+    /* the header for the answer from the datagram's destination */
+    if(socks5_parse_udp(e->data, e->len, &ap) < 0) return 0;
+    return socks5_udp_header(buf, &ap);
+}
+
+static const struct bench_fn {
+    const char *name;
+    enum corpus_kind kind;
+    long (*fn)(const struct corpus_entry *);
+    int parses_first;  /* the time includes a socks5_parse_udp() */
+} fns[] = {
+    { "parse_addrport", CK_REQUEST, run_addrport, 0 },
+    { "parse_request", CK_REQUEST, run_request, 0 },
+    { "auth_method", CK_GREETING, run_auth_method, 0 },
+    { "check_credentials", CK_AUTH, run_credentials, 0 },
+    { "parse_udp", CK_UDP, run_udp, 0 },
+    { "udp_header", CK_UDP, run_udp_header, 1 },
+};
+
+static void bench(const struct bench_fn *f, const struct corpus_entry *c, size_t n, int adversarial,
+                  unsigned ms) {
+    const struct corpus_entry *sel[64];
+    size_t k = 0, i;
+    for(i = 0; i < n && k < sizeof sel / sizeof *sel; i++)
+        if(c[i].kind == f->kind && c[i].adversarial == adversarial) sel[k++] = &c[i];
+    if(!k) return;
+    /* warm up, then run in rounds over all selected entries until the time is up */
+    for(i = 0; i < 1000; i++) sink += f->fn(sel[i % k]);
+    uint64_t ops = 0, a0 = allocs, t0 = bench_now_us(), end = t0 + ms * 1000ULL, t1;
+    do {
+        unsigned r;
+        for(r = 0; r < 256; r++)
+            for(i = 0; i < k; i++) sink += f->fn(sel[i]);
+        ops += 256 * k;
+    } while((t1 = bench_now_us()) < end);
+    uint64_t a1 = allocs;
+    printf("{\"function\": \"%s\", \"corpus\": \"%s\", \"entries\": %zu, \"ops\": %llu, \"ns_per_op\": %.2f",
+           f->name, adversarial ? "adversarial" : "realistic", k, (unsigned long long) ops,
+           (t1 - t0) * 1000.0 / ops);
+    if(HAVE_ALLOC_COUNT) printf(", \"allocs_per_op\": %.4f", (double)(a1 - a0) / ops);
+    else printf(", \"allocs_per_op\": null");
+    if(f->parses_first) printf(", \"note\": \"includes parse_udp\"");
+    printf("}\n");
+}
+
+static int write_seeds(const char *dir, const struct corpus_entry *c, size_t n) {
+    size_t i;
+    for(i = 0; i < n; i++) {
+        char path[4096];
+        snprintf(path, sizeof path, "%s/%s-%s", dir, corpus_kind_names[c[i].kind], c[i].name);
+        FILE *f = fopen(path, "wb");
+        if(!f) {
+            perror(path);
+            return 1;
+        }
+        unsigned char kind = c[i].kind;
+        fwrite(&kind, 1, 1, f);
+        fwrite(c[i].data, 1, c[i].len, f);
+        fclose(f);
+    }
+    return 0;
+}
+
+static int usage(void) {
+    dprintf(2, "usage: wirebench [-t ms] [-f function] [-l] [-w seeddir]\n");
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    const struct corpus_entry *c;
+    const char *only = 0, *seeds = 0;
+    unsigned ms = 200, i;
+    int ch, found = 0;
+    while((ch = getopt(argc, argv, "t:f:lw:")) != -1) {
+        switch(ch) {
+        case 'l':
+            for(i = 0; i < sizeof fns / sizeof *fns; i++) printf("%s\n", fns[i].name);
+            return 0;
+        case 't': ms = atoi(optarg); break;
+        case 'f': only = optarg; break;
+        case 'w': seeds = optarg; break;
+        default: return usage();
+        }
+    }
+    size_t n = corpus_get(&c);
+    if(seeds) return write_seeds(seeds, c, n);
+    for(i = 0; i < sizeof fns / sizeof *fns; i++) {
+        if(only && strcmp(only, fns[i].name)) continue;
+        found = 1;
+        bench(&fns[i], c, n, 0, ms);
+        bench(&fns[i], c, n, 1, ms);
+    }
+    if(!found) return usage();
+    return 0;
+}
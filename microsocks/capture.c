@@ -0,0 +1,269 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "capture.h"
+#include "socks5.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct capture_conn {
+    uint64_t start_ns, reply_ns;
+    enum capture_auth auth;
+    enum capture_cmd cmd;
+    enum capture_atyp atyp;
+    unsigned reply;
+    uint64_t dst;
+    uint32_t flows;
+    size_t n, cap;
+    size_t last[2];  /* latest event per direction, plus one */
+    uint64_t tail[2], tail_datagrams[2];  /* after CAPTURE_MAX_EVENTS */
+    struct capture_event* ev;
+};
+
+static FILE* capture_file;
+static uint64_t capture_epoch;
+static uint64_t capture_key[2];
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct capture_conn *cur;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* siphash-2-4, so that the hashes can't be reversed without the key */
+#define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND do { \
+    v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+    v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+} while(0)
+
+static uint64_t siphash(const unsigned char* p, size_t n) {
+    uint64_t v0 = capture_key[0] ^ 0x736f6d6570736575ULL, v1 = capture_key[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = capture_key[0] ^ 0x6c7967656e657261ULL, v3 = capture_key[1] ^ 0x7465646279746573ULL;
+    uint64_t m, b = (uint64_t) n << 56;
+    size_t i, j;
+    for(i = 0; i + 8 <= n; i += 8) {
+        for(m = 0, j = 0; j < 8; j++) m |= (uint64_t) p[i + j] << (8 * j);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    for(j = 0; i + j < n; j++) b |= (uint64_t) p[i + j] << (8 * j);
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static uint64_t hash_addrport(const struct socks5_addrport* ap) {
+    unsigned char buf[sizeof ap->addr + 2];
+    size_t l = strlen(ap->addr);
+    memcpy(buf, ap->addr, l);
+    buf[l] = ap->port >> 8;
+    buf[l + 1] = ap->port;
+    return siphash(buf, l + 2);
+}
+
+int capture_open(const char* path) {
+    int fd = open("/dev/urandom", O_RDONLY);
+    if(fd == -1 || read(fd, capture_key, sizeof capture_key) != sizeof capture_key) {
+        if(fd != -1) close(fd);
+        return -1;
+    }
+    close(fd);
+    if(!(capture_file = fopen(path, "wb"))) return -1;
+    capture_epoch = now_ns();
+    fwrite(CAPTURE_MAGIC, 1, sizeof CAPTURE_MAGIC - 1, capture_file);
+    fflush(capture_file);
+    return 0;
+}
+
+void capture_conn_start(void) {
+    cur = 0;
+    if(!capture_file || !(cur = calloc(1, sizeof *cur))) return;
+    cur->start_ns = now_ns();
+    cur->reply = CAPTURE_NO_REPLY;
+}
+
+void capture_auth(enum capture_auth auth) {
+    if(cur) cur->auth = auth;
+}
+
+void capture_request(int cmd, const struct socks5_addrport* ap) {
+    if(!cur) return;
+    cur->cmd = cmd == CONNECT ? CAPTURE_CMD_CONNECT : CAPTURE_CMD_UDP;
+    if(!ap) return;
+    switch(ap->type) {
+        case SOCKS5_IPV4: cur->atyp = CAPTURE_ATYP_IPV4; break;
+        case SOCKS5_IPV6: cur->atyp = CAPTURE_ATYP_IPV6; break;
+        case SOCKS5_DNS: cur->atyp = CAPTURE_ATYP_NAME; break;
+        default: cur->atyp = CAPTURE_ATYP_NONE;
+    }
+    cur->dst = hash_addrport(ap);
+}
+
+void capture_reply(int ec) {
+    if(!cur) return;
+    cur->reply = ec < 0 ? -ec : ec;
+    cur->reply_ns = now_ns();
+}
+
+void capture_udp_flow(const struct socks5_addrport* ap) {
+    if(!cur) return;
+    if(!cur->flows++) cur->dst = hash_addrport(ap);
+}
+
+static void add_event(int dir, size_t n, int datagram) {
+    uint32_t ms = (now_ns() - cur->start_ns) / 1000000;
+    /* request/response traffic alternates, so this looks past the other direction */
+    struct capture_event* e = cur->last[dir] ? &cur->ev[cur->last[dir] - 1] : 0;
+    if(e && ms - e->at_ms < CAPTURE_TICK_MS && (uint64_t) e->bytes + n <= UINT32_MAX) {
+        e->bytes += n;
+        e->datagrams += datagram;
+        return;
+    }
+    if(cur->n == cur->cap) {
+        size_t cap = cur->cap ? cur->cap * 2 : 16;
+        struct capture_event* ev;
+        if(cap > CAPTURE_MAX_EVENTS || !(ev = realloc(cur->ev, cap * sizeof *ev))) {
+            cur->tail[dir] += n;
+            cur->tail_datagrams[dir] += datagram;
+            return;
+        }
+        cur->ev = ev;
+        cur->cap = cap;
+    }
+    cur->ev[cur->n++] = (struct capture_event) { .at_ms = ms, .bytes = n, .datagrams = datagram, .dir = dir };
+    cur->last[dir] = cur->n;
+}
+
+void capture_bytes(int dir, size_t n) {
+    if(cur) add_event(dir, n, 0);
+}
+
+void capture_datagram(int dir, size_t n) {
+    if(cur) add_event(dir, n, 1);
+}
+
+static unsigned char* put_varint(unsigned char* p, uint64_t v) {
+    while(v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+void capture_conn_end(void) {
+    if(!cur) return;
+    uint64_t end = now_ns();
+    uint32_t duration_ms = (end - cur->start_ns) / 1000000;
+    size_t i, n = cur->n + 2;
+    int udp = cur->cmd == CAPTURE_CMD_UDP;
+    /* 10 bytes per varint at most */
+    unsigned char *buf = malloc(10 + 8 * 10 + 8 + n * 30), *p;
+    if(!buf) goto out;
+    p = buf + 10;
+    p = put_varint(p, (cur->start_ns - capture_epoch) / 1000000);
+    p = put_varint(p, cur->auth | cur->cmd << 2 | cur->atyp << 4);
+    p = put_varint(p, cur->reply);
+    for(i = 0; i < 8; i++) *p++ = cur->dst >> (8 * i);
+    p = put_varint(p, cur->reply_ns ? (cur->reply_ns - cur->start_ns) / 1000 : 0);
+    p = put_varint(p, duration_ms);
+    p = put_varint(p, cur->flows);
+    p = put_varint(p, cur->n + !!cur->tail[0] + !!cur->tail[1]);
+    uint32_t last = 0;
+    for(i = 0; i < cur->n; i++) {
+        p = put_varint(p, (uint64_t)(cur->ev[i].at_ms - last) << 1 | cur->ev[i].dir);
+        p = put_varint(p, cur->ev[i].bytes);
+        if(udp) p = put_varint(p, cur->ev[i].datagrams);
+        last = cur->ev[i].at_ms;
+    }
+    for(i = 0; i < 2; i++) if(cur->tail[i]) {
+        p = put_varint(p, (uint64_t)(duration_ms - last) << 1 | i);
+        p = put_varint(p, cur->tail[i]);
+        if(udp) p = put_varint(p, cur->tail_datagrams[i]);
+        last = duration_ms;
+    }
+    /* the length goes right in front of the body */
+    unsigned char len[10], *q = put_varint(len, p - (buf + 10));
+    unsigned char* start = buf + 10 - (q - len);
+    memcpy(start, len, q - len);
+    pthread_mutex_lock(&capture_lock);
+    fwrite(start, 1, p - start, capture_file);
+    fflush(capture_file);
+    pthread_mutex_unlock(&capture_lock);
+    free(buf);
+out:
+    free(cur->ev);
+    free(cur);
+    cur = 0;
+}
+
+static int get_varint(const unsigned char** p, const unsigned char* end, uint64_t* v) {
+    unsigned shift = 0;
+    *v = 0;
+    while(*p < end && shift < 64) {
+        unsigned char c = *(*p)++;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if(!(c & 0x80)) return 0;
+        shift += 7;
+    }
+    return -1;
+}
+
+ssize_t capture_decode(const unsigned char* buf, size_t n, struct capture_record* r) {
+    const unsigned char *p = buf, *end = buf + n;
+    uint64_t len, v[7];
+    size_t i;
+    r->events = 0;
+    if(!n) return 0;
+    if(get_varint(&p, end, &len)) return p == end ? 0 : -1;
+    if(len > (size_t)(end - p)) return 0;
+    end = p + len;
+    for(i = 0; i < 3; i++) if(get_varint(&p, end, &v[i])) return -1;
+    if(end - p < 8) return -1;
+    r->start_ms = v[0];
+    r->auth = v[1] & 3;
+    r->cmd = v[1] >> 2 & 3;
+    r->atyp = v[1] >> 4 & 3;
+    r->reply = v[2];
+    if(r->auth > CAPTURE_AUTH_REFUSED || r->cmd > CAPTURE_CMD_UDP) return -1;
+    for(r->dst = 0, i = 0; i < 8; i++) r->dst |= (uint64_t) *p++ << (8 * i);
+    for(i = 3; i < 7; i++) if(get_varint(&p, end, &v[i])) return -1;
+    r->handshake_us = v[3];
+    r->duration_ms = v[4];
+    r->flows = v[5];
+    r->n_events = v[6];
+    /* every event takes two bytes at least */
+    if(r->n_events > (size_t)(end - p) / 2) return -1;
+    if(r->n_events && !(r->events = malloc(r->n_events * sizeof *r->events))) return -1;
+    uint64_t at = 0;
+    for(i = 0; i < r->n_events; i++) {
+        uint64_t d, b, dg = 0;
+        if(get_varint(&p, end, &d) || get_varint(&p, end, &b) ||
+           (r->cmd == CAPTURE_CMD_UDP && get_varint(&p, end, &dg))) {
+            free(r->events);
+            r->events = 0;
+            return -1;
+        }
+        at += d >> 1;
+        r->events[i] = (struct capture_event) { .at_ms = at, .bytes = b, .datagrams = dg, .dir = d & 1 };
+    }
+    return end - buf;
+}
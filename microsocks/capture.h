@@ -0,0 +1,73 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* opt-in recorder of tunnel shapes: how a connection authenticated, what
+   it asked for, a keyed hash of its destination and when how many bytes
+   went which way. no addresses, names or payload end up in the file; the
+   hash key is random per process and never written, so equal
+   destinations stay equal within one trace only. bench/replay.c plays a
+   trace back against a local proxy.
+
+   the file is CAPTURE_MAGIC followed by one record per connection, in the
+   order they ended. a record is a varint with the length of the rest,
+   then the varints start_ms (since the capture opened), kind (auth, cmd
+   and atyp below, shifted by 0, 2 and 4), reply, 8 bytes of destination
+   hash (little endian), handshake_us, duration_ms, udp flows and the
+   event count, then per event (delta_ms << 1 | dir), bytes and, for udp
+   associations, the number of datagrams. traffic in one direction within
+   CAPTURE_TICK_MS of an event's start is added to that event. */
+
+#define CAPTURE_MAGIC "MSCAP01\n"
+#define CAPTURE_TICK_MS 10
+/* bytes beyond this many events are added up into two final ones */
+#define CAPTURE_MAX_EVENTS 4096
+
+/* the same as enum stats_dir */
+enum capture_dir { CAPTURE_UP, CAPTURE_DOWN };
+enum capture_auth { CAPTURE_AUTH_NONE, CAPTURE_AUTH_PASSWORD, CAPTURE_AUTH_REFUSED };
+enum capture_cmd { CAPTURE_CMD_NONE, CAPTURE_CMD_CONNECT, CAPTURE_CMD_UDP };
+enum capture_atyp { CAPTURE_ATYP_NONE, CAPTURE_ATYP_IPV4, CAPTURE_ATYP_NAME, CAPTURE_ATYP_IPV6 };
+#define CAPTURE_NO_REPLY 0xff
+
+struct capture_event {
+    uint32_t at_ms;  /* since the connection started */
+    uint32_t bytes;
+    uint32_t datagrams;
+    int dir;         /* enum capture_dir */
+};
+
+struct capture_record {
+    uint32_t start_ms;
+    enum capture_auth auth;
+    enum capture_cmd cmd;
+    enum capture_atyp atyp;
+    unsigned reply;
+    uint64_t dst;
+    uint32_t handshake_us, duration_ms, flows;
+    size_t n_events;
+    struct capture_event* events;  /* malloc'd by capture_decode */
+};
+
+struct socks5_addrport;
+
+int capture_open(const char* path);
+/* the calling thread serves a new connection */
+void capture_conn_start(void);
+void capture_conn_end(void);
+void capture_auth(enum capture_auth auth);
+/* ap is the target of a CONNECT, NULL for UDP ASSOCIATE */
+void capture_request(int cmd, const struct socks5_addrport* ap);
+void capture_reply(int ec);
+void capture_udp_flow(const struct socks5_addrport* ap);
+void capture_bytes(int dir, size_t n);
+void capture_datagram(int dir, size_t n);
+
+/* decodes the record at buf. returns the bytes it took, 0 if buf ends
+   before it does, -1 if it is malformed or out of memory */
+ssize_t capture_decode(const unsigned char* buf, size_t n, struct capture_record* r);
+
+#endif
@@ -0,0 +1,46 @@
+#include "conntab.h"
+#include <string.h>
+
+struct conntab_slot conntab[CONNTAB_SLOTS];
+
+struct conntab_slot* conntab_claim(uint64_t id, int listener, const char* client, uint64_t now_ns) {
+    unsigned i, start = id % CONNTAB_SLOTS;
+    for(i = 0; i < CONNTAB_SLOTS; i++) {
+        struct conntab_slot *s = &conntab[(start + i) % CONNTAB_SLOTS];
+        uint64_t zero = 0;
+        if(__atomic_load_n(&s->id, __ATOMIC_RELAXED) ||
+           !__atomic_compare_exchange_n(&s->id, &zero, CONNTAB_CLAIMING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+        s->listener = listener;
+        s->start_ns = now_ns;
+        s->bytes[0] = s->bytes[1] = 0;
+        s->fds[0] = s->fds[1] = -1;
+        s->tcpinfo_ns = 0;
+        s->phase = 0;
+        s->busy_ns = 0;
+        s->stall_reported = 0;
+        memset(s->tcpinfo, 0, sizeof s->tcpinfo);
+        s->client[sizeof s->client - 1] = 0;
+        strncpy(s->client, client, sizeof s->client - 1);
+        s->target[0] = 0;
+        __atomic_store_n(&s->id, id, __ATOMIC_RELEASE);
+        return s;
+    }
+    return 0;
+}
+
+void conntab_release(struct conntab_slot* slot) {
+    if(slot) __atomic_store_n(&slot->id, 0, __ATOMIC_RELEASE);
+}
+
+void conntab_set_target(struct conntab_slot* slot, const char* target) {
+    if(!slot) return;
+    slot->target[sizeof slot->target - 1] = 0;
+    strncpy(slot->target, target, sizeof slot->target - 1);
+}
+
+void conntab_set_fds(struct conntab_slot* slot, int client, int target) {
+    if(!slot) return;
+    __atomic_store_n(&slot->fds[0], client, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&slot->fds[1], target, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,46 @@
+#ifndef CONNTAB_H
+#define CONNTAB_H
+
+#include <stdint.h>
+#include "tcpinfo.h"
+
+/* fixed size table of live connections for introspection.
+   a connection thread claims a slot when it starts and is the only writer
+   of it, apart from the tcpinfo and stall fields the watchdog fills in;
+   readers walk the table without locking and may see a slot that is being
+   updated, which is fine for a live view.
+   when the table is full, further connections simply aren't listed. */
+
+#ifndef CONNTAB_SLOTS
+#define CONNTAB_SLOTS 1024
+#endif
+
+/* slot id while its claimer is still filling it in */
+#define CONNTAB_CLAIMING UINT64_MAX
+
+struct conntab_slot {
+    uint64_t id;        /* 0 while the slot is free */
+    int listener;
+    uint64_t start_ns;
+    uint64_t bytes[2];
+    int fds[2];           /* client and target socket while relaying, else -1 */
+    uint64_t tcpinfo_ns;  /* when tcpinfo was last sampled, 0 if never */
+    struct tcpinfo_sample tcpinfo[2];
+    /* see watchdog.h */
+    int phase;
+    uint64_t busy_ns;         /* start of the running callback, 0 if waiting */
+    uint64_t stall_reported;  /* busy_ns of the last reported stall */
+    char client[64];
+    char target[128];
+};
+
+extern struct conntab_slot conntab[CONNTAB_SLOTS];
+
+struct conntab_slot* conntab_claim(uint64_t id, int listener, const char* client, uint64_t now_ns);
+void conntab_release(struct conntab_slot* slot);
+void conntab_set_target(struct conntab_slot* slot, const char* target);
+/* publishes the relayed sockets for tcpinfo sampling, -1 -1 withdraws
+   them and has to happen before they are closed */
+void conntab_set_fds(struct conntab_slot* slot, int client, int target);
+
+#endif
@@ -0,0 +1,120 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#include "handoff.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define HANDOFF_MAX_FDS 2
+
+static int unix_addr(const char* path, struct sockaddr_un* sa) {
+    memset(sa, 0, sizeof *sa);
+    sa->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof sa->sun_path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(sa->sun_path, path);
+    return 0;
+}
+
+int handoff_listen(const char* path) {
+    struct sockaddr_un sa;
+    if(unix_addr(path, &sa)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1) return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    unlink(path);
+    if(bind(fd, (struct sockaddr*) &sa, sizeof sa) || listen(fd, 1)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff_connect(const char* path) {
+    struct sockaddr_un sa;
+    if(unix_addr(path, &sa)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1) return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if(connect(fd, (struct sockaddr*) &sa, sizeof sa)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff_send(int sock, const struct handoff_msg* m, const int* fds, int nfds) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    } ctl;
+    struct iovec iov = { .iov_base = (void*) m, .iov_len = sizeof *m };
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1 };
+    if(nfds) {
+        memset(&ctl, 0, sizeof ctl);
+        mh.msg_control = ctl.buf;
+        mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr* c = CMSG_FIRSTHDR(&mh);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(c), fds, nfds * sizeof(int));
+    }
+    ssize_t n;
+    while((n = sendmsg(sock, &mh, 0)) == -1 && errno == EINTR);
+    if(n < 0) return -1;
+    /* the fds went with the first byte, the rest is plain data */
+    size_t done = n;
+    while(done < sizeof *m) {
+        n = send(sock, (const char*) m + done, sizeof *m - done, 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+int handoff_recv(int sock, struct handoff_msg* m, int* fds, int maxfds) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    } ctl;
+    struct iovec iov = { .iov_base = m, .iov_len = sizeof *m };
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1,
+                         .msg_control = ctl.buf, .msg_controllen = sizeof ctl.buf };
+    ssize_t n;
+    while((n = recvmsg(sock, &mh, MSG_WAITALL)) == -1 && errno == EINTR);
+    if(n <= 0) return -1;
+    int nfds = 0;
+    struct cmsghdr* c;
+    for(c = CMSG_FIRSTHDR(&mh); c; c = CMSG_NXTHDR(&mh, c)) {
+        if(c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        int i, cnt = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for(i = 0; i < cnt; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof fd);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            if(nfds < maxfds) fds[nfds++] = fd;
+            else close(fd);
+        }
+    }
+    size_t done = n;
+    while(done < sizeof *m) {
+        n = recv(sock, (char*) m + done, sizeof *m - done, MSG_WAITALL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) goto fail;
+        done += n;
+    }
+    if(m->version != HANDOFF_VERSION) goto fail;
+    return nfds;
+fail:
+    while(nfds) close(fds[--nfds]);
+    return -1;
+}
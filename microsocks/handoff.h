@@ -0,0 +1,51 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+#include "stats.h"
+
+/* zero-downtime upgrades.
+   the running process listens on a unix socket. a new process started
+   with the same path connects and says hello, gets every listening socket
+   with SCM_RIGHTS, starts serving on them and answers ready. only then
+   does the old process stop accepting; from there on, tunnels that are
+   relaying tcp (or get there later) are passed over as client/target fd
+   pairs with what the new process needs to account for them. handshakes
+   and udp associations finish in the old process, which says end and
+   exits once the last of its connections is gone.
+   every message is one fixed size struct, fds ride along with it. */
+
+#define HANDOFF_VERSION 1
+
+enum handoff_kind {
+    HANDOFF_HELLO = 1,   /* new -> old */
+    HANDOFF_LISTENER,    /* old -> new, 1 fd */
+    HANDOFF_LISTENERS_DONE,
+    HANDOFF_READY,       /* new -> old */
+    HANDOFF_TUNNEL,      /* old -> new, client and target fd */
+    HANDOFF_END,
+};
+
+struct handoff_msg {
+    uint32_t version;
+    uint32_t kind;
+    char listener[STATS_LISTENER_NAME_LEN]; /* "ip:port" */
+    /* tunnels only */
+    uint64_t id;
+    uint64_t age_ns;     /* since the client connected */
+    uint64_t bytes[2];
+    char client[256];
+    char user[256];
+    char target[512];
+};
+
+/* returns a listening socket bound to path, replacing a stale one */
+int handoff_listen(const char* path);
+/* returns a connected socket, -1 if nobody listens on path */
+int handoff_connect(const char* path);
+int handoff_send(int sock, const struct handoff_msg* m, const int* fds, int nfds);
+/* returns the number of fds received into fds, -1 on error or eof and
+   for messages of another version */
+int handoff_recv(int sock, struct handoff_msg* m, int* fds, int maxfds);
+
+#endif
@@ -0,0 +1,68 @@
+#include "hist.h"
+#include <string.h>
+
+static unsigned hist_index(uint64_t v) {
+    if(v >= (1ULL << HIST_MAX_BITS)) v = (1ULL << HIST_MAX_BITS) - 1;
+    if(v < HIST_SUB) return v;
+    unsigned e = 63 - __builtin_clzll(v);
+    unsigned sub = (v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+uint64_t hist_bucket_upper(unsigned idx) {
+    if(idx < HIST_SUB) return idx;
+    unsigned e = idx / HIST_SUB + HIST_SUB_BITS - 1;
+    unsigned sub = idx % HIST_SUB;
+    return ((uint64_t)(HIST_SUB + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+static unsigned my_shard(void) {
+    static unsigned next;
+    static __thread unsigned shard_plus1;
+    if(!shard_plus1)
+        shard_plus1 = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) % HIST_SHARDS + 1;
+    return shard_plus1 - 1;
+}
+
+void hist_shard_record(struct hist_shard *h, uint64_t val) {
+    __atomic_fetch_add(&h->counts[hist_index(val)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, val, __ATOMIC_RELAXED);
+}
+
+void hist_record(struct hist *h, uint64_t usec) {
+    hist_shard_record(&h->shard[my_shard()], usec);
+}
+
+static void merge_shard(struct hist_shard *h, struct hist_snapshot *out) {
+    unsigned i;
+    for(i = 0; i < HIST_BUCKETS; i++) {
+        uint64_t c = __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+        out->counts[i] += c;
+        out->count += c;
+    }
+    out->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+}
+
+void hist_shard_merge(struct hist_shard *h, struct hist_snapshot *out) {
+    memset(out, 0, sizeof *out);
+    merge_shard(h, out);
+}
+
+void hist_merge(struct hist *h, struct hist_snapshot *out) {
+    unsigned s;
+    memset(out, 0, sizeof *out);
+    for(s = 0; s < HIST_SHARDS; s++)
+        merge_shard(&h->shard[s], out);
+}
+
+uint64_t hist_quantile(const struct hist_snapshot *s, double q) {
+    if(!s->count) return 0;
+    uint64_t rank = q * s->count, seen = 0;
+    if(rank >= s->count) rank = s->count - 1;
+    unsigned i;
+    for(i = 0; i < HIST_BUCKETS; i++) {
+        seen += s->counts[i];
+        if(seen > rank) return hist_bucket_upper(i);
+    }
+    return hist_bucket_upper(HIST_BUCKETS - 1);
+}
@@ -0,0 +1,44 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+/* log-linear (hdr style) histogram, mostly used for latencies in microseconds.
+   values below 2^HIST_SUB_BITS get a bucket each, above that every power
+   of two is split into 2^HIST_SUB_BITS linear sub-buckets, so the relative
+   error stays below 1/2^HIST_SUB_BITS over the whole range.
+   writers pick a shard per thread and do relaxed atomic increments, readers
+   merge all shards into a snapshot; neither side locks. */
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 32 /* ~71 minutes, larger values are clamped */
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+#define HIST_SHARDS 8
+
+struct hist_shard {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t sum;
+};
+
+struct hist {
+    struct hist_shard shard[HIST_SHARDS];
+};
+
+struct hist_snapshot {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+};
+
+void hist_record(struct hist *h, uint64_t usec);
+void hist_merge(struct hist *h, struct hist_snapshot *out);
+/* a single shard works as an unsharded histogram for values that are
+   recorded rarely enough that contention does not matter. */
+void hist_shard_record(struct hist_shard *h, uint64_t val);
+void hist_shard_merge(struct hist_shard *h, struct hist_snapshot *out);
+/* largest value that still lands in bucket idx */
+uint64_t hist_bucket_upper(unsigned idx);
+uint64_t hist_quantile(const struct hist_snapshot *s, double q);
+
+#endif
@@ -0,0 +1,103 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#include "logring.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* every slot carries its own seqlock: the state is 2*(seq+1) once record
+   seq is complete and one less while it is being written. a reader that
+   sees a higher state than it expects knows the record was overwritten.
+   two writers only collide on one slot if the ring wraps around during a
+   single write. */
+struct slot {
+    uint64_t state;
+    uint64_t time_ns;
+    uint32_t tag;
+    char msg[LOGRING_MSG_LEN];
+};
+
+struct ring {
+    uint64_t head;
+    struct slot slots[LOGRING_SLOTS];
+};
+
+static struct ring storage, *ring = &storage;
+static __thread uint32_t thread_tag;
+
+void logring_set_tag(uint32_t tag) {
+    thread_tag = tag;
+}
+
+void logring_write(const char* msg) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t seq = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    struct slot *s = &ring->slots[seq & (LOGRING_SLOTS - 1)];
+    __atomic_store_n(&s->state, (seq + 1) * 2 - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->time_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    s->tag = thread_tag;
+    size_t len = strlen(msg);
+    if(len >= sizeof s->msg) len = sizeof s->msg - 1;
+    while(len && msg[len - 1] == '\n') len--;
+    memcpy(s->msg, msg, len);
+    s->msg[len] = 0;
+    __atomic_store_n(&s->state, (seq + 1) * 2, __ATOMIC_RELEASE);
+}
+
+void logring_printf(const char* fmt, ...) {
+    char buf[LOGRING_MSG_LEN];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof buf, fmt, ap);
+    va_end(ap);
+    logring_write(buf);
+}
+
+size_t logring_read(uint64_t *cursor, struct logring_entry *out, size_t n, uint64_t *lost) {
+    uint64_t end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), skipped = 0;
+    size_t got = 0;
+    if(*cursor > end) *cursor = end;
+    if(end - *cursor > LOGRING_SLOTS) {
+        skipped += end - LOGRING_SLOTS - *cursor;
+        *cursor = end - LOGRING_SLOTS;
+    }
+    while(got < n && *cursor < end) {
+        struct slot *s = &ring->slots[*cursor & (LOGRING_SLOTS - 1)];
+        uint64_t want = (*cursor + 1) * 2;
+        uint64_t st = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+        /* still being written, pick it up on the next poll */
+        if(st < want) break;
+        if(st == want) {
+            out[got].time_ns = s->time_ns;
+            out[got].tag = s->tag;
+            memcpy(out[got].msg, s->msg, sizeof out[got].msg);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if(__atomic_load_n(&s->state, __ATOMIC_RELAXED) == want) {
+                out[got].msg[sizeof out[got].msg - 1] = 0;
+                out[got].seq = *cursor;
+                got++;
+            } else skipped++;
+        } else skipped++;
+        ++*cursor;
+    }
+    if(lost) *lost += skipped;
+    return got;
+}
+
+int logring_share(void) {
+    void *p = mmap(0, sizeof *ring, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED) return -1;
+    memcpy(p, ring, sizeof *ring);
+    ring = p;
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef LOGRING_H
+#define LOGRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* fixed size ring of log records.
+   writers (any thread) claim a sequence number with one atomic add and
+   never wait; readers poll with a cursor and get everything that was
+   logged since, in order. records that were overwritten before a reader
+   got to them are skipped and counted as lost. */
+
+#define LOGRING_SLOTS 1024 /* power of two */
+#define LOGRING_MSG_LEN 240
+
+struct logring_entry {
+    uint64_t seq;
+    uint64_t time_ns; /* CLOCK_REALTIME */
+    uint32_t tag;     /* see logring_set_tag() */
+    char msg[LOGRING_MSG_LEN];
+};
+
+/* records written by the calling thread from now on carry tag, so readers
+   can tell apart what several embedded instances logged. default 0. */
+void logring_set_tag(uint32_t tag);
+void logring_write(const char* msg);
+void logring_printf(const char* fmt, ...);
+/* copies up to n records starting at *cursor (0 for the oldest one still
+   around) into out and moves *cursor past them. returns the number of
+   records copied, lost (if non-NULL) is increased by the number skipped. */
+size_t logring_read(uint64_t *cursor, struct logring_entry *out, size_t n, uint64_t *lost);
+
+/* moves the ring into memory that stays shared across fork(), so prefork
+   children log into the supervisor's ring. call before other threads run. */
+int logring_share(void);
+
+#endif
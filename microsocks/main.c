@@ -0,0 +1,5 @@
+#include "microsocks.h"
+
+int main(int argc, char** argv) {
+    return socks_main(argc, argv);
+}
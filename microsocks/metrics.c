@@ -0,0 +1,418 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "metrics.h"
+#include "server.h"
+#include "stats.h"
+#include "conntab.h"
+#include "logring.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+struct outbuf {
+    char* data;
+    size_t len;
+    size_t capa;
+};
+
+static void out_printf(struct outbuf *o, const char* fmt, ...) {
+    va_list ap;
+    for(;;) {
+        size_t avail = o->capa - o->len;
+        va_start(ap, fmt);
+        int n = vsnprintf(o->data ? o->data + o->len : 0, avail, fmt, ap);
+        va_end(ap);
+        if(n < 0) return;
+        if((size_t) n < avail) {
+            o->len += n;
+            return;
+        }
+        size_t capa = o->capa ? o->capa * 2 : 4096;
+        while(capa - o->len <= (size_t) n) capa *= 2;
+        char* p = realloc(o->data, capa);
+        if(!p) return; /* truncated output, better than nothing */
+        o->data = p;
+        o->capa = capa;
+    }
+}
+
+static const char* ec_names[STATS_NUM_ERRORCODES] = {
+    "success", "general_failure", "not_allowed", "net_unreachable",
+    "host_unreachable", "conn_refused", "ttl_expired",
+    "command_not_supported", "addresstype_not_supported",
+    "bind_ip_not_provided",
+};
+
+static const char* dir_names[2] = { "upload", "download" };
+static const char* slab_names[STATS_SLAB_COUNT] = { "conn", "flow" };
+
+static void header(struct outbuf *o, const char* name, const char* type, const char* help) {
+    out_printf(o, "# HELP microsocks_%s %s\n# TYPE microsocks_%s %s\n", name, help, name, type);
+}
+
+static const struct {
+    const char* name;
+    const char* help;
+} lat_names[STATS_LAT_COUNT] = {
+    [STATS_LAT_HANDSHAKE] = { "handshake", "Time from client greeting to request." },
+    [STATS_LAT_RESOLVE] = { "resolve", "Target name resolution time." },
+    [STATS_LAT_CONNECT] = { "connect", "Target connect time." },
+    [STATS_LAT_FIRST_UP] = { "first_upstream_byte", "Time from tunnel setup to the first byte from the client." },
+    [STATS_LAT_FIRST_DOWN] = { "first_downstream_byte", "Time from tunnel setup to the first byte from the target." },
+};
+
+/* the fine grained buckets are folded into power of two boundaries,
+   which line up exactly with the log-linear bucket edges.
+   scale converts the recorded unit into the exported one. */
+static void render_hist(struct outbuf *o, const char* name, const char* labels,
+                        struct hist_snapshot *snap, double scale) {
+    unsigned i, b;
+    uint64_t cum = 0;
+    const char* sep = *labels ? "," : "";
+    for(i = 0, b = 0; b <= HIST_MAX_BITS; b++) {
+        uint64_t le = (1ULL << b) - 1;
+        for(; i < HIST_BUCKETS && hist_bucket_upper(i) <= le; i++)
+            cum += snap->counts[i];
+        out_printf(o, "microsocks_%s_bucket{%s%sle=\"%g\"} %llu\n",
+            name, labels, sep, (le + 1) * scale, (unsigned long long) cum);
+    }
+    out_printf(o, "microsocks_%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long) snap->count);
+    out_printf(o, "microsocks_%s_sum{%s} %g\n", name, labels, snap->sum * scale);
+    out_printf(o, "microsocks_%s_count{%s} %llu\n", name, labels, (unsigned long long) snap->count);
+}
+
+static void render_quantiles(struct outbuf *o, const char* name, const char* labels,
+                             struct hist_snapshot *snap, double scale) {
+    static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+    const char* sep = *labels ? "," : "";
+    unsigned i;
+    for(i = 0; i < sizeof qs / sizeof qs[0]; i++)
+        out_printf(o, "microsocks_%s_quantile{%s%squantile=\"%g\"} %g\n",
+            name, labels, sep, qs[i], hist_quantile(snap, qs[i]) * scale);
+}
+
+static const struct {
+    const char* name;
+    const char* help;
+    double scale;
+} tcpinfo_names[TCPINFO_COUNT] = {
+    [TCPINFO_RTT] = { "tcp_rtt_seconds", "Sampled smoothed TCP round trip time.", 1e-6 },
+    [TCPINFO_RETRANS] = { "tcp_retransmits", "Sampled retransmitted segments per connection.", 1 },
+    [TCPINFO_CWND] = { "tcp_cwnd_segments", "Sampled TCP congestion window.", 1 },
+    [TCPINFO_RATE] = { "tcp_delivery_rate_bytes", "Sampled TCP delivery rate in bytes per second.", 1 },
+};
+
+#if CONFIG_SYSCALL_STATS || CONFIG_PHASE_CPU
+/* tcp and udp bytes relayed since start, the base of the per-MiB ratios */
+static uint64_t relayed_bytes(void) {
+    uint64_t n = 0;
+    unsigned i;
+    for(i = 0; i < 2; i++) n += STATS_GET(bytes[i]) + STATS_GET(udp_bytes[i]);
+    return n;
+}
+
+static uint64_t accepted_conns(unsigned nl) {
+    uint64_t n = 0;
+    unsigned i;
+    for(i = 0; i < nl; i++) n += STATS_GET(listeners[i].accepted);
+    return n;
+}
+#endif
+
+static void render_metrics(struct outbuf *o) {
+    unsigned i, nl = __atomic_load_n(&stats->n_listeners, __ATOMIC_ACQUIRE);
+
+    header(o, "connections_accepted_total", "counter", "Accepted client connections.");
+    for(i = 0; i < nl; i++)
+        out_printf(o, "microsocks_connections_accepted_total{listener=\"%s\"} %llu\n",
+            stats->listeners[i].name, (unsigned long long) STATS_GET(listeners[i].accepted));
+    header(o, "connections_rejected_total", "counter", "Client connections that failed to accept or were refused due to OOM or max_conns.");
+    for(i = 0; i < nl; i++)
+        out_printf(o, "microsocks_connections_rejected_total{listener=\"%s\"} %llu\n",
+            stats->listeners[i].name, (unsigned long long) STATS_GET(listeners[i].rejected));
+    header(o, "connections_active", "gauge", "Client connections currently being served.");
+    for(i = 0; i < nl; i++)
+        out_printf(o, "microsocks_connections_active{listener=\"%s\"} %llu\n",
+            stats->listeners[i].name, (unsigned long long) STATS_GET(listeners[i].active));
+    header(o, "connections_open", "gauge", "Client connections of all listeners, as limited by max_conns.");
+    out_printf(o, "microsocks_connections_open %llu\n", (unsigned long long) STATS_GET(conns_active));
+
+    unsigned nc = STATS_GET(n_children);
+    if(nc) {
+        header(o, "prefork_child_pid", "gauge", "Process id of each prefork child, 0 while it is restarted.");
+        for(i = 0; i < nc; i++)
+            out_printf(o, "microsocks_prefork_child_pid{child=\"%u\"} %llu\n",
+                i, (unsigned long long) STATS_GET(children[i].pid));
+        header(o, "prefork_child_restarts_total", "counter", "Prefork children that died and were started again.");
+        for(i = 0; i < nc; i++)
+            out_printf(o, "microsocks_prefork_child_restarts_total{child=\"%u\"} %llu\n",
+                i, (unsigned long long) STATS_GET(children[i].restarts));
+        header(o, "prefork_child_connections_open", "gauge", "Client connections served by each prefork child.");
+        for(i = 0; i < nc; i++)
+            out_printf(o, "microsocks_prefork_child_connections_open{child=\"%u\"} %llu\n",
+                i, (unsigned long long) STATS_GET(children[i].conns_active));
+    }
+
+    header(o, "handshakes_total", "counter", "Finished SOCKS5 handshakes by reply code.");
+    for(i = 0; i < STATS_NUM_ERRORCODES; i++)
+        out_printf(o, "microsocks_handshakes_total{result=\"%s\"} %llu\n",
+            ec_names[i], (unsigned long long) STATS_GET(handshakes[i]));
+
+    header(o, "relay_bytes_total", "counter", "Bytes relayed over TCP tunnels.");
+    for(i = 0; i < 2; i++)
+        out_printf(o, "microsocks_relay_bytes_total{direction=\"%s\"} %llu\n",
+            dir_names[i], (unsigned long long) STATS_GET(bytes[i]));
+
+    header(o, "udp_packets_total", "counter", "Datagrams relayed over UDP associations.");
+    for(i = 0; i < 2; i++)
+        out_printf(o, "microsocks_udp_packets_total{direction=\"%s\"} %llu\n",
+            dir_names[i], (unsigned long long) STATS_GET(udp_packets[i]));
+    header(o, "udp_bytes_total", "counter", "Payload bytes relayed over UDP associations.");
+    for(i = 0; i < 2; i++)
+        out_printf(o, "microsocks_udp_bytes_total{direction=\"%s\"} %llu\n",
+            dir_names[i], (unsigned long long) STATS_GET(udp_bytes[i]));
+    header(o, "udp_flows_total", "counter", "UDP target flows opened.");
+    out_printf(o, "microsocks_udp_flows_total %llu\n", (unsigned long long) STATS_GET(udp_flows));
+    header(o, "udp_flows_active", "gauge", "UDP target flows currently open.");
+    out_printf(o, "microsocks_udp_flows_active %llu\n", (unsigned long long) STATS_GET(udp_flows_active));
+
+    header(o, "slab_objects", "gauge", "Objects in use in the object caches.");
+    for(i = 0; i < STATS_SLAB_COUNT; i++)
+        out_printf(o, "microsocks_slab_objects{cache=\"%s\"} %llu\n",
+            slab_names[i], (unsigned long long) STATS_GET(slab_objects[i]));
+    header(o, "slab_capacity", "gauge", "Objects the chunks held by the object caches have room for.");
+    for(i = 0; i < STATS_SLAB_COUNT; i++)
+        out_printf(o, "microsocks_slab_capacity{cache=\"%s\"} %llu\n",
+            slab_names[i], (unsigned long long) STATS_GET(slab_capacity[i]));
+    header(o, "slab_bytes", "gauge", "Memory held by the object caches.");
+    for(i = 0; i < STATS_SLAB_COUNT; i++)
+        out_printf(o, "microsocks_slab_bytes{cache=\"%s\"} %llu\n",
+            slab_names[i], (unsigned long long) STATS_GET(slab_bytes[i]));
+
+    header(o, "dns_lookups_total", "counter", "Name resolutions performed for targets.");
+    out_printf(o, "microsocks_dns_lookups_total %llu\n", (unsigned long long) STATS_GET(dns_lookups));
+    header(o, "dns_failures_total", "counter", "Name resolutions that failed.");
+    out_printf(o, "microsocks_dns_failures_total %llu\n", (unsigned long long) STATS_GET(dns_failures));
+    header(o, "dns_lookup_seconds_total", "counter", "Time spent resolving target names.");
+    out_printf(o, "microsocks_dns_lookup_seconds_total %.9f\n", STATS_GET(dns_lookup_ns) / 1e9);
+
+    header(o, "accept_loop_lag_seconds", "gauge", "Time the accept loop spent away from accept() in its last iteration.");
+    out_printf(o, "microsocks_accept_loop_lag_seconds %.9f\n", STATS_GET(accept_lag_ns) / 1e9);
+    header(o, "accept_loop_lag_max_seconds", "gauge", "Longest time the accept loop spent away from accept().");
+    out_printf(o, "microsocks_accept_loop_lag_max_seconds %.9f\n", STATS_GET(accept_lag_max_ns) / 1e9);
+
+#if CONFIG_SYSCALL_STATS
+    static const char* sysc_names[STATS_SYSC_COUNT] = {
+        "read", "write", "wait", "spurious_wakeup", "eagain",
+    };
+    uint64_t relayed = relayed_bytes(), accepted = accepted_conns(nl);
+    uint64_t io = STATS_GET(syscalls[STATS_SYSC_READ]) + STATS_GET(syscalls[STATS_SYSC_WRITE]) +
+                  STATS_GET(syscalls[STATS_SYSC_WAIT]);
+    header(o, "relay_syscalls_total", "counter", "Syscalls and wakeups in the relay loops.");
+    for(i = 0; i < STATS_SYSC_COUNT; i++)
+        out_printf(o, "microsocks_relay_syscalls_total{kind=\"%s\"} %llu\n",
+            sysc_names[i], (unsigned long long) STATS_GET(syscalls[i]));
+    header(o, "relay_syscalls_per_mb", "gauge", "Reads, writes and poller waits per MiB relayed, since start.");
+    out_printf(o, "microsocks_relay_syscalls_per_mb %.3f\n", relayed ? io * 1048576.0 / relayed : 0.0);
+    header(o, "relay_wakeups_per_connection", "gauge", "Poller wakeups per accepted connection, since start.");
+    out_printf(o, "microsocks_relay_wakeups_per_connection %.3f\n",
+        accepted ? (double) STATS_GET(syscalls[STATS_SYSC_WAIT]) / accepted : 0.0);
+#endif
+
+#if CONFIG_PHASE_CPU
+    uint64_t cpu_relayed = relayed_bytes(), cpu_accepted = accepted_conns(nl);
+    header(o, "phase_cpu_seconds_total", "counter", "Thread cpu time spent per connection phase.");
+    for(i = 0; i < STATS_PHASE_COUNT; i++)
+        out_printf(o, "microsocks_phase_cpu_seconds_total{phase=\"%s\"} %.9f\n",
+            stats_phase_names[i], STATS_GET(phase_cpu_ns[i]) / 1e9);
+    header(o, "phase_cpu_ns_per_connection", "gauge", "Cpu nanoseconds per accepted connection and phase, since start.");
+    for(i = 0; i < STATS_PHASE_COUNT; i++)
+        out_printf(o, "microsocks_phase_cpu_ns_per_connection{phase=\"%s\"} %.1f\n",
+            stats_phase_names[i], cpu_accepted ? (double) STATS_GET(phase_cpu_ns[i]) / cpu_accepted : 0.0);
+    header(o, "phase_cpu_ns_per_mb", "gauge", "Cpu nanoseconds per MiB relayed (tcp and udp) and phase, since start.");
+    for(i = 0; i < STATS_PHASE_COUNT; i++)
+        out_printf(o, "microsocks_phase_cpu_ns_per_mb{phase=\"%s\"} %.1f\n",
+            stats_phase_names[i], cpu_relayed ? STATS_GET(phase_cpu_ns[i]) * 1048576.0 / cpu_relayed : 0.0);
+#endif
+
+    static struct hist_snapshot snap; /* only ever used from the metrics thread */
+    char name[128], labels[128];
+    unsigned m, leg;
+    for(i = 0; i < STATS_LAT_COUNT; i++) {
+        hist_merge(&stats->latency[i], &snap);
+        snprintf(name, sizeof name, "%s_seconds", lat_names[i].name);
+        header(o, name, "histogram", lat_names[i].help);
+        render_hist(o, name, "", &snap, 1e-6);
+        snprintf(name, sizeof name, "%s_seconds_quantile", lat_names[i].name);
+        header(o, name, "gauge", "Quantiles from the full resolution histogram.");
+        snprintf(name, sizeof name, "%s_seconds", lat_names[i].name);
+        render_quantiles(o, name, "", &snap, 1e-6);
+    }
+
+    header(o, "heartbeat_lag_seconds", "histogram", "How late the watchdog heartbeat woke up.");
+    hist_merge(&stats->heartbeat_lag, &snap);
+    render_hist(o, "heartbeat_lag_seconds", "", &snap, 1e-6);
+    header(o, "heartbeat_lag_max_seconds", "gauge", "Largest heartbeat delay seen.");
+    out_printf(o, "microsocks_heartbeat_lag_max_seconds %.9f\n", STATS_GET(heartbeat_lag_max_ns) / 1e9);
+    header(o, "poll_batch_events", "histogram", "Events returned per poller wakeup in the relay loops.");
+    hist_merge(&stats->poll_batch, &snap);
+    render_hist(o, "poll_batch_events", "", &snap, 1);
+    header(o, "callback_seconds", "histogram", "Time connection threads spent busy per wakeup, by phase.");
+    for(i = STATS_PHASE_HANDSHAKE; i < STATS_PHASE_COUNT; i++) {
+        hist_merge(&stats->callback[i], &snap);
+        snprintf(labels, sizeof labels, "phase=\"%s\"", stats_phase_names[i]);
+        render_hist(o, "callback_seconds", labels, &snap, 1e-6);
+    }
+    header(o, "callback_max_seconds", "gauge", "Longest single callback seen.");
+    out_printf(o, "microsocks_callback_max_seconds %.9f\n", STATS_GET(callback_max_ns) / 1e9);
+    header(o, "stalls_total", "counter", "Connections reported busy beyond the stall threshold, by phase.");
+    for(i = STATS_PHASE_HANDSHAKE; i < STATS_PHASE_COUNT; i++)
+        out_printf(o, "microsocks_stalls_total{phase=\"%s\"} %llu\n",
+            stats_phase_names[i], (unsigned long long) STATS_GET(stalls[i]));
+
+    for(m = 0; m < TCPINFO_COUNT; m++) {
+        header(o, tcpinfo_names[m].name, "histogram", tcpinfo_names[m].help);
+        for(i = 0; i < nl; i++) for(leg = 0; leg < 2; leg++) {
+            hist_shard_merge(&stats->listeners[i].tcpinfo[leg][m], &snap);
+            snprintf(labels, sizeof labels, "listener=\"%s\",leg=\"%s\"",
+                stats->listeners[i].name, leg == TCPINFO_CLIENT ? "client" : "target");
+            render_hist(o, tcpinfo_names[m].name, labels, &snap, tcpinfo_names[m].scale);
+        }
+    }
+}
+
+static void render_topk(struct outbuf *o) {
+    static const char* dims[STATS_TOPK_COUNT] = { "client", "user", "target" };
+    static struct topk_entry e[TOPK_SLOTS];
+    unsigned d, k, i, n;
+    for(k = 0; k < 2; k++) for(d = 0; d < STATS_TOPK_COUNT; d++) {
+        struct topk *t = k ? &stats->top_conns[d] : &stats->top_bytes[d];
+        out_printf(o, "# %s by %s (halved every %ds)\n", k ? "connections" : "bytes", dims[d], TOPK_HALFLIFE);
+        n = topk_query(t, e);
+        for(i = 0; i < n; i++)
+            if(e[i].count)
+                out_printf(o, "%20llu %20llu %s\n",
+                    (unsigned long long) e[i].count, (unsigned long long) e[i].error, e[i].key);
+        out_printf(o, "\n");
+    }
+}
+
+static void render_connections(struct outbuf *o) {
+    uint64_t now = stats_now_ns();
+    unsigned i, leg;
+    out_printf(o, "# id listener client target age_s bytes_up bytes_down phase busy_ms"
+        " [client|target rtt_us retrans cwnd rate_Bps]\n");
+    for(i = 0; i < CONNTAB_SLOTS; i++) {
+        struct conntab_slot *s = &conntab[i];
+        uint64_t id = __atomic_load_n(&s->id, __ATOMIC_ACQUIRE);
+        if(!id || id == CONNTAB_CLAIMING) continue;
+        out_printf(o, "%llu %d %s %s %.3f %llu %llu", (unsigned long long) id, s->listener,
+            s->client, s->target[0] ? s->target : "-", (now - s->start_ns) / 1e9,
+            (unsigned long long) __atomic_load_n(&s->bytes[0], __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&s->bytes[1], __ATOMIC_RELAXED));
+        uint64_t busy = __atomic_load_n(&s->busy_ns, __ATOMIC_RELAXED);
+        out_printf(o, " %s %llu", stats_phase_names[__atomic_load_n(&s->phase, __ATOMIC_RELAXED)],
+            (unsigned long long) (busy && now > busy ? (now - busy) / 1000000 : 0));
+        if(s->tcpinfo_ns) for(leg = 0; leg < 2; leg++)
+            out_printf(o, " %s %llu %llu %llu %llu", leg == TCPINFO_CLIENT ? "client" : "target",
+                (unsigned long long) s->tcpinfo[leg].v[TCPINFO_RTT],
+                (unsigned long long) s->tcpinfo[leg].v[TCPINFO_RETRANS],
+                (unsigned long long) s->tcpinfo[leg].v[TCPINFO_CWND],
+                (unsigned long long) s->tcpinfo[leg].v[TCPINFO_RATE]);
+        out_printf(o, "\n");
+    }
+}
+
+static void render_log(struct outbuf *o, uint64_t since) {
+    static struct logring_entry batch[64]; /* only ever used from the metrics thread */
+    uint64_t lost = 0;
+    size_t i, n;
+    while((n = logring_read(&since, batch, 64, &lost)))
+        for(i = 0; i < n; i++)
+            out_printf(o, "%llu %llu.%03llu %s\n", (unsigned long long) batch[i].seq,
+                (unsigned long long) (batch[i].time_ns / 1000000000ULL),
+                (unsigned long long) (batch[i].time_ns / 1000000 % 1000), batch[i].msg);
+    if(lost) out_printf(o, "# lost %llu\n", (unsigned long long) lost);
+    out_printf(o, "# next %llu\n", (unsigned long long) since);
+}
+
+static void reply(int fd, const char* status, struct outbuf *body) {
+    char hdr[256];
+    int n = snprintf(hdr, sizeof hdr,
+        "HTTP/1.0 %s\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n", status, body->len);
+    if(write(fd, hdr, n) != n) return;
+    size_t sent = 0;
+    while(sent < body->len) {
+        ssize_t m = write(fd, body->data + sent, body->len - sent);
+        if(m <= 0) return;
+        sent += m;
+    }
+}
+
+static void serve(int fd) {
+    char req[1024];
+    size_t n = 0;
+    /* we only care about the request line, the rest is drained by close. */
+    while(n < sizeof req - 1 && !memchr(req, '\n', n)) {
+        ssize_t m = read(fd, req + n, sizeof req - 1 - n);
+        if(m <= 0) return;
+        n += m;
+    }
+    req[n] = 0;
+
+    struct outbuf o = {0};
+    if(!strncmp(req, "GET /metrics ", 13) || !strncmp(req, "GET / ", 6)) {
+        render_metrics(&o);
+        reply(fd, "200 OK", &o);
+    } else if(!strncmp(req, "GET /connections ", 17)) {
+        render_connections(&o);
+        reply(fd, "200 OK", &o);
+    } else if(!strncmp(req, "GET /topk ", 10)) {
+        render_topk(&o);
+        reply(fd, "200 OK", &o);
+    } else if(!strncmp(req, "GET /log ", 9) || !strncmp(req, "GET /log?since=", 15)) {
+        render_log(&o, req[8] == '?' ? strtoull(req + 15, 0, 10) : 0);
+        reply(fd, "200 OK", &o);
+    } else {
+        out_printf(&o, "not found\n");
+        reply(fd, "404 Not Found", &o);
+    }
+    free(o.data);
+}
+
+static void* metrics_thread(void *data) {
+    struct server *s = data;
+    while(1) {
+        struct client c;
+        if(server_waitclient(s, &c)) {
+            sleep(1);
+            continue;
+        }
+        /* a stuck scraper must not block the next one forever */
+        struct timeval tv = { .tv_sec = 5 };
+        setsockopt(c.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+        setsockopt(c.fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+        serve(c.fd);
+        close(c.fd);
+    }
+    return 0;
+}
+
+int metrics_start(const char* listenip, unsigned short port) {
+    static struct server s;
+    if(server_setup(&s, listenip, port, 0)) return -1;
+    pthread_t pt;
+    if(pthread_create(&pt, 0, metrics_thread, &s)) {
+        close(s.fd);
+        return -1;
+    }
+    pthread_detach(pt);
+    return 0;
+}
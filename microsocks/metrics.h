@@ -0,0 +1,8 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/* serves the counters from stats.h in prometheus text format over plain
+   http on a separate (loopback) listener, from a thread of its own. */
+int metrics_start(const char* listenip, unsigned short port);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef MICROSOCKS_H
+#define MICROSOCKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* embedding api.
+   every instance serves one listener with its own credentials, any number
+   of instances can run in one process. the introspection services
+   (metrics endpoint, tracer, stats segment, watchdog) are process wide and
+   get started by the first instance that asks for them; counters are kept
+   per listener where it matters.
+   sinks are called from a per-instance thread every sink_interval_ms, never
+   from the connection threads, so they may block briefly or take locks. */
+
+struct microsocks;
+
+struct microsocks_log_record {
+    uint64_t seq;
+    uint64_t time_ns; /* CLOCK_REALTIME */
+    const char* msg;
+};
+
+struct microsocks_stats {
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t active;
+    uint64_t bytes[2]; /* upload, download; tcp and udp payload */
+};
+
+typedef void (*microsocks_log_sink)(void* ctx, const struct microsocks_log_record* recs, size_t n);
+typedef void (*microsocks_stats_sink)(void* ctx, const struct microsocks_stats* st);
+
+struct microsocks_config {
+    const char* listenip;          /* default 0.0.0.0 */
+    unsigned short port;           /* default 1080 */
+    int listen_fd;                 /* listening socket to serve instead of binding, default -1 */
+    int reuseport;                 /* bind with SO_REUSEPORT */
+    unsigned max_conns;            /* process wide (or prefork wide) cap, 0 for none */
+    const char* user;              /* user and pass go together */
+    const char* pass;
+    int auth_once;                 /* see -1 in the readme */
+    const char* allow;             /* client networks, "10.0.0.0/8 ::1"; NULL allows all */
+    /* process wide */
+    unsigned short metrics_port;   /* 0 disables */
+    const char* trace_path;
+    unsigned trace_every;
+    const char* capture_path;      /* tunnel shapes, see capture.h */
+    const char* stats_path;        /* NULL keeps the segment anonymous */
+    unsigned stall_ms;             /* 0 disables stall reports */
+    /* per instance */
+    microsocks_log_sink log_sink;
+    microsocks_stats_sink stats_sink;
+    void* sink_ctx;
+    unsigned sink_interval_ms;     /* default 1000 */
+};
+
+void microsocks_config_init(struct microsocks_config* cfg);
+/* returns NULL and sets errno on invalid configs or when out of resources */
+struct microsocks* microsocks_create(const struct microsocks_config* cfg);
+/* binds the listener and serves from background threads, 0 on success */
+int microsocks_start(struct microsocks* ms);
+/* blocks until the instance is stopped from another thread */
+void microsocks_wait(struct microsocks* ms);
+/* stops accepting, shuts down the live connections and waits for their
+   threads. the sinks get one last batch. */
+void microsocks_stop(struct microsocks* ms);
+void microsocks_destroy(struct microsocks* ms);
+
+/* replaces user, pass, auth_once and allow of a running instance, the
+   other fields of cfg are ignored. connections already accepted finish on
+   the settings they started with. -1 with errno set if cfg is invalid. */
+int microsocks_update(struct microsocks* ms, const struct microsocks_config* cfg);
+/* closes the listener but lets the live connections run to completion,
+   microsocks_active() tells when they are gone. */
+void microsocks_drain(struct microsocks* ms);
+unsigned microsocks_active(struct microsocks* ms);
+
+/* zero-downtime upgrades, handoff.h describes the exchange and reload.c
+   drives it for the command line. */
+struct handoff_msg;
+/* passes a copy of the listening socket to the process on sock */
+int microsocks_send_listener(struct microsocks* ms, int sock);
+/* stops accepting. with sock other than -1, tunnels that are relaying tcp
+   or get there later move to the process on sock, the rest finish here. */
+void microsocks_handoff(struct microsocks* ms, int sock);
+/* takes over a tunnel another process sent, 0 on success */
+int microsocks_adopt(struct microsocks* ms, const struct handoff_msg* m, int client_fd, int target_fd);
+
+/* the command line frontend on top of the above, never returns on success */
+int socks_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,105 @@
+#include "policy.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int parse_net(const char* s, size_t len, struct policy_net* net) {
+    char buf[INET6_ADDRSTRLEN + 8], *slash;
+    if(len >= sizeof buf) return -1;
+    memcpy(buf, s, len);
+    buf[len] = 0;
+    if((slash = strchr(buf, '/'))) *slash++ = 0;
+    memset(net, 0, sizeof *net);
+    if(inet_pton(AF_INET, buf, net->addr) == 1) net->af = AF_INET;
+    else if(inet_pton(AF_INET6, buf, net->addr) == 1) net->af = AF_INET6;
+    else return -1;
+    unsigned max = net->af == AF_INET ? 32 : 128;
+    net->prefix = max;
+    if(slash) {
+        char* end;
+        unsigned long p = strtoul(slash, &end, 10);
+        if(!*slash || *end || p > max) return -1;
+        net->prefix = p;
+    }
+    return 0;
+}
+
+struct policy* policy_new(const char* user, const char* pass, int auth_once, const char* allow) {
+    static const char sep[] = ", \t";
+    size_t n = 0;
+    const char* s;
+    for(s = allow ? allow + strspn(allow, sep) : ""; *s; s += strspn(s, sep)) {
+        s += strcspn(s, sep);
+        n++;
+    }
+    struct policy* p = calloc(1, sizeof *p + n * sizeof p->allow[0]);
+    if(!p) return 0;
+    p->refs = 1;
+    p->auth_once = auth_once;
+    if((user && !(p->user = strdup(user))) || (pass && !(p->pass = strdup(pass)))) {
+        policy_unref(p);
+        return 0;
+    }
+    for(s = allow ? allow + strspn(allow, sep) : ""; *s; s += strspn(s, sep)) {
+        size_t len = strcspn(s, sep);
+        if(parse_net(s, len, &p->allow[p->n_allow++])) {
+            policy_unref(p);
+            errno = EINVAL;
+            return 0;
+        }
+        s += len;
+    }
+    return p;
+}
+
+void policy_unref(struct policy* p) {
+    if(!p || __atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL)) return;
+    free(p->user);
+    free(p->pass);
+    free(p);
+}
+
+int policy_allows(const struct policy* p, const union sockaddr_union* addr) {
+    size_t i;
+    if(!p->n_allow) return 1;
+    int af = SOCKADDR_UNION_AF(addr);
+    const unsigned char* a = SOCKADDR_UNION_ADDRESS(addr);
+    for(i = 0; i < p->n_allow; i++) {
+        const struct policy_net* net = &p->allow[i];
+        if(net->af != af) continue;
+        unsigned full = net->prefix / 8, rest = net->prefix % 8;
+        if(memcmp(a, net->addr, full)) continue;
+        if(rest && ((a[full] ^ net->addr[full]) & (0xff00 >> rest) & 0xff)) continue;
+        return 1;
+    }
+    return 0;
+}
+
+/* readers announce themselves in the counter of the current generation's
+   parity for the few instructions between loading the pointer and taking
+   the reference. the publisher flips the generation after swapping the
+   pointer and waits for the old parity to drain; whoever arrives after
+   the flip sees the new generation and loads the new pointer. */
+struct policy* policy_acquire(struct policy_slot* slot) {
+    unsigned g;
+    for(;;) {
+        g = __atomic_load_n(&slot->gen, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&slot->readers[g & 1], 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&slot->gen, __ATOMIC_SEQ_CST) == g) break;
+        __atomic_fetch_sub(&slot->readers[g & 1], 1, __ATOMIC_SEQ_CST);
+    }
+    struct policy* p = __atomic_load_n(&slot->cur, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&p->refs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&slot->readers[g & 1], 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+void policy_publish(struct policy_slot* slot, struct policy* p) {
+    struct policy* old = __atomic_exchange_n(&slot->cur, p, __ATOMIC_SEQ_CST);
+    unsigned g = __atomic_fetch_add(&slot->gen, 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&slot->readers[g & 1], __ATOMIC_ACQUIRE))
+        sched_yield();
+    policy_unref(old);
+}
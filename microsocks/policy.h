@@ -0,0 +1,48 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stddef.h>
+#include "server.h"
+
+/* the reloadable part of an instance's configuration: credentials,
+   auth-once and the client allow list.
+   a connection takes a reference to the current snapshot when it starts
+   and keeps using it until it closes, so a reload never changes the rules
+   under a running tunnel. publishing swaps the pointer and waits out a
+   grace period in which readers may still be between loading the pointer
+   and taking their reference, readers themselves never lock. */
+
+struct policy_net {
+    int af;
+    unsigned char addr[16];
+    unsigned prefix;
+};
+
+struct policy {
+    unsigned refs;
+    char* user;      /* NULL for no authentication */
+    char* pass;
+    int auth_once;
+    size_t n_allow;  /* 0 allows every client */
+    struct policy_net allow[];
+};
+
+struct policy_slot {
+    struct policy* cur;
+    unsigned gen;
+    unsigned readers[2];
+};
+
+/* allow is a list of addr/prefix networks separated by commas or spaces,
+   NULL or empty for no restriction. returns NULL with errno set. */
+struct policy* policy_new(const char* user, const char* pass, int auth_once, const char* allow);
+void policy_unref(struct policy* p);
+int policy_allows(const struct policy* p, const union sockaddr_union* addr);
+
+/* returns the current snapshot with a reference taken */
+struct policy* policy_acquire(struct policy_slot* slot);
+/* installs p, which must come with one reference for the slot, and drops
+   the slot's reference on the previous snapshot */
+void policy_publish(struct policy_slot* slot, struct policy* p);
+
+#endif
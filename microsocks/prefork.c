@@ -0,0 +1,152 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "prefork.h"
+#include "reload.h"
+#include "stats.h"
+#include "logring.h"
+#include "metrics.h"
+#include "shmstats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* children that die sooner than this after being started are restarted
+   only after the same delay, so a broken config doesn't spin */
+#define PREFORK_BACKOFF_NS 1000000000ULL
+
+struct child {
+    pid_t pid;            /* 0 while waiting to be restarted */
+    uint64_t started_ns;
+    uint64_t restart_ns;
+};
+
+static int sig_pipe[2] = {-1, -1};
+
+static void on_signal(int sig) {
+    int e = errno;
+    unsigned char c = sig;
+    if(write(sig_pipe[1], &c, 1)) {}
+    errno = e;
+}
+
+static void spawn(struct child* ch, int idx, const char* conffile, const struct microsocks_config* base) {
+    pid_t pid = fork();
+    if(pid == -1) {
+        logring_printf("prefork: fork: %s", strerror(errno));
+        ch->restart_ns = stats_now_ns() + PREFORK_BACKOFF_NS;
+        return;
+    }
+    if(pid) {
+        ch->pid = pid;
+        ch->started_ns = stats_now_ns();
+        STATS_SET(children[idx].pid, pid);
+        return;
+    }
+    /* until reload_run installs its own handlers, a signal would go to
+       on_signal and into whatever fd now has sig_pipe's number */
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    close(sig_pipe[0]);
+    close(sig_pipe[1]);
+    stats_child = idx;
+    /* the supervisor serves metrics and the stats segment for everyone */
+    struct microsocks_config cfg = *base;
+    char trace[4096], capture[4096];
+    cfg.metrics_port = 0;
+    cfg.stats_path = 0;
+    cfg.reuseport = 1;
+    if(cfg.trace_path) {
+        snprintf(trace, sizeof trace, "%s.%d", base->trace_path, idx);
+        cfg.trace_path = trace;
+    }
+    if(cfg.capture_path) {
+        snprintf(capture, sizeof capture, "%s.%d", base->capture_path, idx);
+        cfg.capture_path = capture;
+    }
+    _exit(reload_run(conffile, 0, &cfg));
+}
+
+static void reap(struct child* ch, unsigned n, int stopping) {
+    pid_t pid;
+    int st;
+    unsigned i;
+    while((pid = waitpid(-1, &st, WNOHANG)) > 0) {
+        for(i = 0; i < n && ch[i].pid != pid; i++);
+        if(i == n) continue;
+        stats_child_reap(i, pid);
+        STATS_SET(children[i].pid, 0);
+        ch[i].pid = 0;
+        if(stopping) continue;
+        char why[32];
+        if(WIFSIGNALED(st)) snprintf(why, sizeof why, "killed by signal %d", WTERMSIG(st));
+        else snprintf(why, sizeof why, "exited with %d", WEXITSTATUS(st));
+        logring_printf("prefork: child %u (pid %d) %s, restarting", i, (int) pid, why);
+        dprintf(2, "child %u (pid %d) %s, restarting\n", i, (int) pid, why);
+        STATS_ADD(children[i].restarts, 1);
+        uint64_t now = stats_now_ns();
+        ch[i].restart_ns = now - ch[i].started_ns < PREFORK_BACKOFF_NS ? now + PREFORK_BACKOFF_NS : now;
+    }
+}
+
+int prefork_run(unsigned n, const char* conffile, const struct microsocks_config* base) {
+    struct child ch[STATS_MAX_CHILDREN];
+    unsigned i;
+    if(n > STATS_MAX_CHILDREN) n = STATS_MAX_CHILDREN;
+    if(stats_share() || logring_share() || pipe(sig_pipe)) {
+        perror("prefork");
+        return 1;
+    }
+    if(base->metrics_port && metrics_start("127.0.0.1", base->metrics_port)) {
+        perror("metrics_start");
+        return 1;
+    }
+    if(shmstats_start(base->stats_path)) {
+        perror("shmstats_start");
+        return 1;
+    }
+    fcntl(sig_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sig_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(sig_pipe[1], F_SETFL, O_NONBLOCK);
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, 0);
+    sigaction(SIGHUP, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    sigaction(SIGINT, &sa, 0);
+
+    memset(ch, 0, sizeof ch);
+    STATS_SET(n_children, n);
+    for(i = 0; i < n; i++) spawn(&ch[i], i, conffile, base);
+    logring_printf("prefork: started %u children", n);
+
+    for(;;) {
+        struct pollfd pfd = { .fd = sig_pipe[0], .events = POLLIN };
+        unsigned char sig = 0;
+        if(poll(&pfd, 1, 1000) == 1 && read(sig_pipe[0], &sig, 1) == 1) {
+            if(sig == SIGTERM || sig == SIGINT) break;
+            if(sig == SIGHUP)
+                for(i = 0; i < n; i++) if(ch[i].pid) kill(ch[i].pid, SIGHUP);
+        }
+        reap(ch, n, 0);
+        uint64_t now = stats_now_ns();
+        for(i = 0; i < n; i++)
+            if(!ch[i].pid && now >= ch[i].restart_ns) spawn(&ch[i], i, conffile, base);
+    }
+
+    for(i = 0; i < n; i++) if(ch[i].pid) kill(ch[i].pid, SIGTERM);
+    for(i = 0; i < n; i++) if(ch[i].pid) {
+        while(waitpid(ch[i].pid, 0, 0) == -1 && errno == EINTR);
+        stats_child_reap(i, ch[i].pid);
+        STATS_SET(children[i].pid, 0);
+    }
+    return 0;
+}
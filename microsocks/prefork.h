@@ -0,0 +1,18 @@
+#ifndef PREFORK_H
+#define PREFORK_H
+
+#include "microsocks.h"
+
+/* multi-process mode.
+   the supervisor forks n children that each bind the listeners with
+   SO_REUSEPORT and serve them like a single process would (see reload.h
+   for conffile), so the kernel spreads the connections over them and a
+   crash takes down only the tunnels of one child. counters, the log ring
+   and the max_conns limit live in shared memory; the supervisor serves
+   metrics and the stats segment for all of them, gives back the gauges a
+   dead child still held and starts a replacement. SIGHUP is passed on to
+   the children, SIGTERM and SIGINT stop everything. */
+
+int prefork_run(unsigned n, const char* conffile, const struct microsocks_config* base);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/* static (USDT) tracepoints on the connection lifecycle.
+   with systemtap's sys/sdt.h each probe compiles to a single nop plus an
+   ELF note, so they cost nothing until a tracer attaches, e.g.
+
+     bpftrace -e 'usdt:./microsocks:microsocks:relay { @[arg1] = sum(arg2); }'
+
+   without the header (or with -DCONFIG_USDT=0) they compile to nothing.
+   all probes take the connection id as first argument. */
+
+#ifndef CONFIG_USDT
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define CONFIG_USDT 1
+#endif
+#endif
+#endif
+
+#if CONFIG_USDT
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(microsocks, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(microsocks, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(microsocks, name, a, b, c)
+#else
+#define PROBE1(name, a) do {} while(0)
+#define PROBE2(name, a, b) do {} while(0)
+#define PROBE3(name, a, b, c) do {} while(0)
+#endif
+
+#endif
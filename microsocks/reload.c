@@ -0,0 +1,436 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "reload.h"
+#include "handoff.h"
+#include "policy.h"
+#include "logring.h"
+#include "sblist.h"
+#include "stats.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+struct conf_listen {
+    char ip[INET6_ADDRSTRLEN];
+    unsigned short port;
+};
+
+struct conf {
+    struct conf_listen listen[STATS_MAX_LISTENERS];
+    size_t n_listen;
+    char* user;
+    char* pass;
+    int auth_once;
+    char* allow;
+};
+
+struct inst {
+    struct conf_listen where;
+    struct microsocks* ms;
+    int draining;
+};
+
+/* listening sockets received from the previous process */
+struct inherited {
+    char name[STATS_LISTENER_NAME_LEN];
+    int fd;
+};
+
+static int sig_pipe[2] = {-1, -1};
+
+static void on_signal(int sig) {
+    int e = errno;
+    unsigned char c = sig;
+    if(write(sig_pipe[1], &c, 1)) {}
+    errno = e;
+}
+
+static void conf_free(struct conf* c) {
+    free(c->user);
+    free(c->pass);
+    free(c->allow);
+    memset(c, 0, sizeof *c);
+}
+
+static int parse_listen(const char* s, struct conf_listen* l) {
+    const char* colon;
+    size_t len;
+    if(*s == '[') {
+        const char* end = strchr(s, ']');
+        if(!end || end[1] != ':') return -1;
+        s++;
+        len = end - s;
+        colon = end + 1;
+    } else {
+        if(!(colon = strrchr(s, ':'))) return -1;
+        len = colon - s;
+    }
+    if(!len || len >= sizeof l->ip) return -1;
+    memcpy(l->ip, s, len);
+    l->ip[len] = 0;
+    char* end;
+    unsigned long port = strtoul(colon + 1, &end, 10);
+    if(!colon[1] || *end || !port || port > 65535) return -1;
+    l->port = port;
+    return 0;
+}
+
+static int set_str(char** dst, const char* val) {
+    free(*dst);
+    return (*dst = strdup(val)) ? 0 : -1;
+}
+
+/* on error the message goes to stderr and c is left empty */
+static int conf_load(const char* path, const struct microsocks_config* base, struct conf* c) {
+    memset(c, 0, sizeof *c);
+    FILE* f = 0;
+    if(path && !(f = fopen(path, "r"))) {
+        dprintf(2, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if(!path) path = "command line";
+    c->auth_once = base->auth_once;
+    if((base->user && set_str(&c->user, base->user)) ||
+       (base->pass && set_str(&c->pass, base->pass)) ||
+       (base->allow && set_str(&c->allow, base->allow)))
+        goto oom;
+    char line[1024];
+    unsigned lineno = 0;
+    while(f && fgets(line, sizeof line, f)) {
+        lineno++;
+        char *key = line, *val, *p;
+        if((p = strchr(line, '#'))) *p = 0;
+        while(isspace((unsigned char) *key)) key++;
+        for(p = key + strlen(key); p > key && isspace((unsigned char) p[-1]); p--) *(p-1) = 0;
+        if(!*key) continue;
+        for(val = key; *val && !isspace((unsigned char) *val); val++);
+        if(*val) *val++ = 0;
+        while(isspace((unsigned char) *val)) val++;
+
+        if(!strcmp(key, "listen")) {
+            if(c->n_listen == STATS_MAX_LISTENERS) {
+                dprintf(2, "%s:%u: more than %d listeners\n", path, lineno, STATS_MAX_LISTENERS);
+                goto fail;
+            }
+            if(parse_listen(val, &c->listen[c->n_listen++])) goto bad;
+        } else if(!strcmp(key, "user")) {
+            if(!*val) goto bad;
+            if(set_str(&c->user, val)) goto oom;
+        } else if(!strcmp(key, "pass")) {
+            if(!*val) goto bad;
+            if(set_str(&c->pass, val)) goto oom;
+        } else if(!strcmp(key, "auth_once")) {
+            if(*val) goto bad;
+            c->auth_once = 1;
+        } else if(!strcmp(key, "allow")) {
+            if(set_str(&c->allow, val)) goto oom;
+        } else {
+            dprintf(2, "%s:%u: unknown setting %s\n", path, lineno, key);
+            goto fail;
+        }
+        continue;
+    bad:
+        dprintf(2, "%s:%u: invalid value for %s\n", path, lineno, key);
+        goto fail;
+    }
+    if(f) fclose(f);
+    f = 0;
+    if(!c->n_listen) {
+        snprintf(c->listen[0].ip, sizeof c->listen[0].ip, "%s", base->listenip);
+        c->listen[0].port = base->port;
+        c->n_listen = 1;
+    }
+    if(!c->user != !c->pass || (c->auth_once && !c->pass)) {
+        dprintf(2, "%s: user and pass must be used together, auth_once needs both\n", path);
+        goto fail;
+    }
+    /* catch bad allow lists here rather than on every listener */
+    struct policy* p = policy_new(c->user, c->pass, c->auth_once, c->allow);
+    if(!p) {
+        dprintf(2, "%s: invalid allow list: %s\n", path, c->allow);
+        goto fail;
+    }
+    policy_unref(p);
+    return 0;
+oom:
+    dprintf(2, "%s: out of memory\n", path);
+fail:
+    if(f) fclose(f);
+    conf_free(c);
+    return -1;
+}
+
+static struct microsocks_config inst_config(const struct microsocks_config* base,
+                                            const struct conf* c, const struct conf_listen* l) {
+    struct microsocks_config cfg = *base;
+    cfg.listenip = l->ip;
+    cfg.port = l->port;
+    cfg.user = c->user;
+    cfg.pass = c->pass;
+    cfg.auth_once = c->auth_once;
+    cfg.allow = c->allow;
+    return cfg;
+}
+
+static int same_listen(const struct conf_listen* a, const struct conf_listen* b) {
+    return a->port == b->port && !strcmp(a->ip, b->ip);
+}
+
+static void apply(sblist* insts, const struct microsocks_config* base, const struct conf* c,
+                  struct inherited* inh, size_t n_inh) {
+    size_t i, j;
+    struct inst* in;
+    for(i = 0; i < sblist_getsize(insts); i++) {
+        in = sblist_get(insts, i);
+        if(in->draining) continue;
+        for(j = 0; j < c->n_listen && !same_listen(&in->where, &c->listen[j]); j++);
+        if(j == c->n_listen) {
+            logring_printf("reload: draining %s:%u", in->where.ip, in->where.port);
+            microsocks_drain(in->ms);
+            in->draining = 1;
+            continue;
+        }
+        struct microsocks_config cfg = inst_config(base, c, &in->where);
+        if(microsocks_update(in->ms, &cfg))
+            logring_printf("reload: %s:%u: %s", in->where.ip, in->where.port, strerror(errno));
+    }
+    for(j = 0; j < c->n_listen; j++) {
+        for(i = 0; i < sblist_getsize(insts); i++) {
+            in = sblist_get(insts, i);
+            if(!in->draining && same_listen(&in->where, &c->listen[j])) break;
+        }
+        if(i < sblist_getsize(insts)) continue;
+        struct inst n = { .where = c->listen[j] };
+        struct microsocks_config cfg = inst_config(base, c, &n.where);
+        char name[STATS_LISTENER_NAME_LEN];
+        snprintf(name, sizeof name, "%s:%u", n.where.ip, n.where.port);
+        for(i = 0; i < n_inh; i++) if(inh[i].fd != -1 && !strcmp(inh[i].name, name)) {
+            cfg.listen_fd = inh[i].fd;
+            inh[i].fd = -1;
+        }
+        if(!(n.ms = microsocks_create(&cfg)) || microsocks_start(n.ms) || !sblist_add(insts, &n)) {
+            if(!n.ms && cfg.listen_fd != -1) close(cfg.listen_fd);
+            logring_printf("reload: can't listen on %s:%u: %s", n.where.ip, n.where.port, strerror(errno));
+            dprintf(2, "can't listen on %s:%u: %s\n", n.where.ip, n.where.port, strerror(errno));
+            microsocks_destroy(n.ms);
+            continue;
+        }
+        logring_printf("reload: listening on %s:%u", n.where.ip, n.where.port);
+    }
+}
+
+static void reap(sblist* insts) {
+    size_t i;
+    for(i = 0; i < sblist_getsize(insts);) {
+        struct inst* in = sblist_get(insts, i);
+        if(in->draining && !microsocks_active(in->ms)) {
+            logring_printf("reload: %s:%u drained", in->where.ip, in->where.port);
+            microsocks_destroy(in->ms);
+            sblist_delete(insts, i);
+        } else i++;
+    }
+}
+
+static struct inst* find_inst(sblist* insts, const char* name) {
+    size_t i;
+    struct inst* first = 0;
+    for(i = 0; i < sblist_getsize(insts); i++) {
+        struct inst* in = sblist_get(insts, i);
+        char n[STATS_LISTENER_NAME_LEN];
+        if(in->draining) continue;
+        if(!first) first = in;
+        snprintf(n, sizeof n, "%s:%u", in->where.ip, in->where.port);
+        if(!strcmp(n, name)) return in;
+    }
+    return first;
+}
+
+static void set_timeout(int sock, int secs) {
+    struct timeval tv = { .tv_sec = secs };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+}
+
+static int send_kind(int sock, enum handoff_kind kind) {
+    struct handoff_msg m;
+    memset(&m, 0, sizeof m);
+    m.version = HANDOFF_VERSION;
+    m.kind = kind;
+    return handoff_send(sock, &m, 0, 0);
+}
+
+/* new process side: collects the listeners of the running process.
+   returns the number received, -1 if the exchange failed. */
+static int take_listeners(int sock, struct inherited* inh, size_t max) {
+    struct handoff_msg m;
+    int n = 0, fd;
+    set_timeout(sock, 10);
+    if(send_kind(sock, HANDOFF_HELLO)) return -1;
+    while(handoff_recv(sock, &m, &fd, 1) >= 0) {
+        if(m.kind == HANDOFF_LISTENERS_DONE) {
+            set_timeout(sock, 0);
+            return n;
+        }
+        if(m.kind != HANDOFF_LISTENER) break;
+        if((size_t) n == max) {
+            close(fd);
+            continue;
+        }
+        m.listener[sizeof m.listener - 1] = 0;
+        strcpy(inh[n].name, m.listener);
+        inh[n++].fd = fd;
+    }
+    while(n) close(inh[--n].fd);
+    return -1;
+}
+
+/* old process side: passes the listeners to the process that connected
+   and, once it is serving them, starts moving the tunnels over. */
+static int give_away(int sock, sblist* insts) {
+    struct handoff_msg m;
+    size_t i;
+    set_timeout(sock, 10);
+    if(handoff_recv(sock, &m, 0, 0) < 0 || m.kind != HANDOFF_HELLO) return -1;
+    for(i = 0; i < sblist_getsize(insts); i++) {
+        struct inst* in = sblist_get(insts, i);
+        if(!in->draining && microsocks_send_listener(in->ms, sock)) return -1;
+    }
+    if(send_kind(sock, HANDOFF_LISTENERS_DONE)) return -1;
+    /* until the new process answers, this one keeps accepting */
+    if(handoff_recv(sock, &m, 0, 0) < 0 || m.kind != HANDOFF_READY) return -1;
+    for(i = 0; i < sblist_getsize(insts); i++) {
+        struct inst* in = sblist_get(insts, i);
+        microsocks_handoff(in->ms, sock);
+        in->draining = 1;
+    }
+    return 0;
+}
+
+int reload_run(const char* path, const char* handoff_path, const struct microsocks_config* base) {
+    struct conf c;
+    struct inherited inh[STATS_MAX_LISTENERS];
+    int n_inh = 0;
+    if(conf_load(path, base, &c)) return 1;
+    sblist* insts = sblist_new(sizeof (struct inst), 8);
+    if(!insts || pipe(sig_pipe)) {
+        perror("reload");
+        conf_free(&c);
+        return 1;
+    }
+    fcntl(sig_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sig_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(sig_pipe[1], F_SETFL, O_NONBLOCK);
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    sigaction(SIGINT, &sa, 0);
+
+    /* prev: the process being replaced, next: our own replacement */
+    int prev = -1, next = -1, lsock = -1;
+    if(handoff_path && (prev = handoff_connect(handoff_path)) != -1) {
+        if((n_inh = take_listeners(prev, inh, STATS_MAX_LISTENERS)) < 0) {
+            dprintf(2, "handoff from the running process failed\n");
+            close(prev);
+            prev = -1;
+            n_inh = 0;
+        }
+    }
+    apply(insts, base, &c, inh, n_inh);
+    while(n_inh) if(inh[--n_inh].fd != -1) close(inh[n_inh].fd);
+    int ret = sblist_getsize(insts) ? 0 : 1;
+    if(prev != -1) {
+        if(ret || send_kind(prev, HANDOFF_READY)) {
+            close(prev);
+            prev = -1;
+        } else logring_printf("handoff: serving the listeners of the previous process");
+    }
+    if(!ret && handoff_path && (lsock = handoff_listen(handoff_path)) == -1)
+        perror("handoff socket");
+
+    while(!ret) {
+        struct pollfd pfd[3] = {
+            { .fd = sig_pipe[0], .events = POLLIN },
+            { .fd = prev, .events = POLLIN },
+            { .fd = lsock, .events = POLLIN },
+        };
+        /* the timeout is for reaping drained listeners */
+        int n = poll(pfd, 3, next == -1 ? 1000 : 100);
+        unsigned char sig;
+        if(n > 0 && pfd[0].revents && read(sig_pipe[0], &sig, 1) == 1) {
+            if(sig != SIGHUP) break;
+            struct conf nc;
+            if(next != -1) {
+                logring_printf("reload: ignored while handing over");
+            } else if(conf_load(path, base, &nc)) {
+                logring_printf("reload: %s rejected, keeping the running config", path);
+            } else {
+                conf_free(&c);
+                c = nc;
+                apply(insts, base, &c, 0, 0);
+                logring_printf("reload: %s applied", path);
+            }
+        }
+        if(n > 0 && pfd[1].revents) {
+            struct handoff_msg m;
+            int fds[2];
+            int nfds = handoff_recv(prev, &m, fds, 2);
+            if(nfds == 2 && m.kind == HANDOFF_TUNNEL) {
+                m.listener[sizeof m.listener - 1] = m.client[sizeof m.client - 1] = 0;
+                m.user[sizeof m.user - 1] = m.target[sizeof m.target - 1] = 0;
+                struct inst* in = find_inst(insts, m.listener);
+                if(!in || microsocks_adopt(in->ms, &m, fds[0], fds[1])) {
+                    close(fds[0]);
+                    close(fds[1]);
+                }
+            } else {
+                while(nfds > 0) close(fds[--nfds]);
+                if(nfds < 0 || m.kind == HANDOFF_END) {
+                    logring_printf("handoff: previous process finished");
+                    close(prev);
+                    prev = -1;
+                }
+            }
+        }
+        if(n > 0 && pfd[2].revents) {
+            int s = accept(lsock, 0, 0);
+            if(s != -1 && !give_away(s, insts)) {
+                logring_printf("handoff: new process took over, draining");
+                close(lsock);
+                lsock = -1;
+                next = s;
+            } else if(s != -1) {
+                logring_printf("handoff: new process went away, still serving");
+                close(s);
+            }
+        }
+        reap(insts);
+        if(next != -1 && !sblist_getsize(insts)) {
+            send_kind(next, HANDOFF_END);
+            break;
+        }
+    }
+    while(sblist_getsize(insts)) {
+        struct inst* in = sblist_get(insts, sblist_getsize(insts) - 1);
+        microsocks_destroy(in->ms);
+        sblist_delete(insts, sblist_getsize(insts) - 1);
+    }
+    if(lsock != -1) {
+        close(lsock);
+        unlink(handoff_path);
+    }
+    if(next != -1) close(next);
+    if(prev != -1) close(prev);
+    sblist_free(insts);
+    conf_free(&c);
+    return ret;
+}
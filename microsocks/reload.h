@@ -0,0 +1,28 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "microsocks.h"
+
+/* runs the listeners described by a config file until SIGTERM or SIGINT,
+   re-reading the file on SIGHUP. without a file, the listener comes from
+   base and SIGHUP changes nothing. a file that fails to parse leaves the
+   running setup alone. listeners that stay get their credentials and
+   allow list swapped in place, new ones are started, removed ones stop
+   accepting and go away once their last tunnel has closed.
+
+   the file has one setting per line, # starts a comment:
+       listen 0.0.0.0:1080     (repeatable, [::1]:1080 for ipv6)
+       user name
+       pass secret
+       auth_once
+       allow 10.0.0.0/8 192.168.1.7
+
+   base provides the settings the file doesn't cover (metrics port, trace
+   file, ...) and the defaults for those it does.
+
+   with a handoff path, a process already serving on that unix socket
+   hands its listeners and tunnels over (see handoff.h) and exits, and
+   the socket is taken over for the next upgrade. */
+int reload_run(const char* path, const char* handoff_path, const struct microsocks_config* base);
+
+#endif
@@ -1,3 +1,6 @@
+/* SO_REUSEPORT is an extension */
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
 #include "server.h"
 #include <stdio.h>
 #include <string.h>
@@ -45,7 +48,7 @@ int server_waitclient(struct server *server, struct client* client) {
     return ((client->fd = accept(server->fd, (void*)&client->addr, &clen)) == -1)*-1;
 }
 
-int server_setup(struct server *server, const char* listenip, unsigned short port) {
+int server_setup(struct server *server, const char* listenip, unsigned short port, int reuseport) {
     struct addrinfo *ainfo = 0;
     if(resolve_tcp(listenip, port, &ainfo)) return -1;
     struct addrinfo* p;
@@ -55,6 +58,9 @@ int server_setup(struct server *server, const char* listenip, unsigned short por
             continue;
         int yes = 1;
         setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+#ifdef SO_REUSEPORT
+        if(reuseport) setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int));
+#endif
         if(bind(listenfd, p->ai_addr, p->ai_addrlen) < 0) {
             close(listenfd);
             listenfd = -1;
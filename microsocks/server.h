@@ -42,7 +42,9 @@ int resolve_sa(const char *host, union sockaddr_union *res);
 int bindtoip(int fd, union sockaddr_union *bindaddr);
 
 int server_waitclient(struct server *server, struct client* client);
-int server_setup(struct server *server, const char* listenip, unsigned short port);
+/* with reuseport, several processes can bind the same address and the
+   kernel spreads the connections over them */
+int server_setup(struct server *server, const char* listenip, unsigned short port, int reuseport);
 
 #endif
 
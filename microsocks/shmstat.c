@@ -0,0 +1,121 @@
+/*
+   microsocks-stat - prints the counters a running microsocks publishes
+   with -S statsfile, without talking to the proxy at all.
+
+   usage: microsocks-stat [-i seconds] statsfile
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "shmstats.h"
+
+static const char* ec_names[STATS_NUM_ERRORCODES] = {
+    "success", "general_failure", "not_allowed", "net_unreachable",
+    "host_unreachable", "conn_refused", "ttl_expired",
+    "command_not_supported", "addresstype_not_supported",
+    "bind_ip_not_provided",
+};
+
+static const char* slab_names[STATS_SLAB_COUNT] = { "conn", "flow" };
+
+static const char* lat_names[STATS_LAT_COUNT] = {
+    "handshake", "resolve", "connect", "first_upstream_byte", "first_downstream_byte",
+};
+
+static void print(const struct shmstats_data *d, const struct shmstats_data *prev, double secs) {
+    unsigned i;
+    printf("published_ns %llu\n", (unsigned long long) d->published_ns);
+    for(i = 0; i < d->n_listeners; i++)
+        printf("listener %s accepted %llu rejected %llu active %llu\n", d->listeners[i].name,
+            (unsigned long long) d->listeners[i].accepted,
+            (unsigned long long) d->listeners[i].rejected,
+            (unsigned long long) d->listeners[i].active);
+    printf("conns_active %llu\n", (unsigned long long) d->conns_active);
+    for(i = 0; i < d->n_children; i++)
+        printf("child %u pid %llu restarts %llu conns_active %llu udp_flows_active %llu\n", i,
+            (unsigned long long) d->children[i].pid, (unsigned long long) d->children[i].restarts,
+            (unsigned long long) d->children[i].conns_active,
+            (unsigned long long) d->children[i].udp_flows_active);
+    for(i = 0; i < STATS_NUM_ERRORCODES; i++)
+        if(d->handshakes[i])
+            printf("handshakes_%s %llu\n", ec_names[i], (unsigned long long) d->handshakes[i]);
+    printf("bytes_up %llu\nbytes_down %llu\n",
+        (unsigned long long) d->bytes[STATS_UP], (unsigned long long) d->bytes[STATS_DOWN]);
+    if(prev && secs > 0)
+        printf("rate_up %.0f B/s\nrate_down %.0f B/s\n",
+            (d->bytes[STATS_UP] - prev->bytes[STATS_UP]) / secs,
+            (d->bytes[STATS_DOWN] - prev->bytes[STATS_DOWN]) / secs);
+    printf("udp_packets_up %llu\nudp_packets_down %llu\nudp_flows %llu\nudp_flows_active %llu\n",
+        (unsigned long long) d->udp_packets[STATS_UP], (unsigned long long) d->udp_packets[STATS_DOWN],
+        (unsigned long long) d->udp_flows, (unsigned long long) d->udp_flows_active);
+    for(i = 0; i < STATS_SLAB_COUNT; i++)
+        printf("slab_%s objects %llu capacity %llu bytes %llu\n", slab_names[i],
+            (unsigned long long) d->slab_objects[i], (unsigned long long) d->slab_capacity[i],
+            (unsigned long long) d->slab_bytes[i]);
+    printf("dns_lookups %llu\ndns_failures %llu\n",
+        (unsigned long long) d->dns_lookups, (unsigned long long) d->dns_failures);
+    if(d->syscalls[STATS_SYSC_WAIT]) {
+        uint64_t mb = d->bytes[0] + d->bytes[1] + d->udp_bytes[0] + d->udp_bytes[1];
+        uint64_t io = d->syscalls[STATS_SYSC_READ] + d->syscalls[STATS_SYSC_WRITE] + d->syscalls[STATS_SYSC_WAIT];
+        printf("syscalls_read %llu\nsyscalls_write %llu\nwakeups %llu\nwakeups_spurious %llu\neagain %llu\n",
+            (unsigned long long) d->syscalls[STATS_SYSC_READ], (unsigned long long) d->syscalls[STATS_SYSC_WRITE],
+            (unsigned long long) d->syscalls[STATS_SYSC_WAIT], (unsigned long long) d->syscalls[STATS_SYSC_SPURIOUS],
+            (unsigned long long) d->syscalls[STATS_SYSC_EAGAIN]);
+        if(mb) printf("syscalls_per_mb %.1f\n", io * 1048576.0 / mb);
+    }
+    for(i = 0; i < STATS_PHASE_COUNT; i++)
+        if(d->phase_cpu_ns[i])
+            printf("phase_cpu_%s_sec %.6f\n", stats_phase_names[i], d->phase_cpu_ns[i] / 1e9);
+    printf("heartbeat_lag_us p50 %llu p99 %llu max %llu\ncallback_max_us %llu\n",
+        (unsigned long long) hist_quantile(&d->heartbeat_lag, 0.5),
+        (unsigned long long) hist_quantile(&d->heartbeat_lag, 0.99),
+        (unsigned long long) (d->heartbeat_lag_max_ns / 1000),
+        (unsigned long long) (d->callback_max_ns / 1000));
+    for(i = 0; i < STATS_PHASE_COUNT; i++)
+        if(d->stalls[i])
+            printf("stalls_%s %llu\n", stats_phase_names[i], (unsigned long long) d->stalls[i]);
+    for(i = 0; i < STATS_LAT_COUNT; i++)
+        printf("%s_us count %llu p50 %llu p99 %llu p999 %llu\n", lat_names[i],
+            (unsigned long long) d->latency[i].count,
+            (unsigned long long) hist_quantile(&d->latency[i], 0.5),
+            (unsigned long long) hist_quantile(&d->latency[i], 0.99),
+            (unsigned long long) hist_quantile(&d->latency[i], 0.999));
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    int ch;
+    unsigned interval = 0;
+    while((ch = getopt(argc, argv, "i:")) != -1) {
+        switch(ch) {
+            case 'i':
+                interval = atoi(optarg);
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if(optind != argc - 1) {
+        usage:
+        dprintf(2, "usage: microsocks-stat [-i seconds] statsfile\n");
+        return 1;
+    }
+    const struct shmstats_segment *seg = shmstats_map(argv[optind]);
+    if(!seg) {
+        dprintf(2, "error: %s is not a microsocks stats file of this version\n", argv[optind]);
+        return 1;
+    }
+    static struct shmstats_data cur, prev;
+    if(shmstats_read(seg, &cur)) return 1;
+    print(&cur, 0, 0);
+    while(interval) {
+        prev = cur;
+        sleep(interval);
+        if(shmstats_read(seg, &cur)) return 1;
+        printf("\n");
+        print(&cur, &prev, (cur.published_ns - prev.published_ns) / 1e9);
+    }
+    return 0;
+}
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include "shmstats.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static struct shmstats_segment *segment;
+
+static void publish(struct shmstats_segment *seg) {
+    struct shmstats_data *d = &seg->data;
+    unsigned i, nl = __atomic_load_n(&stats->n_listeners, __ATOMIC_ACQUIRE);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    __atomic_store_n(&seg->seq, seg->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    d->published_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    d->n_listeners = nl;
+    for(i = 0; i < nl; i++) {
+        memcpy(d->listeners[i].name, stats->listeners[i].name, sizeof d->listeners[i].name);
+        d->listeners[i].accepted = STATS_GET(listeners[i].accepted);
+        d->listeners[i].rejected = STATS_GET(listeners[i].rejected);
+        d->listeners[i].active = STATS_GET(listeners[i].active);
+    }
+    for(i = 0; i < STATS_NUM_ERRORCODES; i++)
+        d->handshakes[i] = STATS_GET(handshakes[i]);
+    for(i = 0; i < 2; i++) {
+        d->bytes[i] = STATS_GET(bytes[i]);
+        d->udp_packets[i] = STATS_GET(udp_packets[i]);
+        d->udp_bytes[i] = STATS_GET(udp_bytes[i]);
+    }
+    d->udp_flows = STATS_GET(udp_flows);
+    d->udp_flows_active = STATS_GET(udp_flows_active);
+    d->conns_active = STATS_GET(conns_active);
+    for(i = 0; i < STATS_SLAB_COUNT; i++) {
+        d->slab_objects[i] = STATS_GET(slab_objects[i]);
+        d->slab_capacity[i] = STATS_GET(slab_capacity[i]);
+        d->slab_bytes[i] = STATS_GET(slab_bytes[i]);
+    }
+    d->dns_lookups = STATS_GET(dns_lookups);
+    d->dns_failures = STATS_GET(dns_failures);
+    d->dns_lookup_ns = STATS_GET(dns_lookup_ns);
+    d->accept_lag_ns = STATS_GET(accept_lag_ns);
+    d->accept_lag_max_ns = STATS_GET(accept_lag_max_ns);
+    for(i = 0; i < STATS_SYSC_COUNT; i++)
+        d->syscalls[i] = STATS_GET(syscalls[i]);
+    for(i = 0; i < STATS_PHASE_COUNT; i++)
+        d->phase_cpu_ns[i] = STATS_GET(phase_cpu_ns[i]);
+    d->heartbeat_lag_max_ns = STATS_GET(heartbeat_lag_max_ns);
+    d->callback_max_ns = STATS_GET(callback_max_ns);
+    for(i = 0; i < STATS_PHASE_COUNT; i++)
+        d->stalls[i] = STATS_GET(stalls[i]);
+    hist_merge(&stats->heartbeat_lag, &d->heartbeat_lag);
+    for(i = 0; i < STATS_LAT_COUNT; i++)
+        hist_merge(&stats->latency[i], &d->latency[i]);
+    d->n_children = STATS_GET(n_children);
+    for(i = 0; i < d->n_children; i++) {
+        d->children[i].pid = STATS_GET(children[i].pid);
+        d->children[i].restarts = STATS_GET(children[i].restarts);
+        d->children[i].conns_active = STATS_GET(children[i].conns_active);
+        d->children[i].udp_flows_active = STATS_GET(children[i].udp_flows_active);
+    }
+
+    __atomic_store_n(&seg->seq, seg->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void* publisher(void *data) {
+    struct shmstats_segment *seg = data;
+    struct timespec ts = { .tv_sec = SHMSTATS_INTERVAL_MS / 1000,
+                           .tv_nsec = (SHMSTATS_INTERVAL_MS % 1000) * 1000000L };
+    while(1) {
+        publish(seg);
+        nanosleep(&ts, 0);
+    }
+    return 0;
+}
+
+int shmstats_start(const char* path) {
+    size_t size = sizeof(struct shmstats_segment);
+    void *p;
+    if(path) {
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        if(fd == -1) return -1;
+        if(ftruncate(fd, size)) {
+            close(fd);
+            return -1;
+        }
+        p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    } else {
+        p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if(p == MAP_FAILED) return -1;
+    struct shmstats_segment *seg = p;
+    memset(seg, 0, size);
+    seg->version = SHMSTATS_VERSION;
+    seg->size = size;
+    seg->hist_sub_bits = HIST_SUB_BITS;
+    seg->hist_buckets = HIST_BUCKETS;
+    publish(seg);
+    /* readers treat the segment as valid once the magic shows up */
+    __atomic_store_n(&seg->magic, SHMSTATS_MAGIC, __ATOMIC_RELEASE);
+
+    pthread_t pt;
+    if(pthread_create(&pt, 0, publisher, seg)) {
+        munmap(p, size);
+        return -1;
+    }
+    pthread_detach(pt);
+    __atomic_store_n(&segment, seg, __ATOMIC_RELEASE);
+    return 0;
+}
+
+const struct shmstats_segment* shmstats_map(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) return 0;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if(!fstat(fd, &st) && st.st_size >= (off_t) sizeof(struct shmstats_segment))
+        p = mmap(0, sizeof(struct shmstats_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED) return 0;
+    const struct shmstats_segment *seg = p;
+    if(__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != SHMSTATS_MAGIC ||
+       seg->version != SHMSTATS_VERSION || seg->size != sizeof *seg) {
+        munmap(p, sizeof(struct shmstats_segment));
+        return 0;
+    }
+    return seg;
+}
+
+int shmstats_read(const struct shmstats_segment* seg, struct shmstats_data* out) {
+    unsigned tries;
+    for(tries = 0; tries < 1000; tries++) {
+        uint64_t s1 = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        if(s1 & 1) continue;
+        memcpy(out, &seg->data, sizeof *out);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == s1) return 0;
+    }
+    return -1;
+}
+
+int shmstats_snapshot(struct shmstats_data* out) {
+    struct shmstats_segment *seg = __atomic_load_n(&segment, __ATOMIC_ACQUIRE);
+    if(!seg) return -1;
+    return shmstats_read(seg, out);
+}
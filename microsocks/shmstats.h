@@ -0,0 +1,89 @@
+#ifndef SHMSTATS_H
+#define SHMSTATS_H
+
+#include <stdint.h>
+#include "stats.h"
+
+/* periodically published copy of most of struct stats in a mmap-able
+   segment (not the per-listener bytes, the tcpinfo, poll batch and
+   callback histograms or the topk sketches, those stay on /metrics).
+   a publisher thread writes a snapshot every SHMSTATS_INTERVAL_MS under a
+   seqlock, so readers in other processes get consistent snapshots with
+   plain memory loads and never talk to the proxy.
+   the layout is versioned; readers must check magic, version and size. */
+
+#define SHMSTATS_MAGIC 0x7473736b636f736dULL /* "msockstt" */
+#define SHMSTATS_VERSION 6
+#ifndef SHMSTATS_INTERVAL_MS
+#define SHMSTATS_INTERVAL_MS 100
+#endif
+
+struct shmstats_listener {
+    char name[STATS_LISTENER_NAME_LEN];
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t active;
+};
+
+/* a prefork child, see prefork.h. pid is 0 while it is restarted */
+struct shmstats_child {
+    uint64_t pid;
+    uint64_t restarts;
+    uint64_t conns_active;
+    uint64_t udp_flows_active;
+};
+
+struct shmstats_data {
+    uint64_t published_ns; /* CLOCK_REALTIME of this snapshot */
+    uint32_t n_listeners;
+    uint32_t pad;
+    struct shmstats_listener listeners[STATS_MAX_LISTENERS];
+    uint64_t handshakes[STATS_NUM_ERRORCODES];
+    uint64_t bytes[2];
+    uint64_t udp_packets[2];
+    uint64_t udp_bytes[2];
+    uint64_t udp_flows;
+    uint64_t udp_flows_active;
+    uint64_t conns_active;      /* all listeners, what max_conns limits */
+    uint64_t slab_objects[STATS_SLAB_COUNT];
+    uint64_t slab_capacity[STATS_SLAB_COUNT];
+    uint64_t slab_bytes[STATS_SLAB_COUNT];
+    uint64_t dns_lookups;
+    uint64_t dns_failures;
+    uint64_t dns_lookup_ns;
+    uint64_t accept_lag_ns;
+    uint64_t accept_lag_max_ns;
+    uint64_t syscalls[STATS_SYSC_COUNT];
+    uint64_t phase_cpu_ns[STATS_PHASE_COUNT];  /* zero without CONFIG_PHASE_CPU */
+    /* see watchdog.h */
+    uint64_t heartbeat_lag_max_ns;
+    uint64_t callback_max_ns;
+    uint64_t stalls[STATS_PHASE_COUNT];
+    struct hist_snapshot heartbeat_lag;
+    struct hist_snapshot latency[STATS_LAT_COUNT];
+    uint32_t n_children;        /* 0 unless running with -F */
+    uint32_t pad2;
+    struct shmstats_child children[STATS_MAX_CHILDREN];
+};
+
+struct shmstats_segment {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t size;      /* sizeof(struct shmstats_segment) */
+    uint32_t hist_sub_bits;
+    uint32_t hist_buckets;
+    uint64_t seq;       /* odd while a snapshot is being written */
+    struct shmstats_data data;
+};
+
+/* creates the segment backed by path, or anonymous memory if path is NULL,
+   and starts the publisher thread. */
+int shmstats_start(const char* path);
+/* maps an existing segment read-only, for external readers */
+const struct shmstats_segment* shmstats_map(const char* path);
+/* consistent copy of the segment's data, returns 0 on success */
+int shmstats_read(const struct shmstats_segment* seg, struct shmstats_data* out);
+/* same, for the segment published by this process */
+int shmstats_snapshot(struct shmstats_data* out);
+
+#endif
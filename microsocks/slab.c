@@ -0,0 +1,120 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "slab.h"
+#include "stats.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_ALIGN 16
+#define ROUND_UP(x) (((x) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+
+struct slab_chunk {
+    struct slab_chunk *prev, *next;  /* on the partial list */
+    void *free;                      /* objects freed in this chunk */
+    unsigned used;
+    unsigned fresh;                  /* objects handed out from the end so far */
+};
+
+#define CHUNK_HDR ROUND_UP(sizeof(struct slab_chunk))
+
+int slab_init(struct slab *s, size_t size, int kind) {
+    memset(s, 0, sizeof *s);
+    s->size = ROUND_UP(size < sizeof(void*) ? sizeof(void*) : size);
+    if(s->size > SLAB_CHUNK_SIZE - CHUNK_HDR) return -1;
+    s->per_chunk = (SLAB_CHUNK_SIZE - CHUNK_HDR) / s->size;
+    s->kind = kind;
+    pthread_mutex_init(&s->lock, 0);
+    return 0;
+}
+
+static void unlink_chunk(struct slab *s, struct slab_chunk *c) {
+    if(c->prev) c->prev->next = c->next;
+    else s->partial = c->next;
+    if(c->next) c->next->prev = c->prev;
+}
+
+#if CONFIG_SLAB
+static struct slab_chunk *chunk_of(void *p) {
+    return (struct slab_chunk*) ((uintptr_t) p & ~(uintptr_t)(SLAB_CHUNK_SIZE - 1));
+}
+
+static void link_chunk(struct slab *s, struct slab_chunk *c) {
+    c->prev = 0;
+    c->next = s->partial;
+    if(c->next) c->next->prev = c;
+    s->partial = c;
+}
+
+static struct slab_chunk *chunk_new(struct slab *s) {
+    void *p;
+    if(posix_memalign(&p, SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE)) return 0;
+    /* only the header is touched, objects fault in as they are handed out */
+    memset(p, 0, sizeof(struct slab_chunk));
+    STATS_GAUGE_ADD(slab_bytes[s->kind], slab_bytes[s->kind], SLAB_CHUNK_SIZE);
+    STATS_GAUGE_ADD(slab_capacity[s->kind], slab_capacity[s->kind], s->per_chunk);
+    return p;
+}
+#endif
+
+static void chunk_release(struct slab *s, struct slab_chunk *c) {
+    free(c);
+    STATS_GAUGE_SUB(slab_bytes[s->kind], slab_bytes[s->kind], SLAB_CHUNK_SIZE);
+    STATS_GAUGE_SUB(slab_capacity[s->kind], slab_capacity[s->kind], s->per_chunk);
+}
+
+void *slab_alloc(struct slab *s) {
+    void *p;
+#if CONFIG_SLAB
+    struct slab_chunk *c;
+    pthread_mutex_lock(&s->lock);
+    if(!(c = s->partial)) {
+        if((c = s->spare)) s->spare = 0;
+        else if(!(c = chunk_new(s))) {
+            pthread_mutex_unlock(&s->lock);
+            return 0;
+        }
+        link_chunk(s, c);
+    }
+    if((p = c->free)) c->free = *(void**) p;
+    else p = (char*) c + CHUNK_HDR + (size_t) c->fresh++ * s->size;
+    /* full chunks stay off the list until something in them is freed */
+    if(++c->used == s->per_chunk) unlink_chunk(s, c);
+    pthread_mutex_unlock(&s->lock);
+#else
+    if(!(p = malloc(s->size))) return 0;
+#endif
+    STATS_GAUGE_ADD(slab_objects[s->kind], slab_objects[s->kind], 1);
+    return p;
+}
+
+void slab_free(struct slab *s, void *p) {
+    if(!p) return;
+    STATS_GAUGE_SUB(slab_objects[s->kind], slab_objects[s->kind], 1);
+#if CONFIG_SLAB
+    struct slab_chunk *c = chunk_of(p);
+    pthread_mutex_lock(&s->lock);
+    *(void**) p = c->free;
+    c->free = p;
+    if(c->used-- == s->per_chunk) link_chunk(s, c);
+    if(!c->used) {
+        unlink_chunk(s, c);
+        if(!s->spare) s->spare = c;
+        else chunk_release(s, c);
+    }
+    pthread_mutex_unlock(&s->lock);
+#else
+    free(p);
+#endif
+}
+
+void slab_destroy(struct slab *s) {
+    struct slab_chunk *c;
+    while((c = s->partial)) {
+        unlink_chunk(s, c);
+        chunk_release(s, c);
+    }
+    if(s->spare) chunk_release(s, s->spare);
+    s->spare = 0;
+    pthread_mutex_destroy(&s->lock);
+}
@@ -0,0 +1,48 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* fixed-size object caches for what every connection allocates (its
+   descriptor, its udp flows). objects are carved from SLAB_CHUNK_SIZE
+   chunks aligned to their size, so a free finds its chunk by masking the
+   address, and every chunk keeps its own free list. allocations fill the
+   chunks that have room first and a chunk whose last object goes is given
+   back (one spare stays), so a long-running node keeps connection objects
+   packed in few chunks instead of spread over a fragmented heap.
+   every proxy instance has its own caches; each cache reports to one of
+   enum stats_slab. a cache has a single mutex and no per-thread
+   magazines: connection descriptors are taken and given back by the
+   accept thread (the latter when it collects finished connections), and
+   udp flows only when an association opens a new destination or ends.
+   with one thread per connection, a thread's magazine would die with the
+   one connection it serves. build with CPPFLAGS=-DCONFIG_SLAB=0 to use plain
+   malloc, e.g. under sanitizers. */
+
+#ifndef CONFIG_SLAB
+#define CONFIG_SLAB 1
+#endif
+
+#define SLAB_CHUNK_SIZE (64*1024)
+
+struct slab_chunk;
+
+struct slab {
+    pthread_mutex_t lock;
+    size_t size;                 /* object size, rounded up */
+    unsigned per_chunk;
+    int kind;                    /* enum stats_slab */
+    struct slab_chunk *partial;  /* chunks with free objects */
+    struct slab_chunk *spare;    /* an empty chunk kept for the next burst */
+};
+
+/* returns -1 if size doesn't fit a chunk */
+int slab_init(struct slab *s, size_t size, int kind);
+/* uninitialised memory, or NULL when out of memory */
+void *slab_alloc(struct slab *s);
+void slab_free(struct slab *s, void *p);
+/* gives all chunks back, every object must have been freed */
+void slab_destroy(struct slab *s);
+
+#endif
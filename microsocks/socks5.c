@@ -0,0 +1,122 @@
+#include "socks5.h"
+#include <arpa/inet.h>
+#include <string.h>
+
+int socks5_parse_addrport(const unsigned char *buf, size_t n, struct socks5_addrport *addrport) {
+    if (n < 2) return -EC_GENERAL_FAILURE;
+    int af = AF_INET;
+    size_t minlen = 1 + 4 + 2, l;
+    char namebuf[MAX_DNS_LEN + 1];
+
+    enum socks5_addr_type type = buf[0];
+    switch(type) {
+        case SOCKS5_IPV6: /* ipv6 */
+            af = AF_INET6;
+            minlen = 1 + 16 + 2;
+            /* fall through */
+        case SOCKS5_IPV4: /* ipv4 */
+            if(n < minlen) return -EC_GENERAL_FAILURE;
+            if(namebuf != inet_ntop(af, buf+1, namebuf, sizeof namebuf))
+                return -EC_GENERAL_FAILURE; /* malformed or too long addr */
+            break;
+        case SOCKS5_DNS: /* dns name */
+            l = buf[1];
+            minlen = 1 + (1 + l) + 2 ;
+            if(n < minlen) return -EC_GENERAL_FAILURE;
+            memcpy(namebuf, buf+2, l);
+            namebuf[l] = 0;
+            break;
+        default:
+            return -EC_ADDRESSTYPE_NOT_SUPPORTED;
+    }
+
+    addrport->type = type;
+    memcpy(addrport->addr, namebuf, strlen(namebuf) + 1);
+    addrport->port = (buf[minlen-2] << 8) | buf[minlen-1];
+    return minlen;
+}
+
+int socks5_parse_request(const unsigned char *buf, size_t n, int *cmd, struct socks5_addrport *addrport) {
+    if(n < 3) return -EC_GENERAL_FAILURE;
+    if(buf[0] != VERSION) return -EC_GENERAL_FAILURE;
+    if(buf[1] != CONNECT && buf[1] != UDP_ASSOCIATE) return -EC_COMMAND_NOT_SUPPORTED; /* we support only CONNECT and UDP ASSOCIATE method */
+    *cmd = buf[1];
+    if(buf[2] != RSV) return -EC_GENERAL_FAILURE; /* malformed packet */
+
+    int ret = socks5_parse_addrport(buf + 3, n - 3, addrport);
+    if (ret < 0) return ret;
+    return EC_SUCCESS;
+}
+
+enum authmethod socks5_auth_method(const unsigned char *buf, size_t n, int user, int trusted) {
+    if(n < 1 || buf[0] != 5) return AM_INVALID;
+    size_t idx = 1;
+    if(idx >= n ) return AM_INVALID;
+    int n_methods = buf[idx];
+    idx++;
+    while(idx < n && n_methods > 0) {
+        if(buf[idx] == AM_NO_AUTH) {
+            if(!user || trusted) return AM_NO_AUTH;
+        } else if(buf[idx] == AM_USERNAME) {
+            if(user) return AM_USERNAME;
+        }
+        idx++;
+        n_methods--;
+    }
+    return AM_INVALID;
+}
+
+enum errorcode socks5_check_credentials(const unsigned char *buf, size_t n,
+                                        const char *user, const char *pass, char name[256]) {
+    if(n < 5) return EC_GENERAL_FAILURE;
+    if(buf[0] != 1) return EC_GENERAL_FAILURE;
+    unsigned ulen, plen;
+    ulen=buf[1];
+    if(n < 2 + ulen + 2) return EC_GENERAL_FAILURE;
+    plen=buf[2+ulen];
+    if(n < 2 + ulen + 1 + plen) return EC_GENERAL_FAILURE;
+    char sent[256];
+    memcpy(name, buf+2, ulen);
+    memcpy(sent, buf+2+ulen+1, plen);
+    name[ulen] = 0;
+    sent[plen] = 0;
+    if(!strcmp(name, user) && !strcmp(sent, pass)) return EC_SUCCESS;
+    return EC_NOT_ALLOWED;
+}
+
+ssize_t socks5_parse_udp(const unsigned char *buf, size_t n, struct socks5_addrport *addrport) {
+    if (n < 3) return -EC_GENERAL_FAILURE;
+    if (buf[0] != RSV || buf[1] != RSV) return -EC_GENERAL_FAILURE;
+    if (buf[2] != 0) return -EC_GENERAL_FAILURE;  // framentation not supported
+
+    ssize_t offset = 3;
+    int ret = socks5_parse_addrport(buf + offset, n - offset, addrport);
+    if (ret < 0) return ret;
+    return offset + ret;
+}
+
+ssize_t socks5_udp_header(unsigned char *buf, const struct socks5_addrport *addrport) {
+    buf[0] = RSV;
+    buf[1] = RSV;
+    buf[2] = 0; // FRAG
+    buf[3] = addrport->type;
+    size_t offset = 4;
+    if (addrport->type == SOCKS5_DNS) {
+        size_t len = strlen(addrport->addr);
+        if (len > 255) return -1;
+        buf[offset++] = len;
+        memcpy(buf + offset, addrport->addr, len);
+        offset += len;
+    } else if (addrport->type == SOCKS5_IPV4) {
+        if (1 != inet_pton(AF_INET, addrport->addr, buf + offset)) return -1;
+        offset += 4;
+    } else if (addrport->type == SOCKS5_IPV6) {
+        if (1 != inet_pton(AF_INET6, addrport->addr, buf + offset)) return -1;
+        offset += 16;
+    } else {
+        return -1;
+    }
+    buf[offset++] = addrport->port >> 8;
+    buf[offset++] = addrport->port & 0xFF;
+    return offset;
+}
@@ -0,0 +1,39 @@
+#ifndef SOCKS5_H
+#define SOCKS5_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "sockssrv.h"
+
+/* the SOCKS5 wire format: parsing and encoding of the messages only, no
+   sockets, locks, resolution or logging, so it can be benchmarked and
+   fuzzed on its own (see bench/wirebench.c and bench/fuzz_socks5.c).
+   parsers never read past n and report malformed input as a negative
+   errorcode. */
+
+struct socks5_addrport {
+    enum socks5_addr_type type;
+    char addr[MAX_DNS_LEN + 1];
+    unsigned short port;
+};
+
+/* atyp, address and port; returns the bytes consumed */
+int socks5_parse_addrport(const unsigned char *buf, size_t n, struct socks5_addrport *addrport);
+/* VER CMD RSV followed by the destination, returns EC_SUCCESS */
+int socks5_parse_request(const unsigned char *buf, size_t n, int *cmd, struct socks5_addrport *addrport);
+/* the method picked from a greeting. user: a login is configured,
+   trusted: the client may skip it (auth_once) */
+enum authmethod socks5_auth_method(const unsigned char *buf, size_t n, int user, int trusted);
+/* rfc1929 login, the name the client sent ends up in name.
+   EC_SUCCESS, EC_NOT_ALLOWED for wrong credentials, EC_GENERAL_FAILURE */
+enum errorcode socks5_check_credentials(const unsigned char *buf, size_t n,
+                                        const char *user, const char *pass, char name[256]);
+/* RSV RSV FRAG and the destination of a client datagram, returns the
+   offset of the payload */
+ssize_t socks5_parse_udp(const unsigned char *buf, size_t n, struct socks5_addrport *addrport);
+/* header for a datagram coming back from addrport, buf needs room for
+   MAX_SOCKS5_HEADER_LEN bytes. returns its length, -1 for an address
+   that doesn't match its type */
+ssize_t socks5_udp_header(unsigned char *buf, const struct socks5_addrport *addrport);
+
+#endif
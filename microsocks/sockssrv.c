@@ -35,13 +35,27 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <limits.h>
+#include <fcntl.h>
 
 #include "sblist.h"
 #include "server.h"
 #include "sockssrv.h"
-
-extern void custom_log(const char *format, ...);
-extern void update_traffic_stats_ui(uint64_t upload, uint64_t download);
+#include "socks5.h"
+#include "stats.h"
+#include "metrics.h"
+#include "probes.h"
+#include "trace.h"
+#include "capture.h"
+#include "shmstats.h"
+#include "conntab.h"
+#include "logring.h"
+#include "watchdog.h"
+#include "microsocks.h"
+#include "policy.h"
+#include "reload.h"
+#include "handoff.h"
+#include "prefork.h"
+#include "slab.h"
 
 /* timeout in microseconds on resource exhaustion to prevent excessive
    cpu usage. */
@@ -49,6 +63,13 @@ extern void update_traffic_stats_ui(uint64_t upload, uint64_t download);
 #define FAILURE_TIMEOUT 64
 #endif
 
+/* while finished connections wait to be joined, the accept loop wakes up
+   this often (milliseconds) to give their descriptors back even if no
+   client comes along. */
+#ifndef COLLECT_INTERVAL_MS
+#define COLLECT_INTERVAL_MS 1000
+#endif
+
 #ifndef MAX
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #endif
@@ -68,17 +89,66 @@ extern void update_traffic_stats_ui(uint64_t upload, uint64_t download);
 #endif
 
 static int quiet;
-static const char* auth_user;
-static const char* auth_pass;
-static sblist* auth_ips;
-static pthread_rwlock_t auth_ips_lock = PTHREAD_RWLOCK_INITIALIZER;
-static const struct server* server;
+
+struct microsocks {
+    struct microsocks_config cfg;   /* strings are owned copies */
+    struct server server;
+    int listener;
+    int stop_pipe[2];
+    pthread_t accept_pt;
+    sblist *threads;
+    pthread_mutex_t threads_lock;   /* accept thread, microsocks_adopt() and stop */
+    uint64_t next_conn_id;
+    /* held while a connection thread closes its client fd, so stop can
+       shut the fds down without racing against reuse. */
+    pthread_mutex_t fd_lock;
+    sblist* auth_ips;
+    pthread_rwlock_t auth_ips_lock;
+    /* credentials and allow list, replaced by microsocks_update() */
+    struct policy_slot policy;
+    pthread_mutex_t update_lock;
+    /* becomes readable for good once tunnels are to move to a new process,
+       see handoff.h. sends on handoff_sock are serialised by handoff_lock. */
+    int handoff_pipe[2];
+    int handoff_sock;
+    pthread_mutex_t handoff_lock;
+    /* running and stopping are guarded by state_lock */
+    pthread_mutex_t state_lock;
+    pthread_cond_t state_cond;
+    int running;
+    int stopping;
+    int accepting;
+    unsigned active;                /* connection threads not done yet */
+    pthread_t sink_pt;
+    int sink_started;
+    uint64_t log_cursor;            /* survives restarts of the sink thread */
+    struct slab conn_slab;          /* struct thread */
+    struct slab flow_slab;          /* struct udp_flow */
+};
+/* id of the connection served by the current thread, for the probes in
+   helpers that don't otherwise know which connection they work for. */
+static __thread uint64_t conn_id;
+static __thread struct conntab_slot *conn_slot;
 
 struct thread {
     pthread_t pt;
+    struct microsocks *ms;
     struct client client;
     enum socksstate state;
+    int listener;
+    uint64_t id;
+    uint64_t start_ns;
+    uint64_t bytes[2];
+    uint64_t bytes_flushed[2]; /* part of bytes already added to the listener */
+    struct conntab_slot *slot;
+    struct policy *policy;     /* snapshot taken when the connection came in */
+    int handed_off;            /* the fds now belong to another process */
+    int target_fd;             /* tunnels resumed by microsocks_adopt() */
     volatile int  done;
+    /* heavy hitter keys, see topk.h */
+    char clientname[256];
+    char user[256];
+    char target[MAX_DNS_LEN + 1];
 };
 
 struct service_addr {
@@ -91,22 +161,12 @@ struct service_addr {
 #define CONFIG_LOG 1
 #endif
 #if CONFIG_LOG
-#define dolog(...) do { \
-    char buf[1024]; \
-    snprintf(buf, sizeof(buf), __VA_ARGS__); \
-    custom_log(buf); \
-} while(0)
+/* embedders poll the records with logring_read(), see logring.h */
+#define dolog(...) logring_printf(__VA_ARGS__)
 #else
 static void dolog(const char* fmt, ...) { }
 #endif
 
-struct socks5_addrport {
-    enum socks5_addr_type type;
-    char addr[MAX_DNS_LEN + 1];
-    unsigned short port;
-};
-
-
 int compareSocks5Addrport(const struct socks5_addrport* addrport1, const struct socks5_addrport* addrport2) {
     if (addrport1->type == addrport2->type && 
         strcmp(addrport1->addr, addrport2->addr) == 0 && 
@@ -118,71 +178,44 @@ int compareSocks5Addrport(const struct socks5_addrport* addrport1, const struct
 
 int resolveSocks5Addrport(struct socks5_addrport* addrport, enum socks5_socket_type  stype, union sockaddr_union* addr) {
      struct addrinfo* ai;
+     int ret;
+     uint64_t start = stats_now_ns();
+     PROBE2(resolve_start, conn_id, addrport->addr);
+     STATS_PHASE_PUSH(RESOLVE);
+     int prev_phase = conn_slot ? conn_slot->phase : STATS_PHASE_HANDSHAKE;
+     watchdog_busy(conn_slot, STATS_PHASE_RESOLVE, start);
      if (stype == TCP_SOCKET) {
-        /* there's no suitable errorcode in rfc1928 for dns lookup failure */
-        if(resolve_tcp(addrport->addr, addrport->port, &ai)) return -EC_GENERAL_FAILURE;
+        ret = resolve_tcp(addrport->addr, addrport->port, &ai);
     } else if (stype == UDP_SOCKET) {
-        if(resolve_udp(addrport->addr, addrport->port, &ai)) return -EC_GENERAL_FAILURE;
+        ret = resolve_udp(addrport->addr, addrport->port, &ai);
     } else {
         abort();
     }
+    uint64_t end = stats_now_ns();
+    watchdog_busy(conn_slot, prev_phase, end);
+    if (addrport->type == SOCKS5_DNS) {
+        STATS_ADD(dns_lookups, 1);
+        STATS_ADD(dns_lookup_ns, end - start);
+        stats_latency(STATS_LAT_RESOLVE, start);
+        if (ret) STATS_ADD(dns_failures, 1);
+        trace_span("resolve", start, end, "failed", ret != 0);
+    }
+    STATS_PHASE_POP();
+    PROBE2(resolve_end, conn_id, ret);
+    /* there's no suitable errorcode in rfc1928 for dns lookup failure */
+    if (ret) return -EC_GENERAL_FAILURE;
 
     memcpy(addr, ai->ai_addr, ai->ai_addrlen);
     freeaddrinfo(ai);
     return 0;
 }
 
-static int parse_addrport(unsigned char *buf, size_t n, struct socks5_addrport* addrport) {
-    assert(addrport != NULL);
-    if (n < 2) return -EC_GENERAL_FAILURE;
-    int af = AF_INET;
-    int minlen = 1 + 4 + 2, l;
-    char namebuf[MAX_DNS_LEN + 1];
-
-    enum socks5_addr_type type = buf[0];
-    switch(type) {
-        case SOCKS5_IPV6: /* ipv6 */
-            af = AF_INET6;
-            minlen = 1 + 16 + 2;
-            /* fall through */
-        case SOCKS5_IPV4: /* ipv4 */
-            if(n < minlen) return -EC_GENERAL_FAILURE;
-            if(namebuf != inet_ntop(af, buf+1, namebuf, sizeof namebuf))
-                return -EC_GENERAL_FAILURE; /* malformed or too long addr */
-            break;
-        case SOCKS5_DNS: /* dns name */
-            l = buf[1];
-            minlen = 1 + (1 + l) + 2 ;
-            if(n < minlen) return -EC_GENERAL_FAILURE;
-            memcpy(namebuf, buf+2, l);
-            namebuf[l] = 0;
-            break;
-        default:
-            return -EC_ADDRESSTYPE_NOT_SUPPORTED;
-    }
-    
-    addrport->type = type;
-    addrport->addr[sizeof addrport->addr - 1] = '\0';
-    strncpy(addrport->addr, namebuf, sizeof addrport->addr -1);
-    addrport->port = (buf[minlen-2] << 8) | buf[minlen-1];
-    return minlen;
-}
-
-static int parse_socks_request_header(unsigned char *buf, size_t n, int* cmd, union sockaddr_union* svc_addr) {
+static int parse_socks_request_header(unsigned char *buf, size_t n, int* cmd, struct socks5_addrport* addrport, union sockaddr_union* svc_addr) {
     assert(svc_addr != NULL);
-    if(n < 3) return -EC_GENERAL_FAILURE;
-    if(buf[0] != VERSION) return -EC_GENERAL_FAILURE;
-    if(buf[1] != CONNECT && buf[1] != UDP_ASSOCIATE) return -EC_COMMAND_NOT_SUPPORTED; /* we support only CONNECT and UDP ASSOCIATE method */
-    *cmd = buf[1];
-    if(buf[2] != RSV) return -EC_GENERAL_FAILURE; /* malformed packet */
-
-    struct socks5_addrport addrport;
-    int ret = parse_addrport(buf + 3, n - 3, &addrport);
-    if (ret < 0) {
-        return ret;
-    }
+    int ret = socks5_parse_request(buf, n, cmd, addrport);
+    if (ret < 0) return ret;
     int socktype = *cmd == CONNECT? TCP_SOCKET : UDP_SOCKET;
-    ret = resolveSocks5Addrport(&addrport, socktype, svc_addr);
+    ret = resolveSocks5Addrport(addrport, socktype, svc_addr);
     if (ret < 0) return ret;
     return EC_SUCCESS;
 }
@@ -240,42 +273,27 @@ static int is_authed(union sockaddr_union *client, union sockaddr_union *authedi
     return 0;
 }
 
-static int is_in_authed_list(union sockaddr_union *caddr) {
+static int is_in_authed_list(struct microsocks *ms, union sockaddr_union *caddr) {
     size_t i;
-    for(i=0;i<sblist_getsize(auth_ips);i++)
-        if(is_authed(caddr, sblist_get(auth_ips, i)))
+    for(i=0;i<sblist_getsize(ms->auth_ips);i++)
+        if(is_authed(caddr, sblist_get(ms->auth_ips, i)))
             return 1;
     return 0;
 }
 
-static void add_auth_ip(union sockaddr_union *caddr) {
-    sblist_add(auth_ips, caddr);
-}
-
-static enum authmethod check_auth_method(unsigned char *buf, size_t n, struct client*client) {
-    if(buf[0] != 5) return AM_INVALID;
-    size_t idx = 1;
-    if(idx >= n ) return AM_INVALID;
-    int n_methods = buf[idx];
-    idx++;
-    while(idx < n && n_methods > 0) {
-        if(buf[idx] == AM_NO_AUTH) {
-            if(!auth_user) return AM_NO_AUTH;
-            else if(auth_ips) {
-                int authed = 0;
-                if(pthread_rwlock_rdlock(&auth_ips_lock) == 0) {
-                    authed = is_in_authed_list(&client->addr);
-                    pthread_rwlock_unlock(&auth_ips_lock);
-                }
-                if(authed) return AM_NO_AUTH;
-            }
-        } else if(buf[idx] == AM_USERNAME) {
-            if(auth_user) return AM_USERNAME;
-        }
-        idx++;
-        n_methods--;
+static void add_auth_ip(struct microsocks *ms, union sockaddr_union *caddr) {
+    sblist_add(ms->auth_ips, caddr);
+}
+
+static enum authmethod check_auth_method(struct microsocks *ms, struct policy *pol, unsigned char *buf, size_t n, struct client*client) {
+    int authed = 0;
+    /* only look the client up if it offers to go without a login */
+    if(pol->user && pol->auth_once && n > 2 && memchr(buf + 2, AM_NO_AUTH, n - 2) &&
+       pthread_rwlock_rdlock(&ms->auth_ips_lock) == 0) {
+        authed = is_in_authed_list(ms, &client->addr);
+        pthread_rwlock_unlock(&ms->auth_ips_lock);
     }
-    return AM_INVALID;
+    return socks5_auth_method(buf, n, pol->user != 0, authed);
 }
 
 static void send_auth_response(int fd, int version, enum authmethod meth) {
@@ -317,115 +335,204 @@ static void send_error(int fd, enum errorcode ec) {
     write(fd, buf, 10);
 }
 
-static uint64_t total_upload_bytes = 0;
-static uint64_t total_download_bytes = 0;
-static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void account_topk_bytes(struct thread *t, uint64_t n) {
+    if(!n) return;
+    topk_add(&stats->top_bytes[STATS_TOPK_CLIENT], t->clientname, n);
+    topk_add(&stats->top_bytes[STATS_TOPK_USER], t->user, n);
+    if(t->target[0]) topk_add(&stats->top_bytes[STATS_TOPK_TARGET], t->target, n);
+}
+
+static void account_topk_conn(struct thread *t) {
+    topk_add(&stats->top_conns[STATS_TOPK_CLIENT], t->clientname, 1);
+    topk_add(&stats->top_conns[STATS_TOPK_USER], t->user, 1);
+    if(t->target[0]) topk_add(&stats->top_conns[STATS_TOPK_TARGET], t->target, 1);
+}
+
+/* counts into the loop's local sc[] array, see stats.h */
+#define SYSC(KIND) do { if (CONFIG_SYSCALL_STATS) sc[STATS_SYSC_##KIND]++; } while (0)
+
+/* per listener byte counts are only brought up to date at the topk
+   flushes, keeping them off the per-read path as well */
+static void account_listener_bytes(struct thread *t) {
+    int d;
+    for(d = 0; d < 2; d++) if(t->bytes[d] != t->bytes_flushed[d]) {
+        STATS_ADD(listeners[t->listener].bytes[d], t->bytes[d] - t->bytes_flushed[d]);
+        t->bytes_flushed[d] = t->bytes[d];
+    }
+}
 
 static void update_traffic_stats(size_t uploaded, size_t downloaded) {
-    pthread_mutex_lock(&stats_mutex);
-    total_upload_bytes += uploaded;
-    total_download_bytes += downloaded;
-    update_traffic_stats_ui(total_upload_bytes, total_download_bytes);
-    pthread_mutex_unlock(&stats_mutex);
+    STATS_ADD(bytes[STATS_UP], uploaded);
+    STATS_ADD(bytes[STATS_DOWN], downloaded);
+}
+/* passes the tunnel on to the process taking over, at a point where
+   nothing read is left unwritten, so the socket buffers are all the state
+   there is. */
+static int handoff_tunnel(struct thread *t, int fd2) {
+    struct microsocks *ms = t->ms;
+    struct handoff_msg m;
+    memset(&m, 0, sizeof m);
+    m.version = HANDOFF_VERSION;
+    m.kind = HANDOFF_TUNNEL;
+    snprintf(m.listener, sizeof m.listener, "%s:%u", ms->cfg.listenip, ms->cfg.port);
+    m.id = t->id;
+    m.age_ns = stats_now_ns() - t->start_ns;
+    m.bytes[STATS_UP] = t->bytes[STATS_UP];
+    m.bytes[STATS_DOWN] = t->bytes[STATS_DOWN];
+    snprintf(m.client, sizeof m.client, "%s", t->clientname);
+    snprintf(m.user, sizeof m.user, "%s", t->user);
+    snprintf(m.target, sizeof m.target, "%s", t->target);
+    int fds[2] = { t->client.fd, fd2 };
+    pthread_mutex_lock(&ms->handoff_lock);
+    int ret = ms->handoff_sock == -1 ? -1 : handoff_send(ms->handoff_sock, &m, fds, 2);
+    pthread_mutex_unlock(&ms->handoff_lock);
+    if(!ret) t->handed_off = 1;
+    return ret;
 }
-static void copyloop(int fd1, int fd2) {
+
+/* returns 1 if the tunnel was handed off rather than finished */
+static int copyloop(struct thread *t, int fd2) {
+    int fd1 = t->client.fd;
+    int hfd = t->ms->handoff_pipe[0];
+    uint64_t topk_pending = 0;
+    uint64_t start = stats_now_ns();
+    uint64_t burst_start = 0, burst_last = 0, burst_bytes = 0;
+    uint64_t sc[STATS_SYSC_COUNT] = {0};
+    int seen_up = 0, seen_down = 0;
     int kq = kqueue();
     if (kq == -1) {
         perror("kqueue");
-        return;
+        return 0;
     }
 
-    struct kevent events[2];
-    struct kevent changes[2];
+    struct kevent events[3];
+    struct kevent changes[3];
 
     EV_SET(&changes[0], fd1, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
     EV_SET(&changes[1], fd2, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
+    EV_SET(&changes[2], hfd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
 
-    if (kevent(kq, changes, 2, NULL, 0, NULL) == -1) {
+    if (kevent(kq, changes, 3, NULL, 0, NULL) == -1) {
         perror("kevent");
         close(kq);
-        return;
+        return 0;
     }
+    conntab_set_fds(t->slot, fd1, fd2);
 
     while (1) {
-        int nev = kevent(kq, NULL, 0, events, 2, NULL);
+        watchdog_idle(t->slot);
+        int nev = kevent(kq, NULL, 0, events, 3, NULL);
+        size_t moved = 0;
+        SYSC(WAIT);
         if (nev == -1) {
-            if (errno == EINTR || errno == EAGAIN) continue;
+            if (errno == EINTR || errno == EAGAIN) {
+                SYSC(SPURIOUS);
+                continue;
+            }
             perror("kevent");
             break;
         } else if (nev == 0) {
             break; // Timeout reached (if applicable)
         }
 
+        uint64_t now = stats_now_ns();
+        watchdog_busy(t->slot, STATS_PHASE_RELAY, now);
+        hist_record(&stats->poll_batch, nev);
+
+        int handoff = 0;
         for (int i = 0; i < nev; i++) {
             int infd = (int)events[i].ident;
             int outfd = (infd == fd1) ? fd2 : fd1;
+            if (infd == hfd) {
+                handoff = 1;
+                continue;
+            }
 
             if (events[i].filter == EVFILT_READ) {
                 char buf[1024];
                 ssize_t sent = 0, n = read(infd, buf, sizeof(buf));
+                SYSC(READ);
                 if (n <= 0) {
-                    close(kq);
-                    return;
+                    if (n < 0 && errno == EAGAIN) SYSC(EAGAIN);
+                    goto out;
                 }
 
                 while (sent < n) {
                     ssize_t m = write(outfd, buf + sent, n - sent);
+                    SYSC(WRITE);
                     if (m < 0) {
-                        close(kq);
-                        return;
+                        if (errno == EAGAIN) SYSC(EAGAIN);
+                        goto out;
                     }
                     sent += m;
                 }
-
-                if (infd == fd1) {
+                moved += n;
+
+                int dir = infd == fd1 ? STATS_UP : STATS_DOWN;
+                PROBE3(relay, t->id, dir, n);
+                if (trace_active()) {
+                    /* reads closer than 10ms together form one burst */
+                    if (burst_start && now - burst_last > 10000000) {
+                        trace_span("relay", burst_start, burst_last, "bytes", burst_bytes);
+                        burst_start = 0;
+                    }
+                    if (!burst_start) {
+                        burst_start = now;
+                        burst_bytes = 0;
+                    }
+                    burst_last = now;
+                    burst_bytes += n;
+                }
+                t->bytes[dir] += n;
+                capture_bytes(dir, n);
+                if (t->slot) __atomic_store_n(&t->slot->bytes[dir], t->bytes[dir], __ATOMIC_RELAXED);
+                if (dir == STATS_UP) {
+                    if (!seen_up++) stats_latency(STATS_LAT_FIRST_UP, start);
                     update_traffic_stats(n, 0);
                 } else {
+                    if (!seen_down++) stats_latency(STATS_LAT_FIRST_DOWN, start);
                     update_traffic_stats(0, n);
                 }
+                if ((topk_pending += n) >= STATS_TOPK_FLUSH_BYTES) {
+                    account_topk_bytes(t, topk_pending);
+                    account_listener_bytes(t);
+                    if (CONFIG_SYSCALL_STATS) stats_syscalls_flush(sc);
+                    STATS_PHASE(RELAY);
+                    topk_pending = 0;
+                }
             }
         }
+        if (handoff) {
+            if (!handoff_tunnel(t, fd2)) goto out;
+            /* the new process is gone, keep relaying here */
+            EV_SET(&changes[2], hfd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+            kevent(kq, changes + 2, 1, NULL, 0, NULL);
+            moved = 1;
+        }
+        if (!moved) SYSC(SPURIOUS);
     }
 
+out:
+    if (burst_start) trace_span("relay", burst_start, burst_last, "bytes", burst_bytes);
+    account_topk_bytes(t, topk_pending);
+    account_listener_bytes(t);
+    if (CONFIG_SYSCALL_STATS) stats_syscalls_flush(sc);
+    conntab_set_fds(t->slot, -1, -1);
     close(kq);
+    return t->handed_off;
 }
 
-// caller must free socks5_addr manually
-static ssize_t extract_udp_data(unsigned char* buf, ssize_t n, struct socks5_addrport* addrport) {
-    if (n < 3) return -EC_GENERAL_FAILURE;
-    if (buf[0] != RSV || buf[1] != RSV) return -EC_GENERAL_FAILURE;
-    if (buf[2] != 0) return -EC_GENERAL_FAILURE;  // framentation not supported
-
-    ssize_t offset = 3;
-    int ret = parse_addrport(buf + offset, n - offset, addrport);
-    if (ret < 0) {
-        return ret;
-    }
-    assert(ret > 0);
-
-    offset += ret;
-    return offset;
-}
-
-struct fd_socks5addr {
+/* a target of an udp association, from the instance's flow_slab */
+struct udp_flow {
+    struct udp_flow *next;
     int fd;
     struct socks5_addrport addrport;
 };
 
-int compare_fd_socks5addr_by_fd(char* item1, char* item2) {
-    struct fd_socks5addr* i1 = ( struct fd_socks5addr*)item1;
-    struct fd_socks5addr* i2 = ( struct fd_socks5addr*)item2;
-    if (i1->fd == i2->fd) return 0;
-    return 1;
-}
-
-int compare_fd_socks5addr_by_addrport(char* item1, char* item2) {
-    struct fd_socks5addr* ap1 = ( struct fd_socks5addr*)item1;
-    struct fd_socks5addr* ap2 = ( struct fd_socks5addr*)item2;
-    return compareSocks5Addrport(&ap1->addrport, &ap2->addrport);
-}
-
-static void copy_loop_udp(int tcp_fd, int udp_fd) {
+static void copy_loop_udp(struct thread *t, int udp_fd) {
+    int tcp_fd = t->client.fd;
+    uint64_t topk_pending = 0;
+    uint64_t sc[STATS_SYSC_COUNT] = {0};
     int kq = kqueue();
     if (kq == -1) {
         perror("kqueue");
@@ -455,17 +562,26 @@ static void copy_loop_udp(int tcp_fd, int udp_fd) {
     }
 
     ssize_t n, ret;
-    struct fd_socks5addr item;
-    sblist* sock_list = sblist_new(sizeof(struct fd_socks5addr), 1);
+    struct socks5_addrport addrport;
+    struct udp_flow *flows = 0, *flow;
+    size_t n_flows = 0;
 
     while (1) {
         struct kevent events[1024];
+        watchdog_idle(t->slot);
         int nev = kevent(kq, NULL, 0, events, 1024, NULL);
+        size_t moved = 0;
+        SYSC(WAIT);
         if (nev == -1) {
-            if (errno == EINTR || errno == EAGAIN) continue;
+            if (errno == EINTR || errno == EAGAIN) {
+                SYSC(SPURIOUS);
+                continue;
+            }
             perror("kevent");
             goto UDP_LOOP_END;
         }
+        watchdog_busy(t->slot, STATS_PHASE_UDP, stats_now_ns());
+        hist_record(&stats->poll_batch, nev);
 
         for (int i = 0; i < nev; i++) {
             int fd = (int)events[i].ident;
@@ -476,11 +592,13 @@ static void copy_loop_udp(int tcp_fd, int udp_fd) {
             // TCP socket
             if (fd == tcp_fd) {
                 n = read(fd, buf, sizeof(buf) - 1);
+                SYSC(READ);
                 if (n == 0) {
                     // SOCKS5 TCP connection closed
                     goto UDP_LOOP_END;
                 }
                 if (n == -1) {
+                    if (errno == EAGAIN) SYSC(EAGAIN);
                     if (errno == EINTR || errno == EAGAIN) continue;
                     perror("read from tcp socket");
                     goto UDP_LOOP_END;
@@ -497,7 +615,9 @@ static void copy_loop_udp(int tcp_fd, int udp_fd) {
                 } else {
                     n = recv(udp_fd, buf, sizeof(buf), 0);
                 }
+                SYSC(READ);
                 if (n == -1) {
+                    if (errno == EAGAIN) SYSC(EAGAIN);
                     if (errno == EINTR || errno == EAGAIN) continue;
                     perror("recv from udp socket");
                     goto UDP_LOOP_END;
@@ -511,20 +631,19 @@ static void copy_loop_udp(int tcp_fd, int udp_fd) {
                     dprintf(1, "fd %d is bound now\n", udp_fd);
                 }
 
-                ssize_t offset = extract_udp_data(buf, n, &item.addrport);
+                ssize_t offset = socks5_parse_udp(buf, n, &addrport);
                 if (offset < 0) {
                     dprintf(2, "failed to extract from udp packet %ld", offset);
                     goto UDP_LOOP_END;
                 }
 
                 int send_fd = 0;
-                int idx = sblist_search(sock_list, (char*)&item, compare_fd_socks5addr_by_addrport);
-                if (idx != -1) {
-                    struct fd_socks5addr* item_found = (struct fd_socks5addr*)sblist_item_from_index(sock_list, idx);
-                    send_fd = item_found->fd;
+                for (flow = flows; flow && compareSocks5Addrport(&flow->addrport, &addrport); flow = flow->next);
+                if (flow) {
+                    send_fd = flow->fd;
                 } else {
                     union sockaddr_union target_addr;
-                    ret = resolveSocks5Addrport(&item.addrport, UDP_SOCKET, &target_addr);
+                    ret = resolveSocks5Addrport(&addrport, UDP_SOCKET, &target_addr);
                     if (ret < 0) {
                         dprintf(2, "failed to resolve socks5 addrport, %ld", ret);
                         goto UDP_LOOP_END;
@@ -537,8 +656,20 @@ static void copy_loop_udp(int tcp_fd, int udp_fd) {
                         send_error(tcp_fd, EC_GENERAL_FAILURE);
                         goto UDP_LOOP_END;
                     }
-                    item.fd = fd;
-                    sblist_add(sock_list, &item);
+                    if (!(flow = slab_alloc(&t->ms->flow_slab))) {
+                        close(fd);
+                        send_error(tcp_fd, EC_GENERAL_FAILURE);
+                        goto UDP_LOOP_END;
+                    }
+                    flow->fd = fd;
+                    flow->addrport = addrport;
+                    flow->next = flows;
+                    flows = flow;
+                    n_flows++;
+                    STATS_ADD(udp_flows, 1);
+                    capture_udp_flow(&addrport);
+                    STATS_GAUGE_ADD(udp_flows_active, udp_flows_active, 1);
+                    topk_add(&stats->top_conns[STATS_TOPK_TARGET], addrport.addr, 1);
 
                     // add to kqueue
                     struct kevent new_event;
@@ -558,95 +689,84 @@ static void copy_loop_udp(int tcp_fd, int udp_fd) {
                     }
                 }
                 ssize_t ret = send(send_fd, buf + offset, n - offset, 0);
+                SYSC(WRITE);
                 if (ret < 0) {
                     perror("send");
                     goto UDP_LOOP_END;
                 }
+                PROBE3(udp_in, t->id, send_fd, ret);
+                t->bytes[STATS_UP] += ret;
+                capture_datagram(STATS_UP, ret);
+                STATS_ADD(udp_packets[STATS_UP], 1);
+                STATS_ADD(udp_bytes[STATS_UP], ret);
+                topk_pending += ret;
+                moved += ret;
             }
 
             // UDP sockets for target addresses
             if (fd != tcp_fd && fd != udp_fd) {
-                item.fd = fd;
-                int idx = sblist_search(sock_list, (char *)&item, compare_fd_socks5addr_by_fd);
-                if (idx == -1) {
+                for (flow = flows; flow && flow->fd != fd; flow = flow->next);
+                if (!flow) {
                     dprintf(2, "UDP socket not found");
                     goto UDP_LOOP_END;
                 }
-                struct fd_socks5addr *item = (struct fd_socks5addr*)sblist_item_from_index(sock_list, idx);
-                buf[0] = RSV;
-                buf[1] = RSV;
-                buf[2] = 0; // FRAG
-                struct socks5_addrport* addrport = &item->addrport;
-                buf[3] = addrport->type;
-                size_t offset = 4;
-                if (addrport->type == SOCKS5_DNS) {
-                    size_t len = strlen(item->addrport.addr);
-                    buf[offset++] = len;
-                    memcpy(buf + offset, addrport->addr, len);
-                    offset += len;
-                } else if (addrport->type == SOCKS5_IPV4) {
-                    struct in_addr addr_in4;
-                    if (1 != inet_pton(AF_INET, addrport->addr, &addr_in4)) {
-                        dprintf(2, "invalid IPv4 address, %s", addrport->addr);
-                        goto UDP_LOOP_END;
-                    }
-                    memcpy(buf + offset, &addr_in4, sizeof addr_in4);
-                    offset += sizeof addr_in4;
-                } else if (addrport->type == SOCKS5_IPV6) {
-                    struct in6_addr addr_in6;
-                    if (1 != inet_pton(AF_INET6, addrport->addr, &addr_in6)) {
-                        dprintf(2, "invalid IPv6 address, %s", addrport->addr);
-                        goto UDP_LOOP_END;
-                    }
-                    memcpy(buf + offset, &addr_in6, sizeof addr_in6);
-                    offset += sizeof addr_in6;
-                } else {
-                    abort();
+                ssize_t offset = socks5_udp_header(buf, &flow->addrport);
+                if (offset < 0) {
+                    dprintf(2, "invalid address, %s", flow->addrport.addr);
+                    goto UDP_LOOP_END;
                 }
-                buf[offset++] = addrport->port >> 8;
-                buf[offset++] = addrport->port & 0xFF;
                 n = recv(fd, buf + offset, sizeof(buf) - offset, 0);
+                SYSC(READ);
                 if(n <= 0) {
                     perror("recv from target address");
                     goto UDP_LOOP_END;
                 }
                 ret = write(udp_fd, buf, offset + n);
+                SYSC(WRITE);
                 if (ret < 0) {
                     perror("write to udp_fd");
                     goto UDP_LOOP_END;
                 }
+                PROBE3(udp_out, t->id, fd, n);
+                t->bytes[STATS_DOWN] += n;
+                capture_datagram(STATS_DOWN, n);
+                STATS_ADD(udp_packets[STATS_DOWN], 1);
+                STATS_ADD(udp_bytes[STATS_DOWN], n);
+                topk_pending += n;
+                moved += n;
             }
         }
+        if (!moved) SYSC(SPURIOUS);
+        if (topk_pending >= STATS_TOPK_FLUSH_BYTES) {
+            account_topk_bytes(t, topk_pending);
+            account_listener_bytes(t);
+            if (CONFIG_SYSCALL_STATS) stats_syscalls_flush(sc);
+            STATS_PHASE(UDP);
+            topk_pending = 0;
+        }
     }
 
 UDP_LOOP_END:
-    for (int i = 0; i < sblist_getsize(sock_list); i++) {
-        struct fd_socks5addr *item = (struct fd_socks5addr*)sblist_item_from_index(sock_list, i);
-        close(item->fd);
+    account_topk_bytes(t, topk_pending);
+    account_listener_bytes(t);
+    if (CONFIG_SYSCALL_STATS) stats_syscalls_flush(sc);
+    while ((flow = flows)) {
+        flows = flow->next;
+        close(flow->fd);
+        slab_free(&t->ms->flow_slab, flow);
     }
-    sblist_free(sock_list);
+    STATS_GAUGE_SUB(udp_flows_active, udp_flows_active, n_flows);
     close(kq);
 }
 
-static enum errorcode check_credentials(unsigned char* buf, size_t n) {
-    if(n < 5) return EC_GENERAL_FAILURE;
-    if(buf[0] != 1) return EC_GENERAL_FAILURE;
-    unsigned ulen, plen;
-    ulen=buf[1];
-    if(n < 2 + ulen + 2) return EC_GENERAL_FAILURE;
-    plen=buf[2+ulen];
-    if(n < 2 + ulen + 1 + plen) return EC_GENERAL_FAILURE;
-    char user[256], pass[256];
-    memcpy(user, buf+2, ulen);
-    memcpy(pass, buf+2+ulen+1, plen);
-    user[ulen] = 0;
-    pass[plen] = 0;
-    if(!strcmp(user, auth_user) && !strcmp(pass, auth_pass)) {
+/* user receives the name the client tried to log in with */
+static enum errorcode check_credentials(struct policy *pol, unsigned char* buf, size_t n, char user[256]) {
+    enum errorcode ec = socks5_check_credentials(buf, n, pol->user, pol->pass, user);
+    if(ec == EC_SUCCESS)
         dolog("Client authentication successful for user: %s\n", user);
-        return EC_SUCCESS;
-    }
-    dolog("Client authentication failed for user: %s\n", user);
-    return EC_NOT_ALLOWED;
+    else if(ec == EC_NOT_ALLOWED)
+        dolog("Client authentication failed for user: %s\n", user);
+    return ec;
 }
 
 int udp_svc_setup(union sockaddr_union* client_addr) {
@@ -704,16 +824,59 @@ int udp_svc_setup(union sockaddr_union* client_addr) {
     return fd;
 }
 
+/* everything a connection thread does on its way out */
+static void finish_connection(struct thread *t) {
+    PROBE3(close, t->id, t->bytes[STATS_UP], t->bytes[STATS_DOWN]);
+    trace_span("connection", t->start_ns, stats_now_ns(), "bytes", t->bytes[STATS_UP] + t->bytes[STATS_DOWN]);
+    trace_conn_end();
+    capture_conn_end();
+    watchdog_idle(t->slot);
+    conntab_release(t->slot);
+    pthread_mutex_lock(&t->ms->fd_lock);
+    close(t->client.fd);
+    t->client.fd = -1;
+    pthread_mutex_unlock(&t->ms->fd_lock);
+    STATS_GAUGE_SUB(listeners[t->listener].active, listener_active[t->listener], 1);
+    STATS_GAUGE_SUB(conns_active, conns_active, 1);
+    policy_unref(t->policy);
+    __atomic_fetch_sub(&t->ms->active, 1, __ATOMIC_RELAXED);
+    STATS_PHASE(NONE);
+    t->done = 1;
+}
+
+static void handshake_done(int ec) {
+    stats_handshake_done(ec);
+    capture_reply(ec);
+}
+
 static void* clientthread(void *data) {
     struct thread *t = data;
-    char clientname[256];
+    t->start_ns = stats_now_ns();
+    conn_id = t->id;
+    logring_set_tag(t->listener + 1);
+    STATS_PHASE(HANDSHAKE);
+    trace_conn_start(t->id);
+    capture_conn_start();
+    char *clientname = t->clientname;
     int af = SOCKADDR_UNION_AF(&t->client.addr);
     void *ipdata = SOCKADDR_UNION_ADDRESS(&t->client.addr);
     unsigned short port = ntohs(SOCKADDR_UNION_PORT(&t->client.addr));
-    inet_ntop(af, ipdata, clientname, sizeof clientname);
+    inet_ntop(af, ipdata, clientname, sizeof t->clientname);
+    strcpy(t->user, "-");
+    t->target[0] = 0;
+    t->slot = conntab_claim(t->id, t->listener, clientname, t->start_ns);
+    conn_slot = t->slot;
     
     // Log new connection
     dolog("New SOCKS client connected from %s:%d", clientname, port);
+
+    t->policy = policy_acquire(&t->ms->policy);
+    if(!policy_allows(t->policy, &t->client.addr)) {
+        dolog("client %s not in allow list", clientname);
+        STATS_ADD(listeners[t->listener].rejected, 1);
+        handshake_done(EC_NOT_ALLOWED);
+        goto breakloop;
+    }
     
     t->state = SS_1_CONNECTED;
     unsigned char buf[1024];
@@ -722,66 +885,109 @@ static void* clientthread(void *data) {
     // for CONNECT, this is target TCP address
     // for UDP ASSOCIATE, this is client UDP address
     union sockaddr_union address, local_addr;
+    struct socks5_addrport addrport;
+    uint64_t greeting_ns = 0;
 
     enum authmethod am;
     while((n = recv(t->client.fd, buf, sizeof buf, 0)) > 0) {
+        watchdog_busy(t->slot, t->state == SS_2_NEED_AUTH ? STATS_PHASE_AUTH : STATS_PHASE_HANDSHAKE,
+            stats_now_ns());
         switch(t->state) {
             case SS_1_CONNECTED:
-                am = check_auth_method(buf, n, &t->client);
+                greeting_ns = stats_now_ns();
+                am = check_auth_method(t->ms, t->policy, buf, n, &t->client);
+                PROBE2(greeting, t->id, am);
+                capture_auth(am == AM_NO_AUTH ? CAPTURE_AUTH_NONE :
+                    am == AM_USERNAME ? CAPTURE_AUTH_PASSWORD : CAPTURE_AUTH_REFUSED);
                 if(am == AM_NO_AUTH) t->state = SS_3_AUTHED;
                 else if (am == AM_USERNAME) t->state = SS_2_NEED_AUTH;
                 send_auth_response(t->client.fd, 5, am);
-                if(am == AM_INVALID) goto breakloop;
+                if(am == AM_INVALID) {
+                    handshake_done(EC_NOT_ALLOWED);
+                    goto breakloop;
+                }
                 break;
             case SS_2_NEED_AUTH:
-                ret = check_credentials(buf, n);
+                STATS_PHASE(AUTH);
+                ret = check_credentials(t->policy, buf, n, t->user);
+                PROBE3(auth, t->id, t->user, ret);
                 send_auth_response(t->client.fd, 1, ret);
-                if(ret != EC_SUCCESS)
+                if(ret != EC_SUCCESS) {
+                    capture_auth(CAPTURE_AUTH_REFUSED);
+                    handshake_done(ret);
                     goto breakloop;
+                }
                 t->state = SS_3_AUTHED;
-                if(auth_ips && !pthread_rwlock_wrlock(&auth_ips_lock)) {
-                    if(!is_in_authed_list(&t->client.addr))
-                        add_auth_ip(&t->client.addr);
-                    pthread_rwlock_unlock(&auth_ips_lock);
+                if(t->policy->auth_once && !pthread_rwlock_wrlock(&t->ms->auth_ips_lock)) {
+                    if(!is_in_authed_list(t->ms, &t->client.addr))
+                        add_auth_ip(t->ms, &t->client.addr);
+                    pthread_rwlock_unlock(&t->ms->auth_ips_lock);
                 }
+                STATS_PHASE(HANDSHAKE);
                 break;
             case SS_3_AUTHED:
-                (void)0;
+                stats_latency(STATS_LAT_HANDSHAKE, greeting_ns);
+                trace_span("handshake", greeting_ns, stats_now_ns(), 0, 0);
                 int cmd;
-                ret = parse_socks_request_header(buf, n, &cmd, &address);
+                ret = parse_socks_request_header(buf, n, &cmd, &addrport, &address);
+                /* for UDP ASSOCIATE this is the client's own address, the
+                   targets are accounted per flow. */
+                if (ret >= 0 && cmd == CONNECT) {
+                    strncpy(t->target, addrport.addr, sizeof t->target - 1);
+                    t->target[sizeof t->target - 1] = 0;
+                    conntab_set_target(t->slot, t->target);
+                }
+                if (ret >= 0) capture_request(cmd, cmd == CONNECT ? &addrport : 0);
+                account_topk_conn(t);
                 if (ret != EC_SUCCESS) {
+                    handshake_done(ret);
                     goto breakloop;
                 }
                 
                 if (cmd == CONNECT) {
+                    uint64_t connect_ns = stats_now_ns();
+                    STATS_PHASE(CONNECT);
+                    watchdog_busy(t->slot, STATS_PHASE_CONNECT, connect_ns);
+                    PROBE1(connect_start, t->id);
                     ret = connect_socks_target(&address, &t->client);
+                    watchdog_busy(t->slot, STATS_PHASE_HANDSHAKE, stats_now_ns());
+                    PROBE2(connect_end, t->id, ret);
+                    trace_span("connect", connect_ns, stats_now_ns(), "failed", ret < 0);
+                    stats_latency(STATS_LAT_CONNECT, connect_ns);
                     if(ret < 0) {
                         send_error(t->client.fd, ret*-1);
+                        handshake_done(ret);
                         goto breakloop;
                     }
                     int remotefd = ret;
                     socklen_t len = sizeof(union sockaddr_union);
-                    if (getsockname(remotefd, (struct sockaddr*)&local_addr, &len)) goto breakloop;
-                    if (-1 == send_response(t->client.fd, EC_SUCCESS, &local_addr)) {
+                    if (getsockname(remotefd, (struct sockaddr*)&local_addr, &len) ||
+                        -1 == send_response(t->client.fd, EC_SUCCESS, &local_addr)) {
+                        handshake_done(EC_GENERAL_FAILURE);
                         close(remotefd);
                         goto breakloop;
                     }
-                    copyloop(t->client.fd, remotefd);
+                    handshake_done(EC_SUCCESS);
+                    STATS_PHASE(RELAY);
+                    copyloop(t, remotefd);
                     close(remotefd);
                     goto breakloop;
                 } else if (cmd == UDP_ASSOCIATE) {
                     int fd = udp_svc_setup(&address);
                     if(fd <= 0) {
                         send_error(t->client.fd, fd*-1);
+                        handshake_done(fd);
                         goto breakloop;
                     }
 
                     socklen_t len = sizeof(union sockaddr_union);
-                    if (getsockname(fd, (struct sockaddr*)&local_addr, &len)) goto breakloop;
-                    if (-1 == send_response(t->client.fd, EC_SUCCESS, &local_addr)) {
+                    if (getsockname(fd, (struct sockaddr*)&local_addr, &len) ||
+                        -1 == send_response(t->client.fd, EC_SUCCESS, &local_addr)) {
+                        handshake_done(EC_GENERAL_FAILURE);
                         close(fd);
                         goto breakloop;
                     }
+                    handshake_done(EC_SUCCESS);
                     if (CONFIG_LOG) {
                         char clientname[256];
                         int af = SOCKADDR_UNION_AF(&address);
@@ -795,7 +1001,11 @@ static void* clientthread(void *data) {
                         dolog("UDP Associate: client[%d] %s:%d bound to local address %s:%d\n", 
                             t->client.fd, clientname, port_c, udp_svc_name, port_s);
                     }
-                    copy_loop_udp(t->client.fd, fd);
+                    uint64_t udp_ns = stats_now_ns();
+                    STATS_PHASE(UDP);
+                    copy_loop_udp(t, fd);
+                    trace_span("udp_associate", udp_ns, stats_now_ns(), "bytes",
+                        t->bytes[STATS_UP] + t->bytes[STATS_DOWN]);
                     close(fd);
                     goto breakloop;
                 } else {
@@ -803,37 +1013,594 @@ static void* clientthread(void *data) {
                     abort();
                 }
         }
+        watchdog_idle(t->slot);
     }
 breakloop:
     // Log disconnection
-    dolog("SOCKS client disconnected: %s:%d", clientname, port);
-    close(t->client.fd);
-    t->done = 1;
+    if(t->handed_off) dolog("SOCKS client handed over: %s:%d", clientname, port);
+    else dolog("SOCKS client disconnected: %s:%d", clientname, port);
+    finish_connection(t);
+    return 0;
+}
 
+/* second half of a tunnel that another process handed over */
+static void* resumethread(void *data) {
+    struct thread *t = data;
+    conn_id = t->id;
+    logring_set_tag(t->listener + 1);
+    STATS_PHASE(RELAY);
+    trace_conn_start(t->id);
+    t->slot = conntab_claim(t->id, t->listener, t->clientname, t->start_ns);
+    conn_slot = t->slot;
+    conntab_set_target(t->slot, t->target);
+    if(copyloop(t, t->target_fd)) dolog("SOCKS client handed over: %s", t->clientname);
+    else dolog("SOCKS client disconnected: %s", t->clientname);
+    close(t->target_fd);
+    finish_connection(t);
     return 0;
 }
 
-static void collect(sblist *threads) {
+/* returns the number of connections still running */
+static size_t collect(struct microsocks *ms) {
+    sblist *threads = ms->threads;
     size_t i;
+    pthread_mutex_lock(&ms->threads_lock);
     for(i=0;i<sblist_getsize(threads);) {
         struct thread* thread = *((struct thread**)sblist_get(threads, i));
         if(thread->done) {
             pthread_join(thread->pt, 0);
             sblist_delete(threads, i);
-            free(thread);
+            slab_free(&ms->conn_slab, thread);
         } else
             i++;
     }
+    pthread_mutex_unlock(&ms->threads_lock);
+    return i;
+}
+
+/* adds t to the instance's threads and runs fn on it. returns -1 on
+   failure and 1 if max_conns connections are open already (limited). */
+static int start_connection(struct microsocks *ms, struct thread *t, void *(*fn)(void*), int limited) {
+    /* reserve before checking, so concurrent acceptors can't overshoot */
+    uint64_t open = STATS_ADD(conns_active, 1);
+    if(limited && ms->cfg.max_conns && open >= ms->cfg.max_conns) {
+        STATS_SUB(conns_active, 1);
+        return 1;
+    }
+    if(stats_child >= 0) STATS_ADD(children[stats_child].conns_active, 1);
+    int ret = -1;
+    pthread_mutex_lock(&ms->threads_lock);
+    if(!sblist_add(ms->threads, &t)) goto out;
+    STATS_ADD(listeners[t->listener].accepted, 1);
+    STATS_GAUGE_ADD(listeners[t->listener].active, listener_active[t->listener], 1);
+    __atomic_fetch_add(&ms->active, 1, __ATOMIC_RELAXED);
+    pthread_attr_t *a = 0, attr;
+    if(pthread_attr_init(&attr) == 0) {
+        a = &attr;
+        pthread_attr_setstacksize(a, THREAD_STACK_SIZE);
+    }
+    if(pthread_create(&t->pt, a, fn, t) != 0) {
+        dolog("pthread_create failed. OOM?\n");
+        STATS_GAUGE_SUB(listeners[t->listener].active, listener_active[t->listener], 1);
+        __atomic_fetch_sub(&ms->active, 1, __ATOMIC_RELAXED);
+        sblist_delete(ms->threads, sblist_getsize(ms->threads) - 1);
+    } else ret = 0;
+    if(a) pthread_attr_destroy(&attr);
+out:
+    pthread_mutex_unlock(&ms->threads_lock);
+    if(ret) STATS_GAUGE_SUB(conns_active, conns_active, 1);
+    return ret;
+}
+
+/* wakes every connection thread by shutting its client socket down, the
+   relay and udp loops notice right away, a handshake with its next recv.
+   stopping is set by now, so microsocks_adopt() adds no more threads. */
+static void stop_connections(struct microsocks *ms) {
+    size_t i;
+    pthread_mutex_lock(&ms->threads_lock);
+    pthread_mutex_lock(&ms->fd_lock);
+    for(i=0;i<sblist_getsize(ms->threads);i++) {
+        struct thread* thread = *((struct thread**)sblist_get(ms->threads, i));
+        if(thread->client.fd != -1) shutdown(thread->client.fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&ms->fd_lock);
+    while(sblist_getsize(ms->threads)) {
+        struct thread* thread = *((struct thread**)sblist_get(ms->threads, 0));
+        pthread_join(thread->pt, 0);
+        sblist_delete(ms->threads, 0);
+        slab_free(&ms->conn_slab, thread);
+    }
+    pthread_mutex_unlock(&ms->threads_lock);
+}
+
+static void* acceptthread(void *data) {
+    struct microsocks *ms = data;
+    int listener = ms->listener;
+    int kq = kqueue();
+    if (kq == -1) {
+        perror("kqueue");
+        return 0;
+    }
+    struct kevent changes[2];
+    EV_SET(&changes[0], ms->server.fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+    EV_SET(&changes[1], ms->stop_pipe[0], EVFILT_READ, EV_ADD, 0, 0, NULL);
+    if (kevent(kq, changes, 2, NULL, 0, NULL) == -1) {
+        perror("kevent");
+        close(kq);
+        return 0;
+    }
+    logring_set_tag(listener + 1);
+
+    uint64_t lag_start = 0;
+    const struct timespec collect_ts = { .tv_sec = COLLECT_INTERVAL_MS / 1000,
+                                         .tv_nsec = (COLLECT_INTERVAL_MS % 1000) * 1000000L };
+    STATS_PHASE(ACCEPT);
+    while(1) {
+        /* charges the previous iteration, the wait in accept() is free */
+        STATS_PHASE(ACCEPT);
+        size_t running = collect(ms);
+        struct client c;
+        struct kevent ev;
+        if(lag_start) {
+            uint64_t lag = stats_now_ns() - lag_start;
+            STATS_SET(accept_lag_ns, lag);
+            stats_max(&stats->accept_lag_max_ns, lag);
+        }
+        int nev = kevent(kq, NULL, 0, &ev, 1, running ? &collect_ts : NULL);
+        if(nev == -1 && errno == EINTR) continue;
+        if(nev == 0 && running) {
+            /* only woke up to collect, that isn't accept lag */
+            lag_start = 0;
+            continue;
+        }
+        if(nev <= 0 || (int)ev.ident == ms->stop_pipe[0]) break;
+        struct thread *curr = slab_alloc(&ms->conn_slab);
+        if(!curr) goto oom;
+        curr->done = 0;
+        curr->handed_off = 0;
+        curr->target_fd = -1;
+        curr->ms = ms;
+        curr->listener = listener;
+        curr->id = __atomic_add_fetch(&ms->next_conn_id, 1, __ATOMIC_RELAXED);
+        curr->bytes[STATS_UP] = curr->bytes[STATS_DOWN] = 0;
+        curr->bytes_flushed[STATS_UP] = curr->bytes_flushed[STATS_DOWN] = 0;
+        if(server_waitclient(&ms->server, &c)) {
+            lag_start = stats_now_ns();
+            slab_free(&ms->conn_slab, curr);
+            /* someone else's, or already gone again */
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) continue;
+            dolog("failed to accept connection\n");
+            STATS_ADD(listeners[listener].rejected, 1);
+            usleep(FAILURE_TIMEOUT);
+            continue;
+        }
+        lag_start = stats_now_ns();
+        /* the listener is non-blocking for the sake of stop, some systems
+           let accepted sockets inherit that */
+        fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) & ~O_NONBLOCK);
+        curr->client = c;
+        PROBE2(accept, curr->id, c.fd);
+        int ret = start_connection(ms, curr, clientthread, 1);
+        if(ret > 0) {
+            dolog("rejecting connection, %u connections open\n", ms->cfg.max_conns);
+            STATS_ADD(listeners[listener].rejected, 1);
+            close(curr->client.fd);
+            slab_free(&ms->conn_slab, curr);
+            continue;
+        }
+        if(ret) {
+            close(curr->client.fd);
+            slab_free(&ms->conn_slab, curr);
+            oom:
+            dolog("rejecting connection due to OOM\n");
+            STATS_ADD(listeners[listener].rejected, 1);
+            usleep(FAILURE_TIMEOUT); /* prevent 100% CPU usage in OOM situation */
+            continue;
+        }
+    }
+    STATS_PHASE(NONE);
+    close(kq);
+    return 0;
+}
+
+static void deliver_sinks(struct microsocks *ms, uint64_t *cursor) {
+    if(ms->cfg.log_sink) {
+        struct logring_entry batch[32];
+        struct microsocks_log_record recs[32];
+        size_t i, n, m;
+        while((n = logring_read(cursor, batch, 32, 0))) {
+            for(i = m = 0; i < n; i++) {
+                /* untagged records are process wide, every instance gets them */
+                if(batch[i].tag && batch[i].tag != (uint32_t) ms->listener + 1) continue;
+                recs[m].seq = batch[i].seq;
+                recs[m].time_ns = batch[i].time_ns;
+                recs[m].msg = batch[i].msg;
+                m++;
+            }
+            if(m) ms->cfg.log_sink(ms->cfg.sink_ctx, recs, m);
+        }
+    }
+    if(ms->cfg.stats_sink) {
+        int l = ms->listener;
+        struct microsocks_stats st = {
+            .accepted = STATS_GET(listeners[l].accepted),
+            .rejected = STATS_GET(listeners[l].rejected),
+            .active = STATS_GET(listeners[l].active),
+            .bytes = { STATS_GET(listeners[l].bytes[STATS_UP]), STATS_GET(listeners[l].bytes[STATS_DOWN]) },
+        };
+        ms->cfg.stats_sink(ms->cfg.sink_ctx, &st);
+    }
+}
+
+static void* sinkthread(void *data) {
+    struct microsocks *ms = data;
+    int done;
+    do {
+        struct timeval now;
+        gettimeofday(&now, 0);
+        uint64_t ns = (uint64_t) now.tv_usec * 1000 + ms->cfg.sink_interval_ms * 1000000ULL;
+        struct timespec until = { .tv_sec = now.tv_sec + ns / 1000000000ULL, .tv_nsec = ns % 1000000000ULL };
+        pthread_mutex_lock(&ms->state_lock);
+        while(ms->stopping < 2 && pthread_cond_timedwait(&ms->state_cond, &ms->state_lock, &until) != ETIMEDOUT);
+        done = ms->stopping == 2;
+        pthread_mutex_unlock(&ms->state_lock);
+        deliver_sinks(ms, &ms->log_cursor);
+    } while(!done);
+    return 0;
+}
+
+/* the process wide parts are started once, by the first instance that
+   asks for them */
+static int start_services(const struct microsocks_config *cfg) {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    static int metrics_started, trace_started, capture_started, shm_started, watchdog_started;
+    int ret = -1;
+    pthread_mutex_lock(&lock);
+    if(cfg->metrics_port && !metrics_started) {
+        if(metrics_start("127.0.0.1", cfg->metrics_port)) {
+            perror("metrics_start");
+            goto out;
+        }
+        metrics_started = 1;
+    }
+    if(cfg->trace_path && !trace_started) {
+        if(trace_open(cfg->trace_path, cfg->trace_every)) {
+            perror("trace_open");
+            goto out;
+        }
+        trace_started = 1;
+    }
+    if(cfg->capture_path && !capture_started) {
+        if(capture_open(cfg->capture_path)) {
+            perror("capture_open");
+            goto out;
+        }
+        capture_started = 1;
+    }
+    /* without a path the segment is private, embedders read it through
+       shmstats_snapshot(). prefork workers leave it to the supervisor,
+       which publishes the stats they share. */
+    if(!shm_started && stats_child < 0) {
+        if(shmstats_start(cfg->stats_path)) {
+            perror("shmstats_start");
+            goto out;
+        }
+        shm_started = 1;
+    }
+    if(!watchdog_started) {
+        if(watchdog_start(cfg->stall_ms)) {
+            perror("watchdog_start");
+            goto out;
+        }
+        watchdog_started = 1;
+    }
+    ret = 0;
+out:
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+static char* dupstr(const char* s) {
+    return s ? strdup(s) : 0;
+}
+
+void microsocks_config_init(struct microsocks_config* cfg) {
+    memset(cfg, 0, sizeof *cfg);
+    cfg->listenip = "0.0.0.0";
+    cfg->port = 1080;
+    cfg->trace_every = 1;
+    cfg->stall_ms = 1000;
+    cfg->sink_interval_ms = 1000;
+    cfg->listen_fd = -1;
+}
+
+static int check_auth_config(const struct microsocks_config* cfg) {
+    if((cfg->user && !cfg->pass) || (!cfg->user && cfg->pass) || (cfg->auth_once && !cfg->pass)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+struct microsocks* microsocks_create(const struct microsocks_config* cfg) {
+    if(check_auth_config(cfg)) return 0;
+    struct microsocks *ms = calloc(1, sizeof *ms);
+    if(!ms) return 0;
+    ms->cfg = *cfg;
+    if(!ms->cfg.listenip) ms->cfg.listenip = "0.0.0.0";
+    if(!ms->cfg.sink_interval_ms) ms->cfg.sink_interval_ms = 1000;
+    ms->cfg.listenip = dupstr(ms->cfg.listenip);
+    /* the reloadable fields live in the policy snapshot only */
+    ms->cfg.user = ms->cfg.pass = ms->cfg.allow = 0;
+    ms->cfg.trace_path = dupstr(cfg->trace_path);
+    ms->cfg.capture_path = dupstr(cfg->capture_path);
+    ms->cfg.stats_path = dupstr(cfg->stats_path);
+    ms->server.fd = -1;
+    ms->stop_pipe[0] = ms->stop_pipe[1] = -1;
+    ms->handoff_pipe[0] = ms->handoff_pipe[1] = -1;
+    ms->handoff_sock = -1;
+    pthread_mutex_init(&ms->fd_lock, 0);
+    pthread_mutex_init(&ms->threads_lock, 0);
+    pthread_mutex_init(&ms->handoff_lock, 0);
+    pthread_mutex_init(&ms->state_lock, 0);
+    pthread_cond_init(&ms->state_cond, 0);
+    pthread_rwlock_init(&ms->auth_ips_lock, 0);
+    pthread_mutex_init(&ms->update_lock, 0);
+    slab_init(&ms->conn_slab, sizeof(struct thread), STATS_SLAB_CONN);
+    slab_init(&ms->flow_slab, sizeof(struct udp_flow), STATS_SLAB_FLOW);
+
+    if(!(ms->policy.cur = policy_new(cfg->user, cfg->pass, cfg->auth_once, cfg->allow)))
+        goto fail;
+    if(!ms->cfg.listenip ||
+       !(ms->threads = sblist_new(sizeof (struct thread*), 8)) ||
+       !(ms->auth_ips = sblist_new(sizeof(union sockaddr_union), 8))) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    char listenname[STATS_LISTENER_NAME_LEN];
+    snprintf(listenname, sizeof listenname, "%s:%u", ms->cfg.listenip, ms->cfg.port);
+    ms->listener = stats_listener_add(listenname);
+    if(ms->listener < 0) {
+        errno = ENOSPC;
+        goto fail;
+    }
+    if(pipe(ms->stop_pipe) || pipe(ms->handoff_pipe)) goto fail;
+    fcntl(ms->stop_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ms->stop_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(ms->handoff_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ms->handoff_pipe[1], F_SETFD, FD_CLOEXEC);
+    return ms;
+fail:
+    microsocks_destroy(ms);
+    return 0;
+}
+
+int microsocks_start(struct microsocks* ms) {
+    pthread_mutex_lock(&ms->state_lock);
+    int running = ms->running;
+    pthread_mutex_unlock(&ms->state_lock);
+    if(running) {
+        errno = EBUSY;
+        return -1;
+    }
+    if(ms->cfg.listen_fd != -1) {
+        /* handed over, only good for the first start */
+        ms->server.fd = ms->cfg.listen_fd;
+        ms->cfg.listen_fd = -1;
+    } else if(server_setup(&ms->server, ms->cfg.listenip, ms->cfg.port, ms->cfg.reuseport)) {
+        ms->server.fd = -1;
+        return -1;
+    }
+    fcntl(ms->server.fd, F_SETFL, fcntl(ms->server.fd, F_GETFL) | O_NONBLOCK);
+    /* children of the embedding process must not keep the port bound */
+    fcntl(ms->server.fd, F_SETFD, FD_CLOEXEC);
+    if(start_services(&ms->cfg)) goto fail;
+
+    /* writes to a peer that went away must fail with EPIPE rather than kill
+       the process, but leave alone a handler the embedder installed */
+    struct sigaction sa;
+    if(!sigaction(SIGPIPE, 0, &sa) && sa.sa_handler == SIG_DFL)
+        signal(SIGPIPE, SIG_IGN);
+
+    ms->stopping = 0;
+    if(pthread_create(&ms->accept_pt, 0, acceptthread, ms)) goto fail;
+    ms->accepting = 1;
+    ms->sink_started = (ms->cfg.log_sink || ms->cfg.stats_sink) &&
+                       !pthread_create(&ms->sink_pt, 0, sinkthread, ms);
+    pthread_mutex_lock(&ms->state_lock);
+    ms->running = 1;
+    pthread_mutex_unlock(&ms->state_lock);
+    return 0;
+fail:
+    close(ms->server.fd);
+    ms->server.fd = -1;
+    return -1;
+}
+
+void microsocks_wait(struct microsocks* ms) {
+    pthread_mutex_lock(&ms->state_lock);
+    while(ms->running) pthread_cond_wait(&ms->state_cond, &ms->state_lock);
+    pthread_mutex_unlock(&ms->state_lock);
+}
+
+/* only one caller gets to join the accept thread, be it drain or stop */
+static void stop_accepting(struct microsocks* ms) {
+    pthread_mutex_lock(&ms->state_lock);
+    int accepting = ms->accepting;
+    ms->accepting = 0;
+    pthread_mutex_unlock(&ms->state_lock);
+    if(!accepting) return;
+    char c = 0;
+    if(write(ms->stop_pipe[1], &c, 1) != 1) abort();
+    pthread_join(ms->accept_pt, 0);
+    if(read(ms->stop_pipe[0], &c, 1) != 1) abort();
+    close(ms->server.fd);
+    ms->server.fd = -1;
+}
+
+void microsocks_drain(struct microsocks* ms) {
+    stop_accepting(ms);
+}
+
+unsigned microsocks_active(struct microsocks* ms) {
+    return __atomic_load_n(&ms->active, __ATOMIC_RELAXED);
+}
+
+int microsocks_send_listener(struct microsocks* ms, int sock) {
+    pthread_mutex_lock(&ms->state_lock);
+    int accepting = ms->accepting;
+    pthread_mutex_unlock(&ms->state_lock);
+    if(!accepting) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct handoff_msg m;
+    memset(&m, 0, sizeof m);
+    m.version = HANDOFF_VERSION;
+    m.kind = HANDOFF_LISTENER;
+    snprintf(m.listener, sizeof m.listener, "%s:%u", ms->cfg.listenip, ms->cfg.port);
+    return handoff_send(sock, &m, &ms->server.fd, 1);
+}
+
+void microsocks_handoff(struct microsocks* ms, int sock) {
+    pthread_mutex_lock(&ms->handoff_lock);
+    ms->handoff_sock = sock;
+    pthread_mutex_unlock(&ms->handoff_lock);
+    stop_accepting(ms);
+    char c = 0;
+    if(sock != -1 && write(ms->handoff_pipe[1], &c, 1) != 1) abort();
+}
+
+int microsocks_adopt(struct microsocks* ms, const struct handoff_msg* m, int client_fd, int target_fd) {
+    struct thread *t = slab_alloc(&ms->conn_slab);
+    if(!t) return -1;
+    memset(t, 0, sizeof *t);
+    t->ms = ms;
+    t->listener = ms->listener;
+    t->id = __atomic_add_fetch(&ms->next_conn_id, 1, __ATOMIC_RELAXED);
+    t->client.fd = client_fd;
+    t->target_fd = target_fd;
+    socklen_t len = sizeof t->client.addr;
+    getpeername(client_fd, (struct sockaddr*) &t->client.addr, &len);
+    t->start_ns = stats_now_ns() - m->age_ns;
+    /* the previous process accounted for what was relayed so far */
+    t->bytes[STATS_UP] = t->bytes_flushed[STATS_UP] = m->bytes[STATS_UP];
+    t->bytes[STATS_DOWN] = t->bytes_flushed[STATS_DOWN] = m->bytes[STATS_DOWN];
+    snprintf(t->clientname, sizeof t->clientname, "%s", m->client);
+    snprintf(t->user, sizeof t->user, "%s", m->user);
+    snprintf(t->target, sizeof t->target, "%s", m->target);
+    t->policy = policy_acquire(&ms->policy);
+    /* held until the thread is listed, so stop either sees it or we see stop */
+    pthread_mutex_lock(&ms->state_lock);
+    if(!ms->running || ms->stopping || start_connection(ms, t, resumethread, 0)) {
+        pthread_mutex_unlock(&ms->state_lock);
+        policy_unref(t->policy);
+        slab_free(&ms->conn_slab, t);
+        return -1;
+    }
+    pthread_mutex_unlock(&ms->state_lock);
+    dolog("resumed tunnel %llu of the previous process as %llu: %s -> %s",
+          (unsigned long long) m->id, (unsigned long long) t->id, m->client, m->target);
+    return 0;
+}
+
+int microsocks_update(struct microsocks* ms, const struct microsocks_config* cfg) {
+    if(check_auth_config(cfg)) return -1;
+    struct policy *p = policy_new(cfg->user, cfg->pass, cfg->auth_once, cfg->allow);
+    if(!p) return -1;
+    pthread_mutex_lock(&ms->update_lock);
+    struct policy *old = ms->policy.cur;
+    /* ips whitelisted under other credentials have to log in again */
+    int reauth = !p->user || !old->user || strcmp(p->user, old->user) || strcmp(p->pass, old->pass);
+    policy_publish(&ms->policy, p);
+    pthread_mutex_unlock(&ms->update_lock);
+    if(reauth && !pthread_rwlock_wrlock(&ms->auth_ips_lock)) {
+        while(sblist_getsize(ms->auth_ips))
+            sblist_delete(ms->auth_ips, sblist_getsize(ms->auth_ips) - 1);
+        pthread_rwlock_unlock(&ms->auth_ips_lock);
+    }
+    return 0;
+}
+
+void microsocks_stop(struct microsocks* ms) {
+    pthread_mutex_lock(&ms->state_lock);
+    if(!ms->running || ms->stopping) {
+        pthread_mutex_unlock(&ms->state_lock);
+        return;
+    }
+    ms->stopping = 1;
+    pthread_mutex_unlock(&ms->state_lock);
+
+    stop_accepting(ms);
+    stop_connections(ms);
+
+    /* the sinks get to see everything the connections logged on the way out */
+    pthread_mutex_lock(&ms->state_lock);
+    ms->stopping = 2;
+    pthread_cond_broadcast(&ms->state_cond);
+    pthread_mutex_unlock(&ms->state_lock);
+    if(ms->sink_started) pthread_join(ms->sink_pt, 0);
+    ms->sink_started = 0;
+
+    pthread_mutex_lock(&ms->state_lock);
+    ms->running = 0;
+    ms->stopping = 0;
+    pthread_cond_broadcast(&ms->state_cond);
+    pthread_mutex_unlock(&ms->state_lock);
+}
+
+void microsocks_destroy(struct microsocks* ms) {
+    if(!ms) return;
+    microsocks_stop(ms);
+    if(ms->threads) sblist_free(ms->threads);
+    if(ms->auth_ips) sblist_free(ms->auth_ips);
+    if(ms->stop_pipe[0] != -1) close(ms->stop_pipe[0]);
+    if(ms->stop_pipe[1] != -1) close(ms->stop_pipe[1]);
+    if(ms->handoff_pipe[0] != -1) close(ms->handoff_pipe[0]);
+    if(ms->handoff_pipe[1] != -1) close(ms->handoff_pipe[1]);
+    free((char*) ms->cfg.listenip);
+    policy_unref(ms->policy.cur);
+    free((char*) ms->cfg.trace_path);
+    free((char*) ms->cfg.capture_path);
+    free((char*) ms->cfg.stats_path);
+    pthread_rwlock_destroy(&ms->auth_ips_lock);
+    pthread_mutex_destroy(&ms->update_lock);
+    pthread_cond_destroy(&ms->state_cond);
+    pthread_mutex_destroy(&ms->state_lock);
+    pthread_mutex_destroy(&ms->fd_lock);
+    pthread_mutex_destroy(&ms->threads_lock);
+    pthread_mutex_destroy(&ms->handoff_lock);
+    slab_destroy(&ms->conn_slab);
+    slab_destroy(&ms->flow_slab);
+    free(ms);
 }
 
 static int usage(void) {
     dprintf(2,
         "MicroSocks SOCKS5 Server\n"
         "------------------------\n"
-        "usage: microsocks -1 -q -i listenip -p port -u user -P password -b bindaddr\n"
+        "usage: microsocks -1 -q -i listenip -p port -u user -P password -a allow -f conffile -H handoffsock -F n -c maxconns -b bindaddr -m metricsport -T tracefile -t n -C capturefile -S statsfile -W stallms\n"
         "all arguments are optional.\n"
         "by default listenip is 0.0.0.0 and port 1080.\n\n"
         "option -q disables logging.\n"
+        "option -a only serves clients from the listed networks,\n"
+        "e.g. -a 10.0.0.0/8,::1\n"
+        "option -f reads listeners, user/pass, auth_once and allow from a file\n"
+        "and re-reads it on SIGHUP, see the readme\n"
+        "option -H takes over listeners and tunnels from a microsocks running\n"
+        "with the same unix socket path, which then exits\n"
+        "option -F runs n worker processes on SO_REUSEPORT listeners under a\n"
+        "supervisor that restarts them when they crash; the per connection\n"
+        "views (/connections, tcp_info samples) are per worker, -m has none\n"
+        "option -c refuses clients while maxconns connections are open\n"
+        "option -m serves prometheus metrics on 127.0.0.1:port\n"
+        "option -T writes a chrome trace-event file of every n-th connection,\n"
+        "n is set with -t and defaults to 1\n"
+        "option -C records the anonymised shape of every tunnel into a\n"
+        "binary file that bench/replay plays back\n"
+        "option -S publishes all counters to a mmap-able file, see microsocks-stat\n"
+        "option -W logs connections stuck in one phase for longer than stallms\n"
+        "(default 1000, 0 disables the reports)\n"
         "option -b specifies which ip outgoing connections are bound to\n"
         "option -1 activates auth_once mode: once a specific ip address\n"
         "authed successfully with user/pass, it is added to a whitelist\n"
@@ -853,29 +1620,64 @@ static void zero_arg(char *s) {
 
 int socks_main(int argc, char** argv) {
     int ch;
-    const char *listenip = "0.0.0.0";
-    unsigned port = 1080;
-    while((ch = getopt(argc, argv, ":1qi:p:u:P:")) != -1) {
+    struct microsocks_config cfg;
+    const char *conffile = 0, *handoff = 0;
+    unsigned workers = 0;
+    microsocks_config_init(&cfg);
+    while((ch = getopt(argc, argv, ":1qi:p:u:P:a:f:H:F:c:m:T:t:C:S:W:")) != -1) {
         switch(ch) {
             case '1':
-                auth_ips = sblist_new(sizeof(union sockaddr_union), 8);
+                cfg.auth_once = 1;
                 break;
             case 'q':
                 quiet = 1;
                 break;
             case 'u':
-                auth_user = strdup(optarg);
+                cfg.user = strdup(optarg);
                 zero_arg(optarg);
                 break;
             case 'P':
-                auth_pass = strdup(optarg);
+                cfg.pass = strdup(optarg);
                 zero_arg(optarg);
                 break;
+            case 'a':
+                cfg.allow = optarg;
+                break;
+            case 'f':
+                conffile = optarg;
+                break;
+            case 'H':
+                handoff = optarg;
+                break;
+            case 'F':
+                workers = atoi(optarg);
+                break;
+            case 'c':
+                cfg.max_conns = atoi(optarg);
+                break;
             case 'i':
-                listenip = optarg;
+                cfg.listenip = optarg;
                 break;
             case 'p':
-                port = atoi(optarg);
+                cfg.port = atoi(optarg);
+                break;
+            case 'm':
+                cfg.metrics_port = atoi(optarg);
+                break;
+            case 'T':
+                cfg.trace_path = optarg;
+                break;
+            case 't':
+                cfg.trace_every = atoi(optarg);
+                break;
+            case 'C':
+                cfg.capture_path = optarg;
+                break;
+            case 'S':
+                cfg.stats_path = optarg;
+                break;
+            case 'W':
+                cfg.stall_ms = atoi(optarg);
                 break;
             case ':':
                 dprintf(2, "error: option -%c requires an operand\n", optopt);
@@ -884,52 +1686,31 @@ int socks_main(int argc, char** argv) {
                 return usage();
         }
     }
-    if((auth_user && !auth_pass) || (!auth_user && auth_pass)) {
+    if((cfg.user && !cfg.pass) || (!cfg.user && cfg.pass)) {
         dprintf(2, "error: user and pass must be used together\n");
         return 1;
     }
-    if(auth_ips && !auth_pass) {
+    if(cfg.auth_once && !cfg.pass) {
         dprintf(2, "error: auth-once option must be used together with user/pass\n");
         return 1;
     }
-    signal(SIGPIPE, SIG_IGN);
-    struct server s;
-    sblist *threads = sblist_new(sizeof (struct thread*), 8);
-    if(server_setup(&s, listenip, port)) {
-        perror("server_setup");
+    if(workers && handoff) {
+        dprintf(2, "error: -F and -H can't be used together\n");
         return 1;
     }
-    server = &s;
-
-    while(1) {
-        collect(threads);
-        struct client c;
-        struct thread *curr = malloc(sizeof (struct thread));
-        if(!curr) goto oom;
-        curr->done = 0;
-        if(server_waitclient(&s, &c)) {
-            dolog("failed to accept connection\n");
-            free(curr);
-            usleep(FAILURE_TIMEOUT);
-            continue;
-        }
-        curr->client = c;
-        if(!sblist_add(threads, &curr)) {
-            close(curr->client.fd);
-            free(curr);
-            oom:
-            dolog("rejecting connection due to OOM\n");
-            usleep(FAILURE_TIMEOUT); /* prevent 100% CPU usage in OOM situation */
-            continue;
-        }
-        pthread_attr_t *a = 0, attr;
-        if(pthread_attr_init(&attr) == 0) {
-            a = &attr;
-            pthread_attr_setstacksize(a, THREAD_STACK_SIZE);
-        }
-        if(pthread_create(&curr->pt, a, clientthread, curr) != 0)
-            dolog("pthread_create failed. OOM?\n");
-        if(a) pthread_attr_destroy(&attr);
+    if(workers) return prefork_run(workers, conffile, &cfg);
+    if(conffile || handoff) return reload_run(conffile, handoff, &cfg);
+    struct microsocks *ms = microsocks_create(&cfg);
+    if(!ms) {
+        perror("microsocks_create");
+        return 1;
     }
+    if(microsocks_start(ms)) {
+        perror("server_setup");
+        microsocks_destroy(ms);
+        return 1;
+    }
+    microsocks_wait(ms);
+    microsocks_destroy(ms);
+    return 0;
 }
-
@@ -35,8 +35,8 @@ enum socks5_cmd {
     UDP_ASSOCIATE = 3,
 };
 
-const int VERSION = 5;
-const int RSV = 0;
+static const int VERSION = 5;
+static const int RSV = 0;
 
 enum socks5_addr_type {
     SOCKS5_ADDR_UNKNOWN = 0,
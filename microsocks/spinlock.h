@@ -0,0 +1,35 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <sched.h>
+#include <unistd.h>
+
+/* spinlocks for the few sections that prefork workers share through the
+   stats memory. the lock word holds the pid of the process that holds it
+   (0 when free), so when a worker dies inside a section the supervisor
+   can give the lock back with spin_unlock_dead() as it reaps the worker.
+   waiters give up the cpu after a short spin, a descheduled holder would
+   otherwise have every waiter burn a core. */
+
+static inline void spin_lock(int *l) {
+    int pid = getpid(), free;
+    unsigned spins = 0;
+    for(;;) {
+        free = 0;
+        if(__atomic_compare_exchange_n(l, &free, pid, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return;
+        while(__atomic_load_n(l, __ATOMIC_RELAXED))
+            if(++spins % 64 == 0) sched_yield();
+    }
+}
+
+static inline void spin_unlock(int *l) {
+    __atomic_store_n(l, 0, __ATOMIC_RELEASE);
+}
+
+/* releases l if the dead process pid still holds it, returns 1 if so */
+static inline int spin_unlock_dead(int *l, int pid) {
+    return __atomic_compare_exchange_n(l, &pid, 0, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+#endif
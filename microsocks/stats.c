@@ -0,0 +1,135 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#include "stats.h"
+#include "spinlock.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static struct stats stats_storage;
+struct stats *stats = &stats_storage;
+int stats_child = -1;
+
+const char* stats_phase_names[STATS_PHASE_COUNT] = {
+    "accept", "handshake", "auth", "resolve", "connect", "relay", "udp",
+};
+
+/* a spinlock inside the stats, so prefork children exclude each other */
+int stats_listener_add(const char *name) {
+    int ret = -1;
+    spin_lock(&stats->listener_lock);
+    unsigned i;
+    /* a listener that is set up again keeps counting where it left off */
+    for(i = 0; i < stats->n_listeners; i++)
+        if(!strcmp(stats->listeners[i].name, name)) {
+            ret = i;
+            goto out;
+        }
+    if(i < STATS_MAX_LISTENERS) {
+        struct stats_listener *l = &stats->listeners[i];
+        memset(l, 0, sizeof *l);
+        strncpy(l->name, name, sizeof l->name - 1);
+        /* publish only once the slot is fully initialised */
+        __atomic_store_n(&stats->n_listeners, i + 1, __ATOMIC_RELEASE);
+        ret = i;
+    }
+out:
+    spin_unlock(&stats->listener_lock);
+    return ret;
+}
+
+int stats_share(void) {
+    void *p = mmap(0, sizeof *stats, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED) return -1;
+    memcpy(p, stats, sizeof *stats);
+    stats = p;
+    return 0;
+}
+
+void stats_child_reap(int child, int pid) {
+    struct stats_child *c = &stats->children[child];
+    unsigned i;
+    uint64_t n;
+    /* a child killed inside one of the shared sections would leave every
+       other child spinning on it. the section's data may be half updated,
+       which only costs a listener slot or a sketch entry. */
+    spin_unlock_dead(&stats->listener_lock, pid);
+    for(i = 0; i < STATS_TOPK_COUNT; i++) {
+        spin_unlock_dead(&stats->top_bytes[i].lock, pid);
+        spin_unlock_dead(&stats->top_conns[i].lock, pid);
+    }
+    for(i = 0; i < STATS_MAX_LISTENERS; i++)
+        if((n = __atomic_exchange_n(&c->listener_active[i], 0, __ATOMIC_RELAXED)))
+            STATS_SUB(listeners[i].active, n);
+    if((n = __atomic_exchange_n(&c->conns_active, 0, __ATOMIC_RELAXED)))
+        STATS_SUB(conns_active, n);
+    if((n = __atomic_exchange_n(&c->udp_flows_active, 0, __ATOMIC_RELAXED)))
+        STATS_SUB(udp_flows_active, n);
+    for(i = 0; i < STATS_SLAB_COUNT; i++) {
+        if((n = __atomic_exchange_n(&c->slab_objects[i], 0, __ATOMIC_RELAXED)))
+            STATS_SUB(slab_objects[i], n);
+        if((n = __atomic_exchange_n(&c->slab_capacity[i], 0, __ATOMIC_RELAXED)))
+            STATS_SUB(slab_capacity[i], n);
+        if((n = __atomic_exchange_n(&c->slab_bytes[i], 0, __ATOMIC_RELAXED)))
+            STATS_SUB(slab_bytes[i], n);
+    }
+}
+
+void stats_handshake_done(int ec) {
+    if(ec < 0) ec = -ec;
+    if(ec >= STATS_NUM_ERRORCODES) ec = 1; /* EC_GENERAL_FAILURE */
+    STATS_ADD(handshakes[ec], 1);
+}
+
+void stats_max(uint64_t *field, uint64_t val) {
+    uint64_t cur = __atomic_load_n(field, __ATOMIC_RELAXED);
+    while(val > cur &&
+          !__atomic_compare_exchange_n(field, &cur, val, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_latency(enum stats_lat lat, uint64_t start_ns) {
+    hist_record(&stats->latency[lat], (stats_now_ns() - start_ns) / 1000);
+}
+
+void stats_syscalls_flush(uint64_t sc[STATS_SYSC_COUNT]) {
+    int i;
+    for(i = 0; i < STATS_SYSC_COUNT; i++) if(sc[i]) {
+        STATS_ADD(syscalls[i], sc[i]);
+        sc[i] = 0;
+    }
+}
+
+#if CONFIG_PHASE_CPU
+static __thread enum stats_phase cur_phase = STATS_PHASE_NONE, saved_phase = STATS_PHASE_NONE;
+static __thread uint64_t phase_mark;
+
+void stats_phase_enter(enum stats_phase p) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if(cur_phase != STATS_PHASE_NONE) STATS_ADD(phase_cpu_ns[cur_phase], now - phase_mark);
+    cur_phase = p;
+    phase_mark = now;
+}
+
+void stats_phase_push(enum stats_phase p) {
+    saved_phase = cur_phase;
+    stats_phase_enter(p);
+}
+
+void stats_phase_pop(void) {
+    stats_phase_enter(saved_phase);
+}
+#endif
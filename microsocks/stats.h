@@ -0,0 +1,205 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include "hist.h"
+#include "topk.h"
+#include "tcpinfo.h"
+
+/* process wide counters and gauges.
+   the data path only ever does relaxed atomic adds on these, readers
+   (the metrics endpoint) do relaxed atomic loads, so nothing on either
+   side takes a lock. */
+
+#define STATS_MAX_LISTENERS 8
+#define STATS_LISTENER_NAME_LEN 64
+/* one slot per enum errorcode, EC_SUCCESS .. EC_BIND_IP_NOT_PROVIDED */
+#define STATS_NUM_ERRORCODES 10
+
+enum stats_dir {
+    STATS_UP = 0,   /* client -> target */
+    STATS_DOWN = 1, /* target -> client */
+};
+
+/* tunnel phases with a latency histogram each */
+enum stats_lat {
+    STATS_LAT_HANDSHAKE = 0,  /* greeting received -> request received */
+    STATS_LAT_RESOLVE,        /* target name resolution */
+    STATS_LAT_CONNECT,        /* target connect() */
+    STATS_LAT_FIRST_UP,       /* tunnel up -> first byte from client */
+    STATS_LAT_FIRST_DOWN,     /* tunnel up -> first byte from target */
+    STATS_LAT_COUNT,
+};
+
+/* dimensions with a heavy hitter sketch each */
+enum stats_topk {
+    STATS_TOPK_CLIENT = 0,
+    STATS_TOPK_USER,
+    STATS_TOPK_TARGET,
+    STATS_TOPK_COUNT,
+};
+
+/* object caches, see slab.h */
+enum stats_slab {
+    STATS_SLAB_CONN = 0,      /* connection descriptors */
+    STATS_SLAB_FLOW,          /* udp flows */
+    STATS_SLAB_COUNT,
+};
+
+/* tunnels feed the byte sketches in chunks of this size (and once more
+   when they close), so the sketch locks stay off the per-read path. */
+#define STATS_TOPK_FLUSH_BYTES (64*1024)
+
+/* syscall accounting in the relay loops. tunnels count into a local
+   array and fold it into the shared counters together with the topk
+   flushes, so the cost is a few increments per read. */
+#ifndef CONFIG_SYSCALL_STATS
+#define CONFIG_SYSCALL_STATS 1
+#endif
+
+enum stats_sysc {
+    STATS_SYSC_READ = 0,  /* read/recv/recvfrom */
+    STATS_SYSC_WRITE,     /* write/send */
+    STATS_SYSC_WAIT,      /* poller waits that returned */
+    STATS_SYSC_SPURIOUS,  /* wakeups that moved no data */
+    STATS_SYSC_EAGAIN,    /* reads or writes failing with EAGAIN */
+    STATS_SYSC_COUNT,
+};
+
+/* cpu time per connection phase, measured with the thread cpu clock at
+   phase boundaries only. since every connection runs on its own thread,
+   time spent blocked in recv() or getaddrinfo() is not charged. */
+#ifndef CONFIG_PHASE_CPU
+#define CONFIG_PHASE_CPU 1
+#endif
+
+enum stats_phase {
+    STATS_PHASE_ACCEPT = 0, /* accept loop, thread hand off and reaping */
+    STATS_PHASE_HANDSHAKE,  /* greeting and request parsing, replies */
+    STATS_PHASE_AUTH,       /* username/password check */
+    STATS_PHASE_RESOLVE,    /* target name resolution */
+    STATS_PHASE_CONNECT,    /* target connect() */
+    STATS_PHASE_RELAY,      /* tcp tunnel copy loop */
+    STATS_PHASE_UDP,        /* udp associate encapsulation */
+    STATS_PHASE_COUNT,
+};
+#define STATS_PHASE_NONE STATS_PHASE_COUNT
+
+extern const char* stats_phase_names[STATS_PHASE_COUNT];
+
+struct stats_listener {
+    char name[STATS_LISTENER_NAME_LEN];
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t active;
+    /* tcp and udp payload, updated in chunks of STATS_TOPK_FLUSH_BYTES */
+    uint64_t bytes[2];
+    /* sampled per leg, see tcpinfo.h */
+    struct hist_shard tcpinfo[2][TCPINFO_COUNT];
+};
+
+/* prefork mode (prefork.h): every child process owns one of these and
+   keeps its share of the gauges here too, so the supervisor can take back
+   what a crashed child left behind. */
+#define STATS_MAX_CHILDREN 64
+
+struct stats_child {
+    uint64_t pid;
+    uint64_t restarts;
+    uint64_t conns_active;
+    uint64_t listener_active[STATS_MAX_LISTENERS];
+    uint64_t udp_flows_active;
+    uint64_t slab_objects[STATS_SLAB_COUNT];
+    uint64_t slab_capacity[STATS_SLAB_COUNT];
+    uint64_t slab_bytes[STATS_SLAB_COUNT];
+};
+
+struct stats {
+    struct stats_listener listeners[STATS_MAX_LISTENERS];
+    unsigned n_listeners;
+    int listener_lock;   /* see spinlock.h */
+    uint64_t handshakes[STATS_NUM_ERRORCODES];
+    uint64_t bytes[2];
+    uint64_t udp_packets[2];
+    uint64_t udp_bytes[2];
+    uint64_t udp_flows;
+    uint64_t udp_flows_active;
+    uint64_t conns_active;    /* all listeners, what max_conns limits */
+    /* slab occupancy: objects in use, room for objects in the chunks
+       held, and the memory of those chunks */
+    uint64_t slab_objects[STATS_SLAB_COUNT];
+    uint64_t slab_capacity[STATS_SLAB_COUNT];
+    uint64_t slab_bytes[STATS_SLAB_COUNT];
+    uint64_t dns_lookups;
+    uint64_t dns_failures;
+    uint64_t dns_lookup_ns;
+    /* time the accept loop spent between two accept() calls */
+    uint64_t accept_lag_ns;
+    uint64_t accept_lag_max_ns;
+    uint64_t syscalls[STATS_SYSC_COUNT];
+    uint64_t phase_cpu_ns[STATS_PHASE_COUNT];
+    /* see watchdog.h */
+    uint64_t heartbeat_lag_max_ns;
+    uint64_t callback_max_ns;
+    uint64_t stalls[STATS_PHASE_COUNT];
+    struct hist heartbeat_lag;
+    struct hist poll_batch;   /* events per poller wakeup */
+    struct hist callback[STATS_PHASE_COUNT];
+    struct hist latency[STATS_LAT_COUNT];
+    struct topk top_bytes[STATS_TOPK_COUNT];
+    struct topk top_conns[STATS_TOPK_COUNT];
+    unsigned n_children;
+    struct stats_child children[STATS_MAX_CHILDREN];
+};
+
+extern struct stats *stats;
+/* index into stats->children in a prefork child, -1 otherwise */
+extern int stats_child;
+
+#define STATS_ADD(FIELD, N) __atomic_fetch_add(&stats->FIELD, (N), __ATOMIC_RELAXED)
+#define STATS_SUB(FIELD, N) __atomic_fetch_sub(&stats->FIELD, (N), __ATOMIC_RELAXED)
+#define STATS_SET(FIELD, N) __atomic_store_n(&stats->FIELD, (N), __ATOMIC_RELAXED)
+#define STATS_GET(FIELD) __atomic_load_n(&stats->FIELD, __ATOMIC_RELAXED)
+/* for gauges with a per child share, CHILD names the field in stats_child */
+#define STATS_GAUGE_ADD(FIELD, CHILD, N) do { \
+    STATS_ADD(FIELD, N); \
+    if(stats_child >= 0) STATS_ADD(children[stats_child].CHILD, N); } while(0)
+#define STATS_GAUGE_SUB(FIELD, CHILD, N) do { \
+    STATS_SUB(FIELD, N); \
+    if(stats_child >= 0) STATS_SUB(children[stats_child].CHILD, N); } while(0)
+
+/* returns listener index to be used with STATS_ADD(listeners[i].x, ...),
+   or -1 if all slots are taken. names already registered get their old
+   index back. */
+int stats_listener_add(const char *name);
+void stats_handshake_done(int ec);
+void stats_max(uint64_t *field, uint64_t val);
+uint64_t stats_now_ns(void);
+/* records the time elapsed since start_ns (from stats_now_ns()) */
+void stats_latency(enum stats_lat lat, uint64_t start_ns);
+/* adds the locally counted syscalls to the totals and zeroes them */
+void stats_syscalls_flush(uint64_t sc[STATS_SYSC_COUNT]);
+/* moves the counters into memory that survives fork() shared, to be
+   called before any other thread runs */
+int stats_share(void);
+/* subtracts the gauges a dead prefork child still held from the totals
+   and releases the stats locks its process pid still held */
+void stats_child_reap(int child, int pid);
+
+#if CONFIG_PHASE_CPU
+/* charges the calling thread's cpu time since its last phase change to
+   the current phase, then switches to p. push/pop nest one level deep,
+   for phases like RESOLVE that can interrupt any other. */
+void stats_phase_enter(enum stats_phase p);
+void stats_phase_push(enum stats_phase p);
+void stats_phase_pop(void);
+#define STATS_PHASE(P) stats_phase_enter(STATS_PHASE_##P)
+#define STATS_PHASE_PUSH(P) stats_phase_push(STATS_PHASE_##P)
+#define STATS_PHASE_POP() stats_phase_pop()
+#else
+#define STATS_PHASE(P) do {} while(0)
+#define STATS_PHASE_PUSH(P) do {} while(0)
+#define STATS_PHASE_POP() do {} while(0)
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+#define _GNU_SOURCE
+#include "tcpinfo.h"
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#if defined(__linux__)
+#include <linux/tcp.h>
+#elif defined(__APPLE__)
+#include <netinet/tcp.h>
+#endif
+
+int tcpinfo_get(int fd, struct tcpinfo_sample *out) {
+    memset(out, 0, sizeof *out);
+#if defined(__linux__)
+    struct tcp_info ti;
+    socklen_t len = sizeof ti;
+    memset(&ti, 0, sizeof ti);
+    if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len)) return -1;
+    out->v[TCPINFO_RTT] = ti.tcpi_rtt;
+    out->v[TCPINFO_RETRANS] = ti.tcpi_total_retrans;
+    out->v[TCPINFO_CWND] = ti.tcpi_snd_cwnd;
+    /* older kernels return a shorter struct without the rate */
+    if(len >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof ti.tcpi_delivery_rate)
+        out->v[TCPINFO_RATE] = ti.tcpi_delivery_rate;
+    return 0;
+#elif defined(__APPLE__) && defined(TCP_CONNECTION_INFO)
+    struct tcp_connection_info ti;
+    socklen_t len = sizeof ti;
+    if(getsockopt(fd, IPPROTO_TCP, TCP_CONNECTION_INFO, &ti, &len)) return -1;
+    out->v[TCPINFO_RTT] = (uint64_t) ti.tcpi_srtt * 1000;
+    out->v[TCPINFO_RETRANS] = ti.tcpi_txretransmitpackets;
+    out->v[TCPINFO_CWND] = ti.tcpi_maxseg ? ti.tcpi_snd_cwnd / ti.tcpi_maxseg : 0;
+    return 0;
+#else
+    (void) fd;
+    return -1;
+#endif
+}
@@ -0,0 +1,30 @@
+#ifndef TCPINFO_H
+#define TCPINFO_H
+
+#include <stdint.h>
+
+/* low rate sampling of the kernel's per-socket tcp state, to tell whether
+   a slow tunnel is slow on the client leg or on the target leg. the
+   watchdog samples one relaying tunnel per tick, see watchdog.c. */
+
+enum tcpinfo_leg {
+    TCPINFO_CLIENT = 0,
+    TCPINFO_TARGET = 1,
+};
+
+enum tcpinfo_metric {
+    TCPINFO_RTT = 0,    /* smoothed rtt, microseconds */
+    TCPINFO_RETRANS,    /* retransmitted segments over the connection's life */
+    TCPINFO_CWND,       /* congestion window, segments */
+    TCPINFO_RATE,       /* delivery rate, bytes per second (linux only) */
+    TCPINFO_COUNT,
+};
+
+struct tcpinfo_sample {
+    uint64_t v[TCPINFO_COUNT];
+};
+
+/* returns 0 on success, -1 if unsupported or not a tcp socket */
+int tcpinfo_get(int fd, struct tcpinfo_sample *out);
+
+#endif
@@ -0,0 +1,87 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "topk.h"
+#include "spinlock.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* a spinlock rather than a mutex: the critical sections are a scan over
+   TOPK_SLOTS entries, and it works unchanged in shared memory. */
+static void lock(struct topk *t) {
+    spin_lock(&t->lock);
+}
+
+static void unlock(struct topk *t) {
+    spin_unlock(&t->lock);
+}
+
+static uint64_t fnv1a(const char* s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(; *s; s++) h = (h ^ (unsigned char) *s) * 0x100000001b3ULL;
+    return h;
+}
+
+static uint64_t epoch_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec / TOPK_HALFLIFE;
+}
+
+static void decay(struct topk *t, uint64_t now) {
+    uint64_t shift = now - t->epoch;
+    unsigned i;
+    t->epoch = now;
+    if(shift > 63) shift = 63;
+    for(i = 0; i < t->used; i++) {
+        t->e[i].count >>= shift;
+        t->e[i].error >>= shift;
+    }
+}
+
+void topk_add(struct topk *t, const char* key, uint64_t weight) {
+    uint64_t h = fnv1a(key), now = epoch_now();
+    unsigned i, min = 0;
+    lock(t);
+    if(now != t->epoch) decay(t, now);
+    for(i = 0; i < t->used; i++) {
+        struct topk_entry *e = &t->e[i];
+        if(e->hash == h && !strncmp(e->key, key, TOPK_KEY_LEN - 1)) {
+            e->count += weight;
+            goto out;
+        }
+        if(e->count < t->e[min].count) min = i;
+    }
+    struct topk_entry *e;
+    if(t->used < TOPK_SLOTS) {
+        e = &t->e[t->used++];
+        e->error = 0;
+        e->count = weight;
+    } else {
+        /* evict the smallest counter, its count becomes our error bound */
+        e = &t->e[min];
+        e->error = e->count;
+        e->count += weight;
+    }
+    e->hash = h;
+    e->key[TOPK_KEY_LEN - 1] = 0;
+    strncpy(e->key, key, TOPK_KEY_LEN - 1);
+out:
+    unlock(t);
+}
+
+static int cmp_count(const void *a, const void *b) {
+    const struct topk_entry *x = a, *y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+unsigned topk_query(struct topk *t, struct topk_entry *out) {
+    uint64_t now = epoch_now();
+    lock(t);
+    if(now != t->epoch) decay(t, now);
+    unsigned n = t->used;
+    memcpy(out, t->e, n * sizeof *out);
+    unlock(t);
+    qsort(out, n, sizeof *out, cmp_count);
+    return n;
+}
@@ -0,0 +1,34 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <stdint.h>
+
+/* space-saving heavy hitter sketch with a fixed number of slots.
+   keys are copied (and truncated) into the slots, so updates never
+   allocate. counts are halved every TOPK_HALFLIFE seconds so the sketch
+   follows what is heavy right now rather than since startup.
+   a slot's true count lies in [count - error, count]. */
+
+#define TOPK_SLOTS 32
+#define TOPK_KEY_LEN 128
+#define TOPK_HALFLIFE 10
+
+struct topk_entry {
+    uint64_t hash;
+    uint64_t count;
+    uint64_t error;
+    char key[TOPK_KEY_LEN];
+};
+
+struct topk {
+    int lock;            /* pid of the holder, see spinlock.h */
+    unsigned used;
+    uint64_t epoch;
+    struct topk_entry e[TOPK_SLOTS];
+};
+
+void topk_add(struct topk *t, const char* key, uint64_t weight);
+/* copies the current entries sorted by count, returns number of entries */
+unsigned topk_query(struct topk *t, struct topk_entry *out);
+
+#endif
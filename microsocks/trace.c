@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* events beyond this are dropped, it bounds memory for long tunnels */
+#define TRACE_MAX_EVENTS 256
+
+struct trace_event {
+    const char* name;
+    const char* arg;
+    uint64_t start;
+    uint64_t end;
+    uint64_t val;
+};
+
+struct trace_buf {
+    uint64_t id;
+    unsigned count;
+    unsigned dropped;
+    struct trace_event ev[TRACE_MAX_EVENTS];
+};
+
+static FILE* trace_file;
+static unsigned trace_every;
+static uint64_t trace_epoch;
+static uint64_t trace_seen;
+static int trace_first = 1;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct trace_buf *cur;
+
+static unsigned long trace_tid(void) {
+#if defined(__linux__)
+    return syscall(SYS_gettid);
+#elif defined(__APPLE__)
+    uint64_t tid;
+    pthread_threadid_np(0, &tid);
+    return tid;
+#else
+    return (unsigned long) pthread_self();
+#endif
+}
+
+int trace_open(const char* path, unsigned every) {
+    if(!(trace_file = fopen(path, "w"))) return -1;
+    trace_every = every ? every : 1;
+    trace_epoch = stats_now_ns();
+    /* the closing bracket is optional in the trace-event array format,
+       which lets us append for as long as the process lives. */
+    fprintf(trace_file, "[\n");
+    fflush(trace_file);
+    return 0;
+}
+
+void trace_conn_start(uint64_t id) {
+    cur = 0;
+    if(!trace_file) return;
+    if(__atomic_fetch_add(&trace_seen, 1, __ATOMIC_RELAXED) % trace_every) return;
+    if(!(cur = malloc(sizeof *cur))) return;
+    cur->id = id;
+    cur->count = 0;
+    cur->dropped = 0;
+}
+
+int trace_active(void) {
+    return cur != 0;
+}
+
+void trace_span(const char* name, uint64_t start_ns, uint64_t end_ns, const char* arg, uint64_t val) {
+    if(!cur) return;
+    if(cur->count == TRACE_MAX_EVENTS) {
+        cur->dropped++;
+        return;
+    }
+    struct trace_event *e = &cur->ev[cur->count++];
+    e->name = name;
+    e->arg = arg;
+    e->start = start_ns;
+    e->end = end_ns;
+    e->val = val;
+}
+
+static void sep(void) {
+    if(!trace_first) fprintf(trace_file, ",\n");
+    trace_first = 0;
+}
+
+void trace_conn_end(void) {
+    if(!cur) return;
+    unsigned i;
+    long pid = getpid();
+    unsigned long tid = trace_tid();
+    pthread_mutex_lock(&trace_lock);
+    sep();
+    fprintf(trace_file, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%ld,\"tid\":%lu,"
+        "\"args\":{\"name\":\"conn %llu\"}}", pid, tid, (unsigned long long) cur->id);
+    for(i = 0; i < cur->count; i++) {
+        struct trace_event *e = &cur->ev[i];
+        /* a tunnel adopted on upgrade started before our epoch, in the
+           previous process, so its connection span has a negative ts */
+        double ts = ((int64_t) e->start - (int64_t) trace_epoch) / 1e3;
+        sep();
+        fprintf(trace_file, "{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%ld,\"tid\":%lu,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"conn\":%llu",
+            e->name, pid, tid, ts, (e->end - e->start) / 1e3, (unsigned long long) cur->id);
+        if(e->arg) fprintf(trace_file, ",\"%s\":%llu", e->arg, (unsigned long long) e->val);
+        fprintf(trace_file, "}}");
+    }
+    if(cur->dropped) {
+        sep();
+        fprintf(trace_file, "{\"ph\":\"i\",\"name\":\"dropped\",\"s\":\"t\",\"pid\":%ld,\"tid\":%lu,"
+            "\"ts\":%.3f,\"args\":{\"conn\":%llu,\"events\":%u}}", pid, tid,
+            (stats_now_ns() - trace_epoch) / 1e3, (unsigned long long) cur->id, cur->dropped);
+    }
+    fflush(trace_file);
+    pthread_mutex_unlock(&trace_lock);
+    free(cur);
+    cur = 0;
+}
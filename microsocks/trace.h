@@ -0,0 +1,20 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* opt-in sampling tracer writing chrome trace-event json, which can be
+   opened in perfetto or chrome://tracing.
+   every n-th connection gets a small event buffer that is written out
+   in one go when the connection ends; connections that are not sampled
+   only pay for a thread-local NULL check per span. */
+
+int trace_open(const char* path, unsigned every);
+/* decides whether the connection served by the calling thread is sampled */
+void trace_conn_start(uint64_t id);
+void trace_conn_end(void);
+int trace_active(void);
+/* records a complete span for the current connection, if it is sampled */
+void trace_span(const char* name, uint64_t start_ns, uint64_t end_ns, const char* arg, uint64_t val);
+
+#endif
@@ -0,0 +1,105 @@
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "watchdog.h"
+#include "stats.h"
+#include "logring.h"
+#include <pthread.h>
+#include <time.h>
+
+static uint64_t stall_ns;
+
+static void callback_done(struct conntab_slot* slot, uint64_t now_ns) {
+    uint64_t since = slot->busy_ns;
+    if(!since) return;
+    uint64_t d = now_ns > since ? now_ns - since : 0;
+    hist_record(&stats->callback[slot->phase], d / 1000);
+    stats_max(&stats->callback_max_ns, d);
+}
+
+void watchdog_busy(struct conntab_slot* slot, int phase, uint64_t now_ns) {
+    if(!slot) return;
+    callback_done(slot, now_ns);
+    __atomic_store_n(&slot->phase, phase, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->busy_ns, now_ns, __ATOMIC_RELEASE);
+}
+
+void watchdog_idle(struct conntab_slot* slot) {
+    if(!slot || !slot->busy_ns) return;
+    callback_done(slot, stats_now_ns());
+    __atomic_store_n(&slot->busy_ns, 0, __ATOMIC_RELAXED);
+}
+
+static void check_slots(uint64_t now) {
+    unsigned i;
+    for(i = 0; i < CONNTAB_SLOTS; i++) {
+        struct conntab_slot *s = &conntab[i];
+        uint64_t id = __atomic_load_n(&s->id, __ATOMIC_ACQUIRE);
+        if(!id || id == CONNTAB_CLAIMING) continue;
+        uint64_t busy = __atomic_load_n(&s->busy_ns, __ATOMIC_ACQUIRE);
+        /* report every busy period once */
+        if(!busy || now - busy < stall_ns || s->stall_reported == busy) continue;
+        s->stall_reported = busy;
+        int phase = __atomic_load_n(&s->phase, __ATOMIC_RELAXED);
+        STATS_ADD(stalls[phase], 1);
+        logring_printf("stall: connection %llu (%s -> %s) busy in %s for %llu ms",
+            (unsigned long long) id, s->client, s->target[0] ? s->target : "-",
+            stats_phase_names[phase], (unsigned long long) ((now - busy) / 1000000));
+    }
+}
+
+/* one relaying tunnel per tick, round robin, whether it is moving data or
+   not: stalled and idle tunnels are the interesting ones. a tunnel may
+   close its sockets while they are sampled and the numbers be reused, so
+   samples are only kept if the slot still publishes the same fds after. */
+static void sample_tcpinfo(uint64_t now) {
+    static unsigned cursor;
+    unsigned i, leg, m;
+    for(i = 0; i < CONNTAB_SLOTS; i++) {
+        struct conntab_slot *s = &conntab[cursor++ % CONNTAB_SLOTS];
+        uint64_t id = __atomic_load_n(&s->id, __ATOMIC_ACQUIRE);
+        if(!id || id == CONNTAB_CLAIMING) continue;
+        int fds[2] = { __atomic_load_n(&s->fds[0], __ATOMIC_SEQ_CST), __atomic_load_n(&s->fds[1], __ATOMIC_SEQ_CST) };
+        if(fds[0] == -1 || fds[1] == -1) continue;
+        struct tcpinfo_sample ti[2];
+        int ok[2];
+        for(leg = 0; leg < 2; leg++) ok[leg] = !tcpinfo_get(fds[leg], &ti[leg]);
+        if(__atomic_load_n(&s->fds[0], __ATOMIC_SEQ_CST) != fds[0] ||
+           __atomic_load_n(&s->fds[1], __ATOMIC_SEQ_CST) != fds[1] ||
+           __atomic_load_n(&s->id, __ATOMIC_ACQUIRE) != id) return;
+        for(leg = 0; leg < 2; leg++) {
+            if(!ok[leg]) continue;
+            for(m = 0; m < TCPINFO_COUNT; m++)
+                hist_shard_record(&stats->listeners[s->listener].tcpinfo[leg][m], ti[leg].v[m]);
+            s->tcpinfo[leg] = ti[leg];
+        }
+        s->tcpinfo_ns = now;
+        return;
+    }
+}
+
+static void* watchdog_thread(void *data) {
+    (void) data;
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = WATCHDOG_INTERVAL_MS * 1000000L };
+    while(1) {
+        uint64_t start = stats_now_ns();
+        nanosleep(&ts, 0);
+        uint64_t now = stats_now_ns(), lag = now - start;
+        lag = lag > WATCHDOG_INTERVAL_MS * 1000000ULL ? lag - WATCHDOG_INTERVAL_MS * 1000000ULL : 0;
+        hist_record(&stats->heartbeat_lag, lag / 1000);
+        stats_max(&stats->heartbeat_lag_max_ns, lag);
+        sample_tcpinfo(now);
+        if(!stall_ns) continue;
+        if(lag > stall_ns)
+            logring_printf("stall: heartbeat ran %llu ms late", (unsigned long long) (lag / 1000000));
+        check_slots(now);
+    }
+    return 0;
+}
+
+int watchdog_start(unsigned stall_ms) {
+    stall_ns = stall_ms * 1000000ULL;
+    pthread_t pt;
+    if(pthread_create(&pt, 0, watchdog_thread, 0)) return -1;
+    pthread_detach(pt);
+    return 0;
+}
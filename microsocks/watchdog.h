@@ -0,0 +1,23 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdint.h>
+#include "conntab.h"
+
+/* health self-monitoring.
+   connection threads mark their conntab slot busy with the phase they
+   are in whenever they stop waiting on the network (a relay wakeup, a
+   handshake message) and idle again before they go back to waiting, the
+   time in between counts as one callback. a heartbeat thread measures
+   its own scheduling delay and reports connections that stay busy for
+   longer than the stall threshold, naming the phase. */
+
+#define WATCHDOG_INTERVAL_MS 100
+
+/* starts the heartbeat thread, stall_ms 0 only keeps the statistics */
+int watchdog_start(unsigned stall_ms);
+/* phase is an enum stats_phase. ends the previous callback, if any */
+void watchdog_busy(struct conntab_slot* slot, int phase, uint64_t now_ns);
+void watchdog_idle(struct conntab_slot* slot);
+
+#endif